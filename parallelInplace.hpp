@@ -18,55 +18,180 @@
 #include <algorithm>
 #include <cassert>
 #include <memory>
+#include <type_traits>
+
+#include <immintrin.h>
 
 #include <omp.h>
 
 namespace ParallelInplace {
 
 
-// Reorder an array in place with extra moves :
-// if we have [0 1 2 3 4 5 ; A B C]
-// it creates [A B C ; 0 1 2 3 4 5]
+////////////////////////////////////////////////////////////////
+// Rotation functions
+////////////////////////////////////////////////////////////////
+
+// The vectorized versions move the values as 32 or 64 bits words
 template <class NumType>
-inline void reorderShifting(NumType array[], const int lengthLeftPart, const int totalSize){
-    const int lengthRightPart = totalSize - lengthLeftPart;
-    // if one of the size is zero just return
-    if(lengthLeftPart == 0 || lengthRightPart == 0){
-        // do nothing
+struct CanUseSimdMoves{
+    static const bool value = (sizeof(NumType) == 4 || sizeof(NumType) == 8)
+                              && std::is_trivially_copyable<NumType>::value;
+};
+
+// Swap array1[0 ... length-1] and array2[0 ... length-1] (the two intervals must not overlap)
+template <class NumType>
+inline void swapBlocks(NumType array1[], NumType array2[], const int length){
+    if(!CanUseSimdMoves<NumType>::value){
+        std::swap_ranges(array1, array1 + length, array2);
         return;
     }
+    int* ptr1 = reinterpret_cast<int*>(array1);
+    int* ptr2 = reinterpret_cast<int*>(array2);
+    const int nbWords = length * int(sizeof(NumType)/sizeof(int));
+    int idx = 0;
+    for( ; idx + 16 <= nbWords ; idx += 16){
+        const __m512i values1 = _mm512_loadu_si512(ptr1 + idx);
+        const __m512i values2 = _mm512_loadu_si512(ptr2 + idx);
+        _mm512_storeu_si512(ptr1 + idx, values2);
+        _mm512_storeu_si512(ptr2 + idx, values1);
+    }
+    if(idx != nbWords){
+        const __mmask16 remaining = __mmask16(0xFFFF >> (16 - (nbWords - idx)));
+        const __m512i values1 = _mm512_maskz_loadu_epi32(remaining, ptr1 + idx);
+        const __m512i values2 = _mm512_maskz_loadu_epi32(remaining, ptr2 + idx);
+        _mm512_mask_storeu_epi32(ptr1 + idx, remaining, values2);
+        _mm512_mask_storeu_epi32(ptr2 + idx, remaining, values1);
+    }
+}
+
+// Reverse array[0 ... length-1], by exchanging reversed vectors from both ends
+template <class NumType>
+inline void reverseBlock(NumType array[], const int length){
+    if(!CanUseSimdMoves<NumType>::value){
+        std::reverse(array, array + length);
+        return;
+    }
+    const int nbValuesInVec = int(64/sizeof(NumType));
+    const __m512i idxReverse = (sizeof(NumType) == 4 ?
+                                    _mm512_set_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+                                  : _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7));
+    int left = 0;
+    int right = length;
+    while(right - left >= 2*nbValuesInVec){
+        const __m512i valuesLeft = _mm512_loadu_si512(array + left);
+        const __m512i valuesRight = _mm512_loadu_si512(array + right - nbValuesInVec);
+        if(sizeof(NumType) == 4){
+            _mm512_storeu_si512(array + left, _mm512_permutexvar_epi32(idxReverse, valuesRight));
+            _mm512_storeu_si512(array + right - nbValuesInVec, _mm512_permutexvar_epi32(idxReverse, valuesLeft));
+        }
+        else{
+            _mm512_storeu_si512(array + left, _mm512_permutexvar_epi64(idxReverse, valuesRight));
+            _mm512_storeu_si512(array + right - nbValuesInVec, _mm512_permutexvar_epi64(idxReverse, valuesLeft));
+        }
+        left += nbValuesInVec;
+        right -= nbValuesInVec;
+    }
+    std::reverse(array + left, array + right);
+}
 
+// Rotation by following the gcd(lengthLeftPart, totalSize) cycles of the permutation,
+// each value is moved once but the accesses are scattered
+template <class NumType>
+inline void reorderCycles(NumType array[], const int lengthLeftPart, const int totalSize){
+    int nbCycles = lengthLeftPart;
+    int other = totalSize;
+    while(other){
+        const int rest = nbCycles % other;
+        nbCycles = other;
+        other = rest;
+    }
+    const int lengthRightPart = totalSize - lengthLeftPart;
+    for(int idxCycle = 0 ; idxCycle < nbCycles ; ++idxCycle){
+        NumType moved = std::move(array[idxCycle]);
+        int current = idxCycle;
+        while(true){
+            // The value at current goes from its position in the left part to the right
+            const int next = (current >= lengthRightPart ? current - lengthRightPart : current + lengthLeftPart);
+            if(next == idxCycle){
+                break;
+            }
+            array[current] = std::move(array[next]);
+            current = next;
+        }
+        array[current] = std::move(moved);
+    }
+}
+
+// Rotation by exchanging blocks (the smallest part is swapped with the end
+// of the other one) while the two parts are larger than a vector,
+// returns the part of the array that remains to be rotated
+template <class NumType>
+inline NumType* reorderBlockSwap(NumType array[], int* lengthLeftPart, int* lengthRightPart){
+    const int nbValuesInVec = int(64/sizeof(NumType));
     // size of the partitions at first iteration
-    int workingLeftLength  = lengthLeftPart;
-    int workingRightLength = lengthRightPart;
-    // while the partitions have different sizes and none of them are null
-    while(workingLeftLength != workingRightLength && workingLeftLength && workingRightLength){
+    int workingLeftLength  = (*lengthLeftPart);
+    int workingRightLength = (*lengthRightPart);
+    // while the partitions have different sizes and none of them are small
+    while(workingLeftLength != workingRightLength
+          && workingLeftLength >= nbValuesInVec && workingRightLength >= nbValuesInVec){
         // if the left partition is the smallest
         if(workingLeftLength < workingRightLength){
             // move the left parition in the correct place
-            for(int idx = 0 ; idx < workingLeftLength ; ++idx){
-                std::swap(array[idx], array[idx + workingRightLength]);
-            }
+            swapBlocks(array, array + workingRightLength, workingLeftLength);
             // the new left partition is now the values that have been swaped
             workingRightLength = workingRightLength - workingLeftLength;
-            //workingLeftLength = workingLeftLength;
         }
         // if right partition is the smallest
         else{
             // move the right partition in the correct place
-            for(int idx = 0 ; idx < workingRightLength ; ++idx){
-                std::swap(array[idx], array[idx + workingLeftLength]);
-            }
+            swapBlocks(array, array + workingLeftLength, workingRightLength);
             // shift the pointer to skip the correct values
             array = (array + workingRightLength);
             // the new left partition is the previous right minus the swaped values
-            //workingRightLength = workingRightLength;
             workingLeftLength  = workingLeftLength - workingRightLength;
         }
     }
-    // if partitions have the same size
-    for(int idx = 0 ; idx < workingLeftLength ; ++idx){
-        std::swap(array[idx], array[idx + workingLeftLength]);
+    (*lengthLeftPart) = workingLeftLength;
+    (*lengthRightPart) = workingRightLength;
+    return array;
+}
+
+// Reorder an array in place with extra moves :
+// if we have [0 1 2 3 4 5 ; A B C]
+// it creates [A B C ; 0 1 2 3 4 5]
+// The blocks are swapped while the two parts are larger than a vector, then the
+// cycles are used for small arrays and the triple reversal otherwise (the block
+// swap would move a part smaller than a vector many times).
+template <class NumType>
+inline void reorderShifting(NumType array[], const int lengthLeftPart, const int totalSize){
+    const int lengthRightPart = totalSize - lengthLeftPart;
+    // if one of the size is zero just return
+    if(lengthLeftPart == 0 || lengthRightPart == 0){
+        // do nothing
+        return;
+    }
+
+    if(!CanUseSimdMoves<NumType>::value){
+        std::rotate(array, array + lengthLeftPart, array + totalSize);
+        return;
+    }
+
+    const int nbValuesInVec = int(64/sizeof(NumType));
+    int workingLeftLength  = lengthLeftPart;
+    int workingRightLength = lengthRightPart;
+    array = reorderBlockSwap(array, &workingLeftLength, &workingRightLength);
+    const int workingSize = workingLeftLength + workingRightLength;
+
+    if(workingLeftLength == workingRightLength){
+        swapBlocks(array, array + workingLeftLength, workingLeftLength);
+    }
+    else if(workingSize <= 2*nbValuesInVec){
+        reorderCycles(array, workingLeftLength, workingSize);
+    }
+    else{
+        reverseBlock(array, workingLeftLength);
+        reverseBlock(array + workingLeftLength, workingRightLength);
+        reverseBlock(array, workingSize);
     }
 }
 
@@ -212,6 +337,9 @@ inline void parallelMergeInPlace(NumType array[], const int sizeArray, int cente
                                  volatile WorkingInterval<NumType> intervals[], volatile int barrier[]){
     const int numThread = omp_get_thread_num();
 
+    // The slot of each thread goes through -1 (arrived), -2 (checked), 1 (interval
+    // ready) and 0 (done), another thread can already be one step further or
+    // in its next merge when a slot is read, so the waits accept the later steps
     for(int idxThread = 0 ; idxThread < numThreadsInvolved ; ++idxThread){
         if(idxThread + firstThread == numThread){
 #pragma omp atomic write
@@ -221,32 +349,17 @@ inline void parallelMergeInPlace(NumType array[], const int sizeArray, int cente
             int dataAreReady;
 #pragma omp atomic read
             dataAreReady = barrier[idxThread + firstThread];
-            if(dataAreReady == -1){
+            if(dataAreReady != 0){
                 break;
             }
         }
     }
 
     // Already in good shape
-    if(centerPosition == 0 || centerPosition == sizeArray || array[centerPosition-1] <= array[centerPosition]){
-        for(int idxThread = 0 ; idxThread < numThreadsInvolved ; ++idxThread){
-            if(idxThread + firstThread == numThread){
-        #pragma omp atomic write
-                barrier[numThread] = 0;
-            }
-            while(true){
-                int dataAreReady;
-        #pragma omp atomic read
-                dataAreReady = barrier[idxThread + firstThread];
-                if(dataAreReady == 0){
-                    break;
-                }
-            }
-        }
-
-        return;
-    }
+    const bool isMerged = (centerPosition == 0 || centerPosition == sizeArray
+                           || array[centerPosition-1] <= array[centerPosition]);
 
+    // No one moves a value before every thread has checked the array
     for(int idxThread = 0 ; idxThread < numThreadsInvolved ; ++idxThread){
         if(idxThread + firstThread == numThread){
     #pragma omp atomic write
@@ -256,37 +369,39 @@ inline void parallelMergeInPlace(NumType array[], const int sizeArray, int cente
             int dataAreReady;
     #pragma omp atomic read
             dataAreReady = barrier[idxThread + firstThread];
-            if(dataAreReady == -2){
+            if(dataAreReady != -1){
                 break;
             }
         }
     }
 
-    if(numThread == firstThread){
-        const int depthLimite = ffs(numThreadsInvolved) - 1;
-#pragma omp atomic write
-        barrier[numThread] = 1;
+    if(isMerged == false){
+        if(numThread == firstThread){
+            const int depthLimite = ffs(numThreadsInvolved) - 1;
+    #pragma omp atomic write
+            barrier[numThread] = 1;
 
-        parallelMergeInPlaceCore<NumType>(array, 0, centerPosition, sizeArray, 0, depthLimite,
-                                          intervals, barrier);
-    }
-    else{
-        while(true){
-            int myDataAreReady;
-#pragma omp atomic read
-            myDataAreReady = barrier[numThread];
-            if(myDataAreReady == 1){
-                break;
-            }
+            parallelMergeInPlaceCore<NumType>(array, 0, centerPosition, sizeArray, 0, depthLimite,
+                                              intervals, barrier);
         }
+        else{
+            while(true){
+                int myDataAreReady;
+    #pragma omp atomic read
+                myDataAreReady = barrier[numThread];
+                if(myDataAreReady == 1){
+                    break;
+                }
+            }
 
-        parallelMergeInPlaceCore<NumType>(intervals[numThread].array,
-                                          intervals[numThread].currentStart,
-                                          intervals[numThread].currentMiddle,
-                                          intervals[numThread].currentEnd,
-                                          intervals[numThread].level,
-                                          intervals[numThread].depthLimite,
-                                          intervals, barrier);
+            parallelMergeInPlaceCore<NumType>(intervals[numThread].array,
+                                              intervals[numThread].currentStart,
+                                              intervals[numThread].currentMiddle,
+                                              intervals[numThread].currentEnd,
+                                              intervals[numThread].level,
+                                              intervals[numThread].depthLimite,
+                                              intervals, barrier);
+        }
     }
 
     for(int idxThread = 0 ; idxThread < numThreadsInvolved ; ++idxThread){
@@ -298,7 +413,7 @@ inline void parallelMergeInPlace(NumType array[], const int sizeArray, int cente
             int dataAreReady;
 #pragma omp atomic read
             dataAreReady = barrier[idxThread + firstThread];
-            if(dataAreReady == 0){
+            if(dataAreReady == 0 || dataAreReady == -1){
                 break;
             }
         }
@@ -9,9 +9,24 @@
 /// Functions to call:
 /// Sort512::Sort(); to sort an array
 /// Sort512::SortOmp(); to sort in parallel
+/// Sort512::SortOmpMergePath(); to sort in parallel with merges split along the merge paths
+/// Sort512::SortOmpSampleSort(); to sort in parallel with an in-place sample sort
 /// Sort512::Partition512(); to partition
+/// Sort512::Partition512K(); to partition in several buckets
+/// Sort512::Partition512KCopy(); same with the buckets in another array
+/// Sort512::Partition512KOmp(); same in parallel
 /// Sort512::SmallSort16V(); to sort a small array
 /// (should be less than 16 AVX512 vectors)
+/// Sort512::NthElement(); to put the kth value in its sorted position
+/// Sort512::PartialSort(); to sort only the k lowest values
+/// Sort512::MultiSelect(); to put several ranks in their sorted positions
+/// Sort512::SortUnique(); to sort and remove the duplicates
+/// Sort512::SortRunLength(); to sort and get the distinct values with their counts
+/// Sort512::MergePathSplit(); to find where the merge of two sorted arrays is split
+/// Sort512::Merge(); to merge two sorted arrays
+/// Sort512::MergeInsert(); to insert a batch of values in a sorted array
+/// Sort512::SearchSorted(); to find the positions of many values in a sorted array
+/// Sort512::SearchSortedMerge(); same for sorted values
 ///
 /// To compile such flags can be used to enable avx 512 and openmp:
 /// - KNL
@@ -28,9 +43,16 @@
 
 #include <immintrin.h>
 #include <climits>
+#include <cstdint>
 #include <cfloat>
 #include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
 
 #if defined(_OPENMP)
 #include <omp.h>
@@ -5944,6 +5966,28 @@ static inline IndexType CoreSortPartition(SortType array[], const IndexType left
     return  Partition512(array, left, right, pivot);
 }
 
+// Greatest value lower than value
+inline int CoreSortPreviousValue(const int value){
+    return value - 1;
+}
+
+inline double CoreSortPreviousValue(const double value){
+    return std::nextafter(value, -std::numeric_limits<double>::infinity());
+}
+
+// When most of the values are on the left of the pivot, the values equal to
+// the pivot are moved next to it (to avoid a quadratic complexity with many
+// duplicates), returns the position of the first value equal to the pivot
+template <class SortType, class IndexType = size_t>
+static inline IndexType CoreSortEqualPartition(SortType array[], const IndexType left, const IndexType part,
+                                               const IndexType right){
+    if(left < part && (right-left)/8*7 < part-left
+            && array[part] != std::numeric_limits<SortType>::lowest()){
+        return Partition512(array, left, part-1, CoreSortPreviousValue(array[part]));
+    }
+    return part;
+}
+
 template <class SortType, class IndexType = size_t>
 static void CoreSort(SortType array[], const IndexType left, const IndexType right){
     static const int SortLimite = 16*64/sizeof(SortType);
@@ -5952,8 +5996,9 @@ static void CoreSort(SortType array[], const IndexType left, const IndexType rig
     }
     else{
         const IndexType part = CoreSortPivotPartition<SortType,IndexType>(array, left, right);
+        const IndexType firstEqual = CoreSortEqualPartition<SortType,IndexType>(array, left, part, right);
         if(part+1 < right) CoreSort<SortType,IndexType>(array,part+1,right);
-        if(part && left < part-1)  CoreSort<SortType,IndexType>(array,left,part - 1);
+        if(firstEqual && left < firstEqual-1)  CoreSort<SortType,IndexType>(array,left,firstEqual - 1);
     }
 }
 
@@ -5962,9 +6007,1348 @@ static inline void Sort(SortType array[], const IndexType size){
     CoreSort<SortType,IndexType>(array, 0, size-1);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Selection
+////////////////////////////////////////////////////////////////////////////////
+
+template <class SortType, class IndexType>
+inline IndexType CoreSelectMedian3(const SortType array[], const IndexType idx1, const IndexType idx2,
+                                   const IndexType idx3){
+    if(array[idx1] < array[idx2]){
+        return (array[idx2] < array[idx3] ? idx2 : (array[idx1] < array[idx3] ? idx3 : idx1));
+    }
+    return (array[idx1] < array[idx3] ? idx1 : (array[idx2] < array[idx3] ? idx3 : idx2));
+}
+
+// Pseudo-median of nine values spread over the interval (median of three medians)
+template <class SortType, class IndexType>
+inline IndexType CoreSelectGetPivot(const SortType array[], const IndexType left, const IndexType right){
+    const IndexType step = (right-left)/8;
+    const IndexType median1 = CoreSelectMedian3(array, left, left + step, left + 2*step);
+    const IndexType median2 = CoreSelectMedian3(array, left + 3*step, left + 4*step, left + 5*step);
+    const IndexType median3 = CoreSelectMedian3(array, left + 6*step, left + 7*step, right);
+    return CoreSelectMedian3(array, median1, median2, median3);
+}
+
+template <class SortType, class IndexType>
+inline IndexType CoreSelectPivotPartition(SortType array[], const IndexType left, const IndexType right){
+    const IndexType pivotIdx = CoreSelectGetPivot(array, left, right);
+    std::swap(array[pivotIdx], array[right]);
+    const IndexType part = Partition512(array, left, right-1, array[right]);
+    std::swap(array[part], array[right]);
+    return part;
+}
+
+// Partition array[left ... right] until the value at position kth is in its
+// sorted position, only the side that contains kth is partitioned again.
+// The number of partitions is limited, the interval is then sorted.
+template <class SortType, class IndexType>
+inline void CoreSelect(SortType array[], IndexType left, IndexType right, const IndexType kth){
+    static const int SortLimite = 16*64/sizeof(SortType);
+    int nbPartitionsLeft = 0;
+    for(IndexType size = right-left+1 ; size ; size >>= 1){
+        nbPartitionsLeft += 2;
+    }
+    while(SortLimite <= right-left){
+        if(nbPartitionsLeft == 0){
+            CoreSort<SortType,IndexType>(array, left, right);
+            return;
+        }
+        nbPartitionsLeft -= 1;
+        const IndexType part = CoreSelectPivotPartition<SortType,IndexType>(array, left, right);
+        if(part < kth){
+            left = part + 1;
+        }
+        else{
+            const IndexType firstEqual = CoreSortEqualPartition<SortType,IndexType>(array, left, part, right);
+            if(firstEqual <= kth){
+                return;
+            }
+            right = firstEqual - 1;
+        }
+    }
+    SmallSort16V(array+left, right-left+1);
+}
+
+// Put in array[kth] the value that would be there if the array was sorted,
+// the values before are lower or equal and the values after are greater or equal
+template <class SortType, class IndexType = size_t>
+static inline void NthElement(SortType array[], const IndexType size, const IndexType kth){
+    if(kth < size){
+        CoreSelect<SortType,IndexType>(array, 0, size-1, kth);
+    }
+}
+
+// Sort the nbFirst lowest values in array[0 ... nbFirst-1], the other values
+// are greater or equal (in no particular order)
+template <class SortType, class IndexType = size_t>
+static inline void PartialSort(SortType array[], const IndexType size, const IndexType nbFirst){
+    if(nbFirst == 0 || size == 0){
+        return;
+    }
+    if(nbFirst < size){
+        CoreSelect<SortType,IndexType>(array, 0, size-1, nbFirst-1);
+    }
+    CoreSort<SortType,IndexType>(array, 0, std::min(nbFirst, size)-1);
+}
+
+// Partition array[left ... right] and continue only in the sides that contain
+// some of the sorted ranks[firstRank ... lastRank-1]
+template <class SortType, class IndexType>
+inline void CoreMultiSelect(SortType array[], IndexType left, IndexType right, const IndexType ranks[],
+                            IndexType firstRank, const IndexType lastRank, int nbPartitionsLeft){
+    static const int SortLimite = 16*64/sizeof(SortType);
+    while(firstRank != lastRank && SortLimite <= right-left){
+        if(lastRank - firstRank == 1){
+            CoreSelect<SortType,IndexType>(array, left, right, ranks[firstRank]);
+            return;
+        }
+        if(nbPartitionsLeft == 0){
+            CoreSort<SortType,IndexType>(array, left, right);
+            return;
+        }
+        nbPartitionsLeft -= 1;
+        const IndexType part = CoreSelectPivotPartition<SortType,IndexType>(array, left, right);
+        const IndexType firstEqual = CoreSortEqualPartition<SortType,IndexType>(array, left, part, right);
+        // The ranks from firstEqual to part are done
+        const IndexType lastLowerRank = IndexType(std::lower_bound(&ranks[firstRank], &ranks[lastRank], firstEqual) - ranks);
+        if(firstRank != lastLowerRank){
+            CoreMultiSelect<SortType,IndexType>(array, left, firstEqual-1, ranks, firstRank, lastLowerRank, nbPartitionsLeft);
+        }
+        firstRank = IndexType(std::upper_bound(&ranks[lastLowerRank], &ranks[lastRank], part) - ranks);
+        left = part + 1;
+    }
+    if(firstRank != lastRank){
+        SmallSort16V(array+left, right-left+1);
+    }
+}
+
+// Put the values at the given ranks in their sorted positions with a single
+// recursive partitioning (the values between two ranks are in no particular order)
+template <class SortType, class IndexType = size_t>
+static inline void MultiSelect(SortType array[], const IndexType size, const IndexType ranks[], const IndexType nbRanks){
+    std::vector<IndexType> sortedRanks;
+    for(IndexType idxRank = 0 ; idxRank < nbRanks ; ++idxRank){
+        if(ranks[idxRank] < size){
+            sortedRanks.push_back(ranks[idxRank]);
+        }
+    }
+    if(sortedRanks.empty()){
+        return;
+    }
+    std::sort(sortedRanks.begin(), sortedRanks.end());
+    sortedRanks.erase(std::unique(sortedRanks.begin(), sortedRanks.end()), sortedRanks.end());
+
+    int nbPartitions = 0;
+    for(IndexType sizeLeft = size ; sizeLeft ; sizeLeft >>= 1){
+        nbPartitions += 2;
+    }
+    CoreMultiSelect<SortType,IndexType>(array, 0, size-1, sortedRanks.data(), 0, IndexType(sortedRanks.size()),
+                                        nbPartitions);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Merge path
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the number of values that come from array1 in the first diag values
+// of the merge of array1 and array2 (the values of array1 go first when equal)
+template <class SortType, class IndexType = size_t>
+inline IndexType MergePathSplit(const SortType array1[], const IndexType size1,
+                                const SortType array2[], const IndexType size2, const IndexType diag){
+    IndexType low = (diag > size2 ? diag - size2 : 0);
+    IndexType high = std::min(diag, size1);
+    while(low < high){
+        const IndexType middle = low + (high-low)/2;
+        if(array1[middle] <= array2[diag - middle - 1]){
+            low = middle + 1;
+        }
+        else{
+            high = middle;
+        }
+    }
+    return low;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Merge
+////////////////////////////////////////////////////////////////////////////////
+
+template <class SortType>
+struct CoreMergeVec;
+
+template <>
+struct CoreMergeVec<int> {
+    static const int S = 16;
+    typedef __m512i VecType;
+
+    static inline VecType Load(const int* ptr){
+        return _mm512_loadu_si512(ptr);
+    }
+    static inline void Store(int* ptr, const VecType vec){
+        _mm512_storeu_si512(ptr, vec);
+    }
+};
+
+template <>
+struct CoreMergeVec<double> {
+    static const int S = 8;
+    typedef __m512d VecType;
+
+    static inline VecType Load(const double* ptr){
+        return _mm512_loadu_pd(ptr);
+    }
+    static inline void Store(double* ptr, const VecType vec){
+        _mm512_storeu_pd(ptr, vec);
+    }
+};
+
+// Scalar merge of the three sorted arrays, the values of the array with the lowest
+// value are copied up to the lowest value of the others (which are often small)
+template <class SortType, class IndexType>
+inline void CoreMergeTail(const SortType* arrays[3], const IndexType sizes[3], SortType dest[]){
+    IndexType positions[3] = {0, 0, 0};
+    while(true){
+        int selected = -1;
+        int nbNotEmpty = 0;
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(positions[idxArray] != sizes[idxArray]){
+                nbNotEmpty += 1;
+                if(selected == -1 || arrays[idxArray][positions[idxArray]] < arrays[selected][positions[selected]]){
+                    selected = idxArray;
+                }
+            }
+        }
+        if(nbNotEmpty <= 1){
+            if(selected != -1){
+                std::copy(&arrays[selected][positions[selected]], &arrays[selected][sizes[selected]], dest);
+            }
+            return;
+        }
+        bool hasLimit = false;
+        SortType limit = SortType();
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(idxArray != selected && positions[idxArray] != sizes[idxArray]
+                    && (hasLimit == false || arrays[idxArray][positions[idxArray]] < limit)){
+                limit = arrays[idxArray][positions[idxArray]];
+                hasLimit = true;
+            }
+        }
+        const SortType* runEnd = std::upper_bound(&arrays[selected][positions[selected]] + 1,
+                                                  &arrays[selected][sizes[selected]], limit);
+        const IndexType runSize = IndexType(runEnd - &arrays[selected][positions[selected]]);
+        dest = std::copy(&arrays[selected][positions[selected]], runEnd, dest);
+        positions[selected] += runSize;
+    }
+}
+
+// Merge two sorted arrays in dest, one vector at a time: the next vector is
+// taken from the array with the lowest next value and merged with the vector of
+// the greatest values by the bitonic network, the lowest values are stored.
+// dest can end where array2 starts (dest + size1 == array2) as the values
+// of array2 are loaded before being overwritten.
+template <class SortType, class IndexType = size_t>
+static inline void Merge(const SortType array1[], const IndexType size1,
+                         const SortType array2[], const IndexType size2, SortType dest[]){
+    typedef CoreMergeVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    IndexType idx1 = 0;
+    IndexType idx2 = 0;
+    IndexType nbOut = 0;
+    SortType greatestValues[Vec::S];
+    IndexType nbGreatest = 0;
+
+    if(size1 >= S && size2 >= S){
+        typename Vec::VecType lowest = Vec::Load(&array1[0]);
+        typename Vec::VecType greatest = Vec::Load(&array2[0]);
+        idx1 = S;
+        idx2 = S;
+        while(true){
+            CoreExchangeSort2V(lowest, greatest);
+            Vec::Store(&dest[nbOut], lowest);
+            nbOut += S;
+
+            // The next vector must come from the array with the lowest value
+            if(idx1 != size1 && (idx2 == size2 || array1[idx1] <= array2[idx2])){
+                if(idx1 + S > size1) break;
+                lowest = Vec::Load(&array1[idx1]);
+                idx1 += S;
+            }
+            else if(idx2 != size2){
+                if(idx2 + S > size2) break;
+                lowest = Vec::Load(&array2[idx2]);
+                idx2 += S;
+            }
+            else{
+                break;
+            }
+        }
+        Vec::Store(greatestValues, greatest);
+        nbGreatest = S;
+    }
+
+    const SortType* arrays[3] = {greatestValues, &array1[idx1], &array2[idx2]};
+    const IndexType sizes[3] = {nbGreatest, size1 - idx1, size2 - idx2};
+    CoreMergeTail(arrays, sizes, &dest[nbOut]);
+}
+
+// Merge array[first ... middle-1] and array[middle ... last-1],
+// the first part is copied in buffer (of at least middle-first values)
+// and merged with the second one
+template <class SortType, class IndexType = size_t>
+static inline void CoreMergeInPlace(SortType array[], const IndexType first, const IndexType middle, const IndexType last,
+                                    SortType buffer[]){
+    if(first == middle || middle == last || array[middle-1] <= array[middle]){
+        return;
+    }
+    std::copy(&array[first], &array[middle], buffer);
+    Merge<SortType,IndexType>(buffer, middle-first, &array[middle], last-middle, &array[first]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Merge insert
+////////////////////////////////////////////////////////////////////////////////
+
+// Scalar merge of the last values from their ends: the values of the array with
+// the greatest value are copied down to the greatest value of the others.
+// One array can be the beginning of the destination, it is not moved when
+// it is the last one.
+template <class SortType, class IndexType>
+inline void CoreMergeBackwardTail(const SortType* arrays[3], IndexType sizes[3], SortType destEnd[]){
+    while(true){
+        int selected = -1;
+        int nbNotEmpty = 0;
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(sizes[idxArray]){
+                nbNotEmpty += 1;
+                if(selected == -1 || arrays[selected][sizes[selected]-1] < arrays[idxArray][sizes[idxArray]-1]){
+                    selected = idxArray;
+                }
+            }
+        }
+        if(nbNotEmpty <= 1){
+            if(selected != -1 && &arrays[selected][sizes[selected]] != destEnd){
+                std::copy_backward(&arrays[selected][0], &arrays[selected][sizes[selected]], destEnd);
+            }
+            return;
+        }
+        bool hasLimit = false;
+        SortType limit = SortType();
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(idxArray != selected && sizes[idxArray]
+                    && (hasLimit == false || limit < arrays[idxArray][sizes[idxArray]-1])){
+                limit = arrays[idxArray][sizes[idxArray]-1];
+                hasLimit = true;
+            }
+        }
+        const SortType* runStart = std::lower_bound(&arrays[selected][0], &arrays[selected][sizes[selected]-1], limit);
+        destEnd = std::copy_backward(runStart, &arrays[selected][sizes[selected]], destEnd);
+        sizes[selected] = IndexType(runStart - &arrays[selected][0]);
+    }
+}
+
+// Merge the sorted batch into array[0 ... size-1] from the end (the array must
+// have room for size+batchSize values), the next vector is taken from the array
+// with the greatest last value and merged with the vector of the lowest values,
+// the greatest values are stored. The values of the array that are lower than
+// the batch are not moved.
+template <class SortType, class IndexType>
+inline void CoreMergeBackward(SortType array[], const IndexType size, const SortType batch[], const IndexType batchSize){
+    typedef CoreMergeVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    IndexType idxArray = size;
+    IndexType idxBatch = batchSize;
+    IndexType idxOut = size + batchSize;
+    SortType lowestValues[Vec::S];
+    IndexType nbLowest = 0;
+
+    if(size >= S && batchSize >= S){
+        typename Vec::VecType lowest;
+        typename Vec::VecType greatest;
+        if(batch[idxBatch-1] < array[idxArray-1]){
+            idxArray -= S;
+            lowest = Vec::Load(&array[idxArray]);
+        }
+        else{
+            idxBatch -= S;
+            lowest = Vec::Load(&batch[idxBatch]);
+        }
+        while(idxArray >= S && idxBatch >= S){
+            if(batch[idxBatch-1] < array[idxArray-1]){
+                idxArray -= S;
+                greatest = Vec::Load(&array[idxArray]);
+            }
+            else{
+                idxBatch -= S;
+                greatest = Vec::Load(&batch[idxBatch]);
+            }
+            CoreExchangeSort2V(lowest, greatest);
+            idxOut -= S;
+            Vec::Store(&array[idxOut], greatest);
+        }
+        Vec::Store(lowestValues, lowest);
+        nbLowest = S;
+    }
+
+    const SortType* arrays[3] = {array, batch, lowestValues};
+    IndexType sizes[3] = {idxArray, idxBatch, nbLowest};
+    CoreMergeBackwardTail(arrays, sizes, &array[idxOut]);
+}
+
+// Insert the batch in the sorted array, sorted must have room for size+batchSize
+// values. The batch is sorted (in place) and merged from the end of the array,
+// such that only the values greater than the lowest one of the batch are moved
+template <class SortType, class IndexType = size_t>
+static inline void MergeInsert(SortType sorted[], const IndexType size, SortType batch[], const IndexType batchSize){
+    if(batchSize == 0){
+        return;
+    }
+    Sort<SortType,IndexType>(batch, batchSize);
+    CoreMergeBackward<SortType,IndexType>(sorted, size, batch, batchSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Search sorted
+////////////////////////////////////////////////////////////////////////////////
+
+// Below this number of values between two probes the next probes are not
+// prefetched (with the gather prefetch of KNL)
+const size_t SearchPrefetchLimit = 4096;
+
+template <class SortType>
+struct CoreSearchVec;
+
+template <>
+struct CoreSearchVec<int> {
+    static const int S = 16;
+    typedef __mmask16 Mask;
+    typedef __m512i VecType;
+    // One 32 bits position per query
+    typedef __m512i PositionType;
+    typedef int PositionScalar;
+
+    static inline Mask FirstLanes(const int nbLanes){
+        return Mask(0xFFFF >> (S - nbLanes));
+    }
+    static inline VecType Load(const Mask mask, const int* ptr){
+        return _mm512_maskz_loadu_epi32(mask, ptr);
+    }
+    static inline PositionType SetPositions(const int position){
+        return _mm512_set1_epi32(position);
+    }
+    static inline PositionType AddPositions(const PositionType positions, const Mask mask, const PositionType step){
+        return _mm512_mask_add_epi32(positions, mask, positions, step);
+    }
+    // Lane i is set if sorted[positions[i]] < queries[i]
+    static inline Mask Lower(const int* sorted, const PositionType positions, const VecType queries){
+        return _mm512_cmp_epi32_mask(_mm512_i32gather_epi32(positions, sorted, 4), queries, _MM_CMPINT_LT);
+    }
+    static inline void StorePositions(int* ptr, const PositionType positions){
+        _mm512_storeu_si512(ptr, positions);
+    }
+#if defined(__AVX512PF__)
+    static inline void Prefetch(const int* sorted, const PositionType positions){
+        _mm512_prefetch_i32gather_ps(positions, sorted, 4, _MM_HINT_T0);
+    }
+#endif
+    // Number of values lower than value in ptr[0 ... nbValues-1], nbValues <= S
+    static inline int CountLower(const int* ptr, const int nbValues, const int value){
+        const Mask remaining = FirstLanes(nbValues);
+        return popcount(_mm512_mask_cmp_epi32_mask(remaining, _mm512_maskz_loadu_epi32(remaining, ptr),
+                                                   _mm512_set1_epi32(value), _MM_CMPINT_LT));
+    }
+};
+
+template <>
+struct CoreSearchVec<double> {
+    static const int S = 8;
+    typedef __mmask8 Mask;
+    typedef __m512d VecType;
+    // One 64 bits position per query
+    typedef __m512i PositionType;
+    typedef long long PositionScalar;
+
+    static inline Mask FirstLanes(const int nbLanes){
+        return Mask(0xFF >> (S - nbLanes));
+    }
+    static inline VecType Load(const Mask mask, const double* ptr){
+        return _mm512_maskz_loadu_pd(mask, ptr);
+    }
+    static inline PositionType SetPositions(const long long position){
+        return _mm512_set1_epi64(position);
+    }
+    static inline PositionType AddPositions(const PositionType positions, const Mask mask, const PositionType step){
+        return _mm512_mask_add_epi64(positions, mask, positions, step);
+    }
+    static inline Mask Lower(const double* sorted, const PositionType positions, const VecType queries){
+        return _mm512_cmp_pd_mask(_mm512_i64gather_pd(positions, sorted, 8), queries, _CMP_LT_OQ);
+    }
+    static inline void StorePositions(long long* ptr, const PositionType positions){
+        _mm512_storeu_si512(ptr, positions);
+    }
+#if defined(__AVX512PF__)
+    static inline void Prefetch(const double* sorted, const PositionType positions){
+        _mm512_prefetch_i64gather_pd(positions, sorted, 8, _MM_HINT_T0);
+    }
+#endif
+    static inline int CountLower(const double* ptr, const int nbValues, const double value){
+        const Mask remaining = FirstLanes(nbValues);
+        return popcount(_mm512_mask_cmp_pd_mask(remaining, _mm512_maskz_loadu_pd(remaining, ptr),
+                                                _mm512_set1_pd(value), _CMP_LT_OQ));
+    }
+};
+
+// Branchless binary search of several vectors of queries at the same time:
+// all the queries probe at the same distance from their current position
+// (one gather per vector) and move forward if the value probed is lower,
+// the vectors are independent such that their gathers overlap.
+// With AVX512PF the two possible probes of the next step are prefetched when
+// they are far (a prefetch per lane without it costs more than it saves).
+template <class SortType, class IndexType>
+inline void CoreSearchSorted(const SortType sorted[], const IndexType size, const SortType queries[],
+                             const IndexType nbQueries, IndexType out[]){
+    typedef CoreSearchVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    const int NbVecs = 8;
+
+    for(IndexType idxQuery = 0 ; idxQuery < nbQueries ; idxQuery += NbVecs*S){
+        typename Vec::VecType queriesVec[NbVecs];
+        typename Vec::PositionType positions[NbVecs];
+        for(int idxVec = 0 ; idxVec < NbVecs ; ++idxVec){
+            const IndexType first = std::min(nbQueries, idxQuery + idxVec*S);
+            queriesVec[idxVec] = Vec::Load(Vec::FirstLanes(int(std::min(S, nbQueries - first))), &queries[first]);
+            positions[idxVec] = Vec::SetPositions(0);
+        }
+
+        IndexType length = size;
+        while(length > 1){
+            const IndexType half = length/2;
+            const typename Vec::PositionType step = Vec::SetPositions(typename Vec::PositionScalar(half));
+#if defined(__AVX512PF__)
+            if(half >= SearchPrefetchLimit){
+                const IndexType nextHalf = (length - half)/2;
+                for(int idxVec = 0 ; idxVec < NbVecs ; ++idxVec){
+                    Vec::Prefetch(&sorted[nextHalf], positions[idxVec]);
+                    Vec::Prefetch(&sorted[half + nextHalf], positions[idxVec]);
+                }
+            }
+#endif
+            for(int idxVec = 0 ; idxVec < NbVecs ; ++idxVec){
+                positions[idxVec] = Vec::AddPositions(positions[idxVec],
+                                                      Vec::Lower(&sorted[half], positions[idxVec], queriesVec[idxVec]),
+                                                      step);
+            }
+            length -= half;
+        }
+
+        for(int idxVec = 0 ; idxVec < NbVecs ; ++idxVec){
+            positions[idxVec] = Vec::AddPositions(positions[idxVec],
+                                                  Vec::Lower(sorted, positions[idxVec], queriesVec[idxVec]),
+                                                  Vec::SetPositions(1));
+            typename Vec::PositionScalar lanes[Vec::S];
+            Vec::StorePositions(lanes, positions[idxVec]);
+            const IndexType first = idxQuery + idxVec*S;
+            for(IndexType idxLane = 0 ; idxLane < S && first + idxLane < nbQueries ; ++idxLane){
+                out[first + idxLane] = IndexType(lanes[idxLane]);
+            }
+        }
+    }
+}
+
+// out[idx] is the position of the first value of sorted not lower than
+// queries[idx] (as std::lower_bound), the queries can be in any order
+template <class SortType, class IndexType = size_t>
+static inline void SearchSorted(const SortType sorted[], const IndexType size, const SortType queries[],
+                                const IndexType nbQueries, IndexType out[]){
+    if(size == 0){
+        std::fill(out, out + nbQueries, IndexType(0));
+    }
+    else if(sizeof(typename CoreSearchVec<SortType>::PositionScalar) == 4 && size_t(size) > size_t(INT_MAX)){
+        // The positions would not fit in the lanes
+        for(IndexType idxQuery = 0 ; idxQuery < nbQueries ; ++idxQuery){
+            out[idxQuery] = IndexType(std::lower_bound(sorted, sorted + size, queries[idxQuery]) - sorted);
+        }
+    }
+    else{
+        CoreSearchSorted<SortType,IndexType>(sorted, size, queries, nbQueries, out);
+    }
+}
+
+// Same as SearchSorted but the queries must be sorted: the sorted array
+// is scanned once, for each query the vectors entirely lower are skipped
+// (by an exponential search if there are many) and the values lower
+// in the last vector are counted with a vector compare
+template <class SortType, class IndexType = size_t>
+static inline void SearchSortedMerge(const SortType sorted[], const IndexType size, const SortType queries[],
+                                     const IndexType nbQueries, IndexType out[]){
+    typedef CoreSearchVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    // All the values before position are lower than the current query
+    IndexType position = 0;
+    for(IndexType idxQuery = 0 ; idxQuery < nbQueries ; ++idxQuery){
+        const SortType query = queries[idxQuery];
+        IndexType step = S;
+        IndexType high = position + step;
+        while(high < size && sorted[high - 1] < query){
+            position = high;
+            step *= 2;
+            high = position + step;
+        }
+        high = std::min(high, size);
+        while(high - position > S){
+            const IndexType middle = position + (high - position)/2;
+            if(sorted[middle - 1] < query){
+                position = middle;
+            }
+            else{
+                high = middle;
+            }
+        }
+        position += IndexType(Vec::CountLower(&sorted[position], int(high - position), query));
+        out[idxQuery] = position;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Multi-way partition
+////////////////////////////////////////////////////////////////////////////////
+
+// Size in bytes of the blocks moved by the in-place multi-way partition
+// (there is a buffer of a block per bucket)
+const size_t PartitionKBlockBytes = 2048;
+
+// Not lower than any value to partition or search
+template <class SortType>
+inline SortType CorePadValue(){
+    return std::numeric_limits<SortType>::max();
+}
+
+template <>
+inline double CorePadValue<double>(){
+    return std::numeric_limits<double>::infinity();
+}
+
+// Not greater than any value to partition
+template <class SortType>
+inline SortType CoreLeastValue(){
+    return std::numeric_limits<SortType>::lowest();
+}
+
+template <>
+inline double CoreLeastValue<double>(){
+    return -std::numeric_limits<double>::infinity();
+}
+
+template <class SortType>
+struct CorePartitionKVec;
+
+template <>
+struct CorePartitionKVec<int> {
+    static const int S = 16;
+    // Log2 of the number of values in two vectors
+    static const int PairShift = 5;
+    typedef __mmask16 Mask;
+    typedef __m512i VecType;
+    // One 32 bits position in the tree per value
+    typedef __m512i PositionType;
+
+    static inline Mask FirstLanes(const int nbLanes){
+        return Mask(0xFFFF >> (S - nbLanes));
+    }
+    static inline VecType Load(const Mask mask, const int* ptr){
+        return _mm512_maskz_loadu_epi32(mask, ptr);
+    }
+    // The lanes from firstLane of a cache line (64 bytes aligned)
+    static inline void StoreLine(int* line, const int firstLane, const VecType vec){
+        if(firstLane == 0){
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(line), vec);
+        }
+        else{
+            _mm512_mask_storeu_epi32(line, Mask(~FirstLanes(firstLane)), vec);
+        }
+    }
+    static inline PositionType SetPositions(const int position){
+        return _mm512_set1_epi32(position);
+    }
+    // tree[positions] with base <= positions < 2*base (a level of the tree):
+    // permutes of two vectors of the level, or a gather if it has more than 8 vectors
+    static inline VecType Nodes(const int* tree, const int base, const PositionType positions){
+        if(base <= S){
+            return _mm512_permutex2var_epi32(_mm512_loadu_si512(tree), positions, _mm512_loadu_si512(tree + S));
+        }
+        if(base <= 8*S){
+            const PositionType pairs = _mm512_srli_epi32(positions, PairShift);
+            VecType nodes = _mm512_setzero_si512();
+            for(int first = base ; first < 2*base ; first += 2*S){
+                nodes = _mm512_mask_mov_epi32(nodes, _mm512_cmpeq_epi32_mask(pairs, _mm512_set1_epi32(first >> PairShift)),
+                                              _mm512_permutex2var_epi32(_mm512_loadu_si512(tree + first), positions,
+                                                                        _mm512_loadu_si512(tree + first + S)));
+            }
+            return nodes;
+        }
+        return _mm512_i32gather_epi32(positions, tree, 4);
+    }
+    // Go to the child 2p+1 where the node is lower than the value, 2p otherwise
+    static inline PositionType Descend(const PositionType positions, const VecType nodes, const VecType values){
+        const PositionType children = _mm512_add_epi32(positions, positions);
+        return _mm512_mask_add_epi32(children, _mm512_cmp_epi32_mask(nodes, values, _MM_CMPINT_LT),
+                                     children, _mm512_set1_epi32(1));
+    }
+    static inline void StoreBuckets(int* ptr, const PositionType positions, const int firstLeaf){
+        _mm512_storeu_si512(ptr, _mm512_sub_epi32(positions, _mm512_set1_epi32(firstLeaf)));
+    }
+};
+
+template <>
+struct CorePartitionKVec<double> {
+    static const int S = 8;
+    static const int PairShift = 4;
+    typedef __mmask8 Mask;
+    typedef __m512d VecType;
+    // One 64 bits position in the tree per value
+    typedef __m512i PositionType;
+
+    static inline Mask FirstLanes(const int nbLanes){
+        return Mask(0xFF >> (S - nbLanes));
+    }
+    static inline VecType Load(const Mask mask, const double* ptr){
+        return _mm512_maskz_loadu_pd(mask, ptr);
+    }
+    static inline void StoreLine(double* line, const int firstLane, const VecType vec){
+        if(firstLane == 0){
+            _mm512_stream_pd(line, vec);
+        }
+        else{
+            _mm512_mask_storeu_pd(line, Mask(~FirstLanes(firstLane)), vec);
+        }
+    }
+    static inline PositionType SetPositions(const int position){
+        return _mm512_set1_epi64(position);
+    }
+    static inline VecType Nodes(const double* tree, const int base, const PositionType positions){
+        if(base <= S){
+            return _mm512_permutex2var_pd(_mm512_loadu_pd(tree), positions, _mm512_loadu_pd(tree + S));
+        }
+        if(base <= 8*S){
+            const PositionType pairs = _mm512_srli_epi64(positions, PairShift);
+            VecType nodes = _mm512_setzero_pd();
+            for(int first = base ; first < 2*base ; first += 2*S){
+                nodes = _mm512_mask_mov_pd(nodes, _mm512_cmpeq_epi64_mask(pairs, _mm512_set1_epi64(first >> PairShift)),
+                                           _mm512_permutex2var_pd(_mm512_loadu_pd(tree + first), positions,
+                                                                  _mm512_loadu_pd(tree + first + S)));
+            }
+            return nodes;
+        }
+        return _mm512_i64gather_pd(positions, tree, 8);
+    }
+    static inline PositionType Descend(const PositionType positions, const VecType nodes, const VecType values){
+        const PositionType children = _mm512_add_epi64(positions, positions);
+        return _mm512_mask_add_epi64(children, _mm512_cmp_pd_mask(nodes, values, _CMP_LT_OQ),
+                                     children, _mm512_set1_epi64(1));
+    }
+    static inline void StoreBuckets(int* ptr, const PositionType positions, const int firstLeaf){
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr),
+                            _mm512_cvtepi64_epi32(_mm512_sub_epi64(positions, _mm512_set1_epi64(firstLeaf))));
+    }
+};
+
+// The splitters in an implicit binary search tree, tree[1] is the root and
+// the children of tree[p] are tree[2p] and tree[2p+1], padded to
+// nbLeaves-1 nodes (nbLeaves a power of 2), the leaf reached by a value is
+// its bucket (the number of splitters lower than it)
+template <class SortType>
+struct CorePartitionKTree {
+    std::vector<SortType> tree;
+    int nbLeaves;
+
+    CorePartitionKTree(const SortType splitters[], const size_t nbBuckets) : nbLeaves(1){
+        while(size_t(nbLeaves) < nbBuckets){
+            nbLeaves *= 2;
+        }
+        // Also room for the two vectors read for the first levels
+        tree.resize(std::max(size_t(nbLeaves), size_t(2*CorePartitionKVec<SortType>::S)), CorePadValue<SortType>());
+        // The node j of a level with base nodes is the splitter (2j+1)*(nbLeaves/(2 base)) - 1
+        for(int base = 1 ; base < nbLeaves ; base *= 2){
+            const int spacing = nbLeaves/(2*base);
+            for(int idxNode = 0 ; idxNode < base ; ++idxNode){
+                const size_t idxSplitter = size_t((2*idxNode + 1)*spacing - 1);
+                if(idxSplitter + 1 < nbBuckets){
+                    tree[base + idxNode] = splitters[idxSplitter];
+                }
+            }
+        }
+    }
+
+    int bucket(const SortType value) const{
+        int position = 1;
+        while(position < nbLeaves){
+            position = 2*position + (tree[position] < value ? 1 : 0);
+        }
+        return position - nbLeaves;
+    }
+};
+
+// buckets[idx] is the bucket of values[idx], all the values of a vector go
+// down the tree together (a level is read with permutes, see Nodes),
+// buckets must have room for nbValues rounded up to a multiple of S
+template <class SortType, class IndexType>
+inline void CorePartitionKClassify(const CorePartitionKTree<SortType>& tree, const SortType values[],
+                                   const IndexType nbValues, int buckets[]){
+    typedef CorePartitionKVec<SortType> Vec;
+    const int S = Vec::S;
+    const SortType* nodes = tree.tree.data();
+    for(IndexType idxValue = 0 ; idxValue < nbValues ; idxValue += S){
+        const int nbLanes = int(std::min(IndexType(S), nbValues - idxValue));
+        const typename Vec::VecType vec = Vec::Load(Vec::FirstLanes(nbLanes), &values[idxValue]);
+        typename Vec::PositionType positions = Vec::SetPositions(1);
+        for(int base = 1 ; base < tree.nbLeaves ; base *= 2){
+            positions = Vec::Descend(positions, Vec::Nodes(nodes, base, positions), vec);
+        }
+        Vec::StoreBuckets(&buckets[idxValue], positions, tree.nbLeaves);
+    }
+}
+
+// Number of values per bucket in bucketOffsets[1 ... nbBuckets] (shifted by one
+// such that CorePartitionKOffsets makes the offsets in place), four counters per
+// bucket are used in turn such that the increments of a bucket do not wait for each other
+template <class SortType, class IndexType>
+inline void CorePartitionKCount(const CorePartitionKTree<SortType>& tree, const SortType array[], const IndexType size,
+                                const IndexType nbBuckets, IndexType bucketOffsets[]){
+    const IndexType ChunkSize = 256;
+    int buckets[ChunkSize];
+    std::vector<IndexType> counts(4*nbBuckets, 0);
+    IndexType* counts0 = &counts[0];
+    IndexType* counts1 = &counts[nbBuckets];
+    IndexType* counts2 = &counts[2*nbBuckets];
+    IndexType* counts3 = &counts[3*nbBuckets];
+    for(IndexType first = 0 ; first < size ; first += ChunkSize){
+        const IndexType nbInChunk = std::min(ChunkSize, size - first);
+        CorePartitionKClassify<SortType,IndexType>(tree, &array[first], nbInChunk, buckets);
+        IndexType idx = 0;
+        for(; idx + 4 <= nbInChunk ; idx += 4){
+            counts0[buckets[idx]] += 1;
+            counts1[buckets[idx + 1]] += 1;
+            counts2[buckets[idx + 2]] += 1;
+            counts3[buckets[idx + 3]] += 1;
+        }
+        for(; idx < nbInChunk ; ++idx){
+            counts0[buckets[idx]] += 1;
+        }
+    }
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        bucketOffsets[idxBucket + 1] = counts0[idxBucket] + counts1[idxBucket] + counts2[idxBucket] + counts3[idxBucket];
+    }
+}
+
+// From the counts in bucketOffsets[1 ... nbBuckets] to the offsets
+template <class IndexType>
+inline void CorePartitionKOffsets(const IndexType nbBuckets, IndexType bucketOffsets[]){
+    bucketOffsets[0] = 0;
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        bucketOffsets[idxBucket + 1] += bucketOffsets[idxBucket];
+    }
+}
+
+// Write the values of array in output bucket after bucket, the bucket b receives
+// the values v such that splitters[b-1] < v <= splitters[b] (the values equal
+// to a splitter go to the lower side as with Partition512), the nbBuckets-1
+// splitters must be sorted.
+// bucketOffsets has nbBuckets+1 entries, the bucket b is from bucketOffsets[b]
+// to bucketOffsets[b+1]-1.
+// The buckets are counted in a first pass, in the second pass the values go
+// in a buffer of a vector per bucket which is written with a single 64 bytes
+// store when full.
+template <class SortType, class IndexType = size_t>
+static inline void Partition512KCopy(const SortType array[], const IndexType size, const SortType splitters[],
+                                     const IndexType nbBuckets, IndexType bucketOffsets[], SortType output[]){
+    typedef CorePartitionKVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    const IndexType ChunkSize = 256;
+    const CorePartitionKTree<SortType> tree(splitters, size_t(nbBuckets));
+
+    CorePartitionKCount<SortType,IndexType>(tree, array, size, nbBuckets, bucketOffsets);
+    CorePartitionKOffsets<IndexType>(nbBuckets, bucketOffsets);
+
+    // The buffer of a bucket mirrors the cache line where its next values go
+    // in output, such that it is written when the line is complete
+    // (a non temporal store except for the first line of the bucket)
+    std::unique_ptr<SortType[]> buffers(new SortType[nbBuckets*S]);
+    std::vector<SortType*> bufferCursors(nbBuckets);
+    std::vector<SortType*> outputLines(nbBuckets);
+    std::vector<int> firstLanes(nbBuckets);
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(&output[bucketOffsets[idxBucket]]);
+        firstLanes[idxBucket] = int((address % 64)/sizeof(SortType));
+        outputLines[idxBucket] = reinterpret_cast<SortType*>(address - address % 64);
+        bufferCursors[idxBucket] = &buffers[idxBucket*S + IndexType(firstLanes[idxBucket])];
+    }
+    int buckets[ChunkSize];
+    for(IndexType first = 0 ; first < size ; first += ChunkSize){
+        const IndexType nbInChunk = std::min(ChunkSize, size - first);
+        CorePartitionKClassify<SortType,IndexType>(tree, &array[first], nbInChunk, buckets);
+        for(IndexType idx = 0 ; idx < nbInChunk ; ++idx){
+            const IndexType bucket = IndexType(buckets[idx]);
+            SortType* cursor = bufferCursors[bucket];
+            *cursor++ = array[first + idx];
+            if(cursor == &buffers[(bucket + 1)*S]){
+                cursor = &buffers[bucket*S];
+                Vec::StoreLine(outputLines[bucket], firstLanes[bucket], Vec::Load(Vec::FirstLanes(int(S)), cursor));
+                outputLines[bucket] += S;
+                firstLanes[bucket] = 0;
+            }
+            bufferCursors[bucket] = cursor;
+        }
+    }
+    _mm_sfence();
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        std::copy(&buffers[idxBucket*S + IndexType(firstLanes[idxBucket])], bufferCursors[idxBucket],
+                  &outputLines[idxBucket][firstLanes[idxBucket]]);
+    }
+}
+
+// Same as Partition512KCopy in place, with blocks of values as the in-place
+// super scalar samplesort (IPS4o):
+// - the values go in a buffer of a block per bucket, a full buffer is written
+//   back at the beginning of the array where the values have already been read,
+// - the blocks are permuted such that those of a bucket follow each other
+//   from the first block boundary of the bucket,
+// - the values of the buffers and of the blocks that cross the end of their
+//   bucket are moved to the free positions at the bounds of the bucket.
+// It needs a block per bucket (PartitionKBlockBytes each), the arrays that are
+// not larger than that are partitioned in a copy.
+template <class SortType, class IndexType = size_t>
+static inline void Partition512K(SortType array[], const IndexType size, const SortType splitters[],
+                                 const IndexType nbBuckets, IndexType bucketOffsets[]){
+    const IndexType BlockSize = IndexType(PartitionKBlockBytes/sizeof(SortType));
+    const IndexType ChunkSize = 256;
+
+    if(nbBuckets == 2 && size != 0){
+        bucketOffsets[0] = 0;
+        bucketOffsets[1] = Partition512<IndexType>(array, 0, size - 1, splitters[0]);
+        bucketOffsets[2] = size;
+        return;
+    }
+    if(size <= nbBuckets*BlockSize){
+        std::unique_ptr<SortType[]> copy(new SortType[size]);
+        std::copy(array, array + size, copy.get());
+        Partition512KCopy<SortType,IndexType>(copy.get(), size, splitters, nbBuckets, bucketOffsets, array);
+        return;
+    }
+
+    const CorePartitionKTree<SortType> tree(splitters, size_t(nbBuckets));
+    std::unique_ptr<SortType[]> buffers(new SortType[nbBuckets*BlockSize]);
+    std::vector<SortType*> bufferCursors(nbBuckets);
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        bufferCursors[idxBucket] = &buffers[idxBucket*BlockSize];
+        bucketOffsets[idxBucket + 1] = 0;
+    }
+
+    // The values read and not yet written back are in the buffers, such that
+    // a full block can be written before the current position
+    IndexType nbWritten = 0;
+    int buckets[ChunkSize];
+    for(IndexType first = 0 ; first < size ; first += ChunkSize){
+        const IndexType nbInChunk = std::min(ChunkSize, size - first);
+        CorePartitionKClassify<SortType,IndexType>(tree, &array[first], nbInChunk, buckets);
+        for(IndexType idx = 0 ; idx < nbInChunk ; ++idx){
+            const IndexType bucket = IndexType(buckets[idx]);
+            SortType* cursor = bufferCursors[bucket];
+            *cursor++ = array[first + idx];
+            if(cursor == &buffers[(bucket + 1)*BlockSize]){
+                cursor = &buffers[bucket*BlockSize];
+                std::copy(cursor, cursor + BlockSize, &array[nbWritten]);
+                nbWritten += BlockSize;
+                bucketOffsets[bucket + 1] += BlockSize;
+            }
+            bufferCursors[bucket] = cursor;
+        }
+    }
+    std::vector<IndexType> fills(nbBuckets);
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        fills[idxBucket] = IndexType(bufferCursors[idxBucket] - &buffers[idxBucket*BlockSize]);
+        bucketOffsets[idxBucket + 1] += fills[idxBucket];
+    }
+    CorePartitionKOffsets<IndexType>(nbBuckets, bucketOffsets);
+
+    // The blocks of a bucket go from the first block boundary of the bucket,
+    // the blocks from writes[b] to reads[b] have not been moved yet
+    const auto roundUp = [&](const IndexType position){
+        return (position + BlockSize - 1)/BlockSize*BlockSize;
+    };
+    std::vector<IndexType> writes(nbBuckets);
+    std::vector<IndexType> reads(nbBuckets);
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        writes[idxBucket] = roundUp(bucketOffsets[idxBucket]);
+        reads[idxBucket] = std::max(writes[idxBucket], std::min(roundUp(bucketOffsets[idxBucket + 1]), nbWritten));
+    }
+
+    // Only the block position that crosses the end of the array can be
+    // out of it, its block goes in overflow
+    std::unique_ptr<SortType[]> swapBlocks(new SortType[3*BlockSize]);
+    SortType* current = &swapBlocks[0];
+    SortType* other = &swapBlocks[BlockSize];
+    SortType* overflow = &swapBlocks[2*BlockSize];
+    IndexType overflowBucket = nbBuckets;
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        while(writes[idxBucket] < reads[idxBucket]){
+            reads[idxBucket] -= BlockSize;
+            std::copy(&array[reads[idxBucket]], &array[reads[idxBucket]] + BlockSize, current);
+            IndexType destination = IndexType(tree.bucket(current[0]));
+            while(true){
+                const IndexType position = writes[destination];
+                writes[destination] += BlockSize;
+                if(position < reads[destination]){
+                    const IndexType next = IndexType(tree.bucket(array[position]));
+                    // Otherwise the block is already in its bucket
+                    if(next != destination){
+                        std::copy(&array[position], &array[position] + BlockSize, other);
+                        std::copy(current, current + BlockSize, &array[position]);
+                        std::swap(current, other);
+                        destination = next;
+                    }
+                }
+                else{
+                    if(position + BlockSize <= size){
+                        std::copy(current, current + BlockSize, &array[position]);
+                    }
+                    else{
+                        std::copy(current, current + BlockSize, overflow);
+                        overflowBucket = destination;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // The free positions of a bucket are before its first block and after its
+    // last block, the buckets are processed in order such that those before
+    // the first block (in the previous buckets) have been emptied
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        const IndexType begin = bucketOffsets[idxBucket];
+        const IndexType end = bucketOffsets[idxBucket + 1];
+        const IndexType blocksBegin = roundUp(begin);
+        const bool inOverflow = (idxBucket == overflowBucket);
+        const IndexType blocksEnd = writes[idxBucket] - (inOverflow ? BlockSize : 0);
+        const IndexType headEnd = std::min(blocksBegin, end);
+        IndexType position = begin;
+        const auto moveToFree = [&](const SortType values[], const IndexType nbValues){
+            for(IndexType idx = 0 ; idx < nbValues ; ++idx){
+                if(position == headEnd){
+                    position = blocksEnd;
+                }
+                array[position++] = values[idx];
+            }
+        };
+        const IndexType beyondEnd = std::max(end, blocksBegin);
+        if(beyondEnd < blocksEnd){
+            moveToFree(&array[beyondEnd], blocksEnd - beyondEnd);
+        }
+        if(inOverflow){
+            moveToFree(overflow, BlockSize);
+        }
+        moveToFree(&buffers[idxBucket*BlockSize], fills[idxBucket]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sample sort
+////////////////////////////////////////////////////////////////////////////////
+
+// Below this number of values the sample sort uses CoreSort (not more such
+// that the buckets of a sorted or reversed array are also sorted fast)
+const size_t SampleSortLimit = 1 << 14;
+// Maximum number of buckets of a sample sort partition
+const size_t SampleSortMaxBuckets = 256;
+
+// From 64 buckets for 2^20 values to 256 buckets from 2^22 values
+template <class IndexType>
+inline IndexType CoreSampleSortNbBuckets(const IndexType size){
+    IndexType nbBuckets = 64;
+    while(nbBuckets < IndexType(SampleSortMaxBuckets) && size/(2*nbBuckets) >= (1 << 14)){
+        nbBuckets *= 2;
+    }
+    return nbBuckets;
+}
+
+// Select the splitters from a sorted random sample, returns the number of
+// buckets (not more than nbBuckets). A value selected several times is given
+// its own bucket (its previous value is added as splitter), equalBuckets[b]
+// is true when all the values of the bucket b are equal (nothing to sort)
+template <class SortType, class IndexType>
+inline IndexType CoreSampleSortSplitters(const SortType array[], const IndexType size, const IndexType nbBuckets,
+                                         SortType splitters[], bool equalBuckets[]){
+    IndexType log2Size = 0;
+    while((IndexType(1) << log2Size) < size){
+        log2Size += 1;
+    }
+    const IndexType sampleSize = std::min(size, nbBuckets*std::max(IndexType(1), log2Size/5));
+    std::unique_ptr<SortType[]> sample(new SortType[sampleSize]);
+    // Xorshift positions
+    unsigned long long randomState = 88172645463325252ULL ^ static_cast<unsigned long long>(size);
+    for(IndexType idxSample = 0 ; idxSample < sampleSize ; ++idxSample){
+        randomState ^= randomState << 13;
+        randomState ^= randomState >> 7;
+        randomState ^= randomState << 17;
+        sample[idxSample] = array[IndexType(randomState % static_cast<unsigned long long>(size))];
+    }
+    Sort<SortType,IndexType>(sample.get(), sampleSize);
+
+    std::unique_ptr<SortType[]> candidates(new SortType[nbBuckets]);
+    std::unique_ptr<bool[]> selectedTwice(new bool[nbBuckets]);
+    IndexType nbCandidates = 0;
+    for(IndexType idxBucket = 1 ; idxBucket < nbBuckets ; ++idxBucket){
+        const SortType candidate = sample[idxBucket*sampleSize/nbBuckets];
+        if(nbCandidates != 0 && candidates[nbCandidates - 1] == candidate){
+            selectedTwice[nbCandidates - 1] = true;
+        }
+        else{
+            candidates[nbCandidates] = candidate;
+            selectedTwice[nbCandidates] = false;
+            nbCandidates += 1;
+        }
+    }
+
+    IndexType nbSplitters = 0;
+    for(IndexType idxCandidate = 0 ; idxCandidate < nbCandidates ; ++idxCandidate){
+        const SortType candidate = candidates[idxCandidate];
+        if(selectedTwice[idxCandidate] && candidate != CoreLeastValue<SortType>()
+                && (nbSplitters == 0 || splitters[nbSplitters - 1] < CoreSortPreviousValue(candidate))){
+            splitters[nbSplitters++] = CoreSortPreviousValue(candidate);
+        }
+        splitters[nbSplitters++] = candidate;
+    }
+    for(IndexType idxBucket = 0 ; idxBucket <= nbSplitters ; ++idxBucket){
+        equalBuckets[idxBucket] = (idxBucket == 0 ? (nbSplitters != 0 && splitters[0] == CoreLeastValue<SortType>()) :
+                                   idxBucket < nbSplitters && splitters[idxBucket - 1] == CoreSortPreviousValue(splitters[idxBucket]));
+    }
+    return nbSplitters + 1;
+}
+
+// Sort the buckets of Partition512K recursively, CoreSort is used for the
+// small ones (and if a bucket has all the values, it should not happen)
+template <class SortType, class IndexType>
+static void CoreSampleSort(SortType array[], const IndexType size){
+    if(size < IndexType(SampleSortLimit)){
+        if(size > 1) CoreSort<SortType,IndexType>(array, 0, size-1);
+        return;
+    }
+    SortType splitters[SampleSortMaxBuckets];
+    bool equalBuckets[SampleSortMaxBuckets];
+    IndexType bucketOffsets[SampleSortMaxBuckets + 1];
+    const IndexType nbBuckets = CoreSampleSortSplitters<SortType,IndexType>(array, size, CoreSampleSortNbBuckets(size),
+                                                                            splitters, equalBuckets);
+    Partition512K<SortType,IndexType>(array, size, splitters, nbBuckets, bucketOffsets);
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        const IndexType bucketSize = bucketOffsets[idxBucket + 1] - bucketOffsets[idxBucket];
+        if(equalBuckets[idxBucket]){
+            continue;
+        }
+        if(bucketSize == size){
+            CoreSort<SortType,IndexType>(array, 0, size-1);
+        }
+        else{
+            CoreSampleSort<SortType,IndexType>(&array[bucketOffsets[idxBucket]], bucketSize);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sort unique
+////////////////////////////////////////////////////////////////////////////////
+
+// Lane i is set if the key is different from the one on its left,
+// previous contains the keys of the previous vector (its last lane is the left
+// neighbor of the first lane)
+template <class IndexType>
+inline __mmask16 CoreGroupStartMask(const int sorted[], const IndexType idx, const IndexType size,
+                                    __m512i& previous){
+    const IndexType S = 16;
+    const __mmask16 remaining = (size - idx >= S ? 0xFFFF : __mmask16(0xFFFF >> (S - (size - idx))));
+    const __m512i keys = _mm512_maskz_loadu_epi32(remaining, &sorted[idx]);
+    const __m512i neighbors = _mm512_alignr_epi32(keys, previous, 15);
+    previous = keys;
+    return _mm512_mask_cmp_epi32_mask(remaining, keys, neighbors, _MM_CMPINT_NE);
+}
+
+template <class IndexType>
+inline __mmask8 CoreGroupStartMask(const double sorted[], const IndexType idx, const IndexType size,
+                                   __m512d& previous){
+    const IndexType S = 8;
+    const __mmask8 remaining = (size - idx >= S ? 0xFF : __mmask8(0xFF >> (S - (size - idx))));
+    const __m512d keys = _mm512_maskz_loadu_pd(remaining, &sorted[idx]);
+    const __m512d neighbors = _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(keys),
+                                                                      _mm512_castpd_si512(previous), 7));
+    previous = keys;
+    return _mm512_mask_cmp_pd_mask(remaining, keys, neighbors, _CMP_NEQ_UQ);
+}
+
+// Same as CoreSort but the sorted segments are given to func(first, last)
+// in ascending order (the left part, the pivot and then the right part),
+// every value before first is already sorted and processed
+template <class SortType, class IndexType, class SegmentFunc>
+static void CoreSortInOrder(SortType array[], const IndexType left, const IndexType right, SegmentFunc&& func){
+    static const int SortLimite = 16*64/sizeof(SortType);
+    if(right-left < SortLimite){
+        SmallSort16V(array+left, right-left+1);
+        func(left, right+1);
+    }
+    else{
+        const IndexType part = CoreSortPivotPartition<SortType,IndexType>(array, left, right);
+        const IndexType firstEqual = CoreSortEqualPartition<SortType,IndexType>(array, left, part, right);
+        if(left < firstEqual) CoreSortInOrder<SortType,IndexType>(array, left, firstEqual - 1, func);
+        func(firstEqual, part+1);
+        if(part < right) CoreSortInOrder<SortType,IndexType>(array, part+1, right, func);
+    }
+}
+
+// Compact the sorted values of [first, last[ that are different from
+// their left neighbor at array[nbUnique...], returns the new nbUnique
+template <class IndexType>
+inline IndexType CoreUniqueSegment(int array[], const IndexType first, const IndexType last,
+                                   IndexType nbUnique){
+    const IndexType S = 16;
+    __m512i previous = _mm512_set1_epi32(nbUnique ? array[nbUnique-1] : 0);
+    __mmask16 forceFirst = (nbUnique ? 0 : 1);
+    for(IndexType idx = first ; idx < last ; idx += S){
+        // previous is set to the current keys
+        const __mmask16 isUnique = CoreGroupStartMask(array, idx, last, previous) | forceFirst;
+        forceFirst = 0;
+        // The store is always before the next values to read
+        _mm512_mask_compressstoreu_epi32(&array[nbUnique], isUnique, previous);
+        nbUnique += popcount(isUnique);
+    }
+    return nbUnique;
+}
+
+template <class IndexType>
+inline IndexType CoreUniqueSegment(double array[], const IndexType first, const IndexType last,
+                                   IndexType nbUnique){
+    const IndexType S = 8;
+    __m512d previous = _mm512_set1_pd(nbUnique ? array[nbUnique-1] : 0);
+    __mmask8 forceFirst = (nbUnique ? 0 : 1);
+    for(IndexType idx = first ; idx < last ; idx += S){
+        // previous is set to the current keys
+        const __mmask8 isUnique = CoreGroupStartMask(array, idx, last, previous) | forceFirst;
+        forceFirst = 0;
+        // The store is always before the next values to read
+        _mm512_mask_compressstoreu_pd(&array[nbUnique], isUnique, previous);
+        nbUnique += popcount(isUnique);
+    }
+    return nbUnique;
+}
+
+// Sort the array and remove the duplicates, the leaves are compacted
+// just after being sorted (when they are still in the cache),
+// returns the number of unique values stored at the beginning of array
+template <class SortType, class IndexType = size_t>
+static inline IndexType SortUnique(SortType array[], const IndexType size){
+    IndexType nbUnique = 0;
+    if(size){
+        CoreSortInOrder<SortType,IndexType>(array, 0, size-1, [&](const IndexType first, const IndexType last){
+            nbUnique = CoreUniqueSegment(array, first, last, nbUnique);
+        });
+    }
+    return nbUnique;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Run length (distinct values and counts)
+////////////////////////////////////////////////////////////////////////////////
+
+// Store the values of [first, last[ that are different from their left neighbor
+// at keys[nbDistinct...] and their positions at counts[nbDistinct...],
+// returns the new nbDistinct
+template <class IndexType>
+inline IndexType CoreRunLengthSegment(const int array[], const IndexType first, const IndexType last,
+                                      int keys[], int counts[], IndexType nbDistinct){
+    const IndexType S = 16;
+    __m512i previous = _mm512_set1_epi32(nbDistinct ? keys[nbDistinct-1] : 0);
+    __mmask16 forceFirst = (nbDistinct ? 0 : 1);
+    __m512i positions = _mm512_add_epi32(_mm512_set1_epi32(int(first)),
+                                         _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+                                                          7, 6, 5, 4, 3, 2, 1, 0));
+    for(IndexType idx = first ; idx < last ; idx += S){
+        // previous is set to the current values
+        const __mmask16 isStart = CoreGroupStartMask(array, idx, last, previous) | forceFirst;
+        forceFirst = 0;
+        _mm512_mask_compressstoreu_epi32(&keys[nbDistinct], isStart, previous);
+        _mm512_mask_compressstoreu_epi32(&counts[nbDistinct], isStart, positions);
+        nbDistinct += popcount(isStart);
+        positions = _mm512_add_epi32(positions, _mm512_set1_epi32(S));
+    }
+    return nbDistinct;
+}
+
+template <class IndexType>
+inline IndexType CoreRunLengthSegment(const double array[], const IndexType first, const IndexType last,
+                                      double keys[], int counts[], IndexType nbDistinct){
+    const IndexType S = 8;
+    __m512d previous = _mm512_set1_pd(nbDistinct ? keys[nbDistinct-1] : 0);
+    __mmask8 forceFirst = (nbDistinct ? 0 : 1);
+    __m512i positions = _mm512_add_epi32(_mm512_set1_epi32(int(first)),
+                                         _mm512_set_epi32(0, 0, 0, 0, 0, 0, 0, 0,
+                                                          7, 6, 5, 4, 3, 2, 1, 0));
+    for(IndexType idx = first ; idx < last ; idx += S){
+        // previous is set to the current values
+        const __mmask8 isStart = CoreGroupStartMask(array, idx, last, previous) | forceFirst;
+        forceFirst = 0;
+        _mm512_mask_compressstoreu_pd(&keys[nbDistinct], isStart, previous);
+        _mm512_mask_compressstoreu_epi32(&counts[nbDistinct], isStart, positions);
+        nbDistinct += popcount(isStart);
+        positions = _mm512_add_epi32(positions, _mm512_set1_epi32(S));
+    }
+    return nbDistinct;
+}
+
+// Transform the first positions of the runs into their lengths
+template <class IndexType>
+inline void CoreRunLengthCounts(int counts[], const IndexType nbDistinct, const IndexType size){
+    const IndexType S = 16;
+    IndexType idx = 0;
+    for( ; idx + S < nbDistinct ; idx += S){
+        // The next positions are loaded before the store
+        const __m512i firsts = _mm512_loadu_si512(&counts[idx]);
+        const __m512i nexts = _mm512_loadu_si512(&counts[idx+1]);
+        _mm512_storeu_si512(&counts[idx], _mm512_sub_epi32(nexts, firsts));
+    }
+    for( ; idx + 1 < nbDistinct ; ++idx){
+        counts[idx] = counts[idx+1] - counts[idx];
+    }
+    if(nbDistinct){
+        counts[nbDistinct-1] = int(size) - counts[nbDistinct-1];
+    }
+}
+
+// Sort the array and store each distinct value in keys (that can be array)
+// with its number of occurrences in counts, the array is sorted in place
+// and each leaf is encoded just after being sorted while it is in cache
+// (there is no second pass over the sorted array),
+// returns the number of distinct values
+template <class SortType, class IndexType = size_t>
+static inline IndexType SortRunLength(SortType array[], const IndexType size, SortType keys[], int counts[]){
+    IndexType nbDistinct = 0;
+    if(size){
+        CoreSortInOrder<SortType,IndexType>(array, 0, size-1, [&](const IndexType first, const IndexType last){
+            nbDistinct = CoreRunLengthSegment(array, first, last, keys, counts, nbDistinct);
+        });
+        CoreRunLengthCounts(counts, nbDistinct, size);
+    }
+    return nbDistinct;
+}
+
+
+
 
 #if defined(_OPENMP)
 
+// The number of threads of the current team, the work of a region is split
+// with it: the team can be smaller than the num_threads asked (nested region
+// or dynamic adjustment)
+inline int CoreTeamSize(){
+    return omp_get_num_threads();
+}
+
 template <class SortType, class IndexType = size_t>
 static inline void CoreSortTaskPartition(SortType array[], const IndexType left, const IndexType right, const int deep){
     static const int SortLimite = 16*64/sizeof(SortType);
@@ -6011,6 +7395,11 @@ static inline void SortOmpMerge(SortType array[], const IndexType size){
 
     assert(((omp_get_num_threads()-1) & omp_get_num_threads()) == 0); // Must be power of 2
 
+    // The merge from first copies its first part in the buffer from first/2,
+    // the merges of a level do not overlap there (the chunks are rounded up,
+    // so up to half a value per thread is needed after size/2)
+    std::unique_ptr<SortType[]> buffer(new SortType[size/2 + omp_get_max_threads()]);
+
 #pragma omp parallel
     {
         const IndexType chunk = (size + omp_get_num_threads() - 1)/omp_get_num_threads();
@@ -6042,9 +7431,7 @@ static inline void SortOmpMerge(SortType array[], const IndexType size){
             const IndexType middle = std::min(size, first + (nbOriginalPartsToMerge/2)*chunk);
             const IndexType last = std::min(size, first + nbOriginalPartsToMerge*chunk);
 
-            std::inplace_merge(&array[first],
-                               &array[middle],
-                               &array[last]);
+            CoreMergeInPlace<SortType,IndexType>(array, first, middle, last, &buffer[first/2]);
 
             {
                 int& mydone = done[level][(omp_get_thread_num()>>level)];
@@ -6063,11 +7450,14 @@ static inline void SortOmpMergeDeps(SortType array[], const IndexType size){
     while(nbParts < omp_get_max_threads()){
         nbParts <<= 1;
     }
+    // The merge from first copies its first part in the buffer from first/2,
+    // the merges of a level do not overlap there
+    const IndexType chunk = (size + nbParts - 1)/nbParts;
+    std::unique_ptr<SortType[]> buffer(new SortType[(nbParts/2)*chunk]);
 #pragma omp parallel
     {
 #pragma omp master
         {
-            const IndexType chunk = (size + nbParts - 1)/nbParts;
             for(long int idxPart = 0 ; idxPart < nbParts ; ++idxPart){
                 const IndexType first = std::min(IndexType(size), chunk * idxPart);
                 const IndexType last = std::min(IndexType(size), chunk * (idxPart + 1));
@@ -6089,9 +7479,7 @@ static inline void SortOmpMergeDeps(SortType array[], const IndexType size){
                     const IndexType last = std::min(size, first + nbOriginalPartsToMerge*chunk);
 
     #pragma omp task depend(inout:array[first],array[middle]) firstprivate(first, middle,last)
-                    std::inplace_merge(&array[first],
-                                       &array[middle],
-                                       &array[last]);
+                    CoreMergeInPlace<SortType,IndexType>(array, first, middle, last, &buffer[first/2]);
                 }
                 level += 1;
             }
@@ -6173,6 +7561,377 @@ static inline void SortOmpParMerge(SortType array[], const IndexType size){
     }
 }
 
+// Each thread sorts a chunk, then at each level the pairs of runs are merged
+// out-of-place (the array and a buffer are used alternately): the output of
+// the level is split in equal slices along the merge paths, such that every
+// thread merges the same number of values with the vectorized merge
+template <class SortType, class IndexType = size_t>
+static inline void SortOmpMergePath(SortType array[], const IndexType size){
+    const int nbThreads = omp_get_max_threads();
+    if(size < IndexType(nbThreads)*64){
+        if(size > 1) CoreSort<SortType,IndexType>(array,0,size-1);
+        return;
+    }
+    std::unique_ptr<SortType[]> buffer(new SortType[size]);
+
+#pragma omp parallel num_threads(nbThreads)
+    {
+        const int nbWorkers = CoreTeamSize();
+        const int idxThread = omp_get_thread_num();
+        const IndexType chunk = (size + nbWorkers - 1)/nbWorkers;
+        {
+            const IndexType first = std::min(size, chunk * idxThread);
+            const IndexType last = std::min(size, chunk * (idxThread + 1));
+            if(first < last) CoreSort<SortType,IndexType>(array,first,last-1);
+        }
+
+        SortType* src = array;
+        SortType* dst = buffer.get();
+        const IndexType sliceFirst = IndexType(size*idxThread/nbWorkers);
+        const IndexType sliceLast = IndexType(size*(idxThread+1)/nbWorkers);
+
+        for(IndexType width = chunk ; width < size ; width *= 2){
+#pragma omp barrier
+            // The pairs of runs that overlap the slice of the thread
+            for(IndexType first = (sliceFirst/(2*width))*(2*width) ; first < sliceLast ; first += 2*width){
+                const IndexType middle = std::min(size, first + width);
+                const IndexType last = std::min(size, first + 2*width);
+                const IndexType diagFirst = std::max(sliceFirst, first) - first;
+                const IndexType diagLast = std::min(sliceLast, last) - first;
+
+                const IndexType firstFrom1 = MergePathSplit(&src[first], middle-first, &src[middle], last-middle, diagFirst);
+                const IndexType lastFrom1 = MergePathSplit(&src[first], middle-first, &src[middle], last-middle, diagLast);
+                Merge<SortType,IndexType>(&src[first + firstFrom1], lastFrom1 - firstFrom1,
+                                          &src[middle + diagFirst - firstFrom1], (diagLast - lastFrom1) - (diagFirst - firstFrom1),
+                                          &dst[first + diagFirst]);
+            }
+            std::swap(src, dst);
+        }
+
+        // The last level still reads the array
+        if(src != array){
+#pragma omp barrier
+            std::copy(&src[sliceFirst], &src[sliceLast], &array[sliceFirst]);
+        }
+    }
+}
+
+// The batch is sorted in parallel, a large batch is copied at the end of the
+// array and merged with ParallelInplace::parallelMergeInPlace (on a power of two
+// number of threads), otherwise it is merged from the end by one thread
+template <class SortType, class IndexType = size_t>
+static inline void MergeInsertOmp(SortType sorted[], const IndexType size, SortType batch[], const IndexType batchSize){
+    if(batchSize == 0){
+        return;
+    }
+    SortOmpPartition<SortType,IndexType>(batch, batchSize);
+
+    const long int MAX_THREADS = 128;
+    long int nbThreads = 1;
+    while(nbThreads*2 <= std::min(long(omp_get_max_threads()), MAX_THREADS)){
+        nbThreads *= 2;
+    }
+    if(nbThreads == 1 || batchSize < (1<<16) || batchSize < size/8 || size + batchSize > IndexType(INT_MAX)){
+        CoreMergeBackward<SortType,IndexType>(sorted, size, batch, batchSize);
+        return;
+    }
+
+    std::copy(batch, batch + batchSize, &sorted[size]);
+    ParallelInplace::WorkingInterval<SortType> intervals[MAX_THREADS] = {};
+    int barrier[MAX_THREADS] = {};
+#pragma omp parallel num_threads(nbThreads)
+    {
+        // The in-place merge waits for all the threads it is given,
+        // a smaller team merges from the end with one thread
+        if(CoreTeamSize() == nbThreads){
+            ParallelInplace::parallelMergeInPlace(sorted, int(size + batchSize), int(size), nbThreads, 0,
+                                                  intervals, barrier);
+        }
+        else{
+#pragma omp master
+            CoreMergeBackward<SortType,IndexType>(sorted, size, batch, batchSize);
+        }
+    }
+}
+
+// Partition512K with a team of threads (same arguments and result), as the
+// parallel IPS4o:
+// - the array is split in one stripe per thread asked, each stripe is
+//   classified with its own buffers and the full blocks are written back
+//   at the beginning of the stripe,
+// - in each bucket region the full blocks are moved to the front,
+// - the threads permute the blocks together, the write and read positions of
+//   a bucket are changed under its lock and a thread that writes in a free
+//   position waits until the blocks taken from the bucket have been read,
+// - the values of the buffers and of the blocks that cross the bounds of the
+//   buckets are moved to the free positions, the buckets in parallel.
+template <class SortType, class IndexType = size_t>
+static inline void Partition512KOmp(SortType array[], const IndexType size, const SortType splitters[],
+                                    const IndexType nbBuckets, IndexType bucketOffsets[]){
+    const IndexType BlockSize = IndexType(PartitionKBlockBytes/sizeof(SortType));
+    const IndexType ChunkSize = 256;
+    // One stripe per thread asked, the stripes are shared among the threads
+    // of the team, that can be smaller (see CoreTeamSize())
+    const int nbStripes = omp_get_max_threads();
+    if(nbStripes == 1 || size <= IndexType(nbStripes)*nbBuckets*BlockSize){
+        Partition512K<SortType,IndexType>(array, size, splitters, nbBuckets, bucketOffsets);
+        return;
+    }
+
+    const CorePartitionKTree<SortType> tree(splitters, size_t(nbBuckets));
+    const auto roundUp = [&](const IndexType position){
+        return (position + BlockSize - 1)/BlockSize*BlockSize;
+    };
+    const IndexType stripeSize = roundUp((size + IndexType(nbStripes) - 1)/IndexType(nbStripes));
+    // The buffers and counters of the stripe s are from s*nbBuckets
+    std::unique_ptr<SortType[]> buffers(new SortType[IndexType(nbStripes)*nbBuckets*BlockSize]);
+    std::vector<IndexType> fills(IndexType(nbStripes)*nbBuckets, 0);
+    std::vector<IndexType> counts(IndexType(nbStripes)*nbBuckets, 0);
+    std::vector<IndexType> nbWritten(nbStripes, 0);
+    std::vector<IndexType> writes(nbBuckets);
+    std::vector<IndexType> reads(nbBuckets);
+    std::vector<int> pendingReads(nbBuckets, 0);
+    std::vector<omp_lock_t> locks(nbBuckets);
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        omp_init_lock(&locks[idxBucket]);
+    }
+    std::unique_ptr<SortType[]> overflow(new SortType[BlockSize]);
+    IndexType overflowBucket = nbBuckets;
+    // The values after the last block of a bucket that are beyond its end
+    std::unique_ptr<SortType[]> beyond(new SortType[nbBuckets*BlockSize]);
+    std::vector<IndexType> nbBeyond(nbBuckets, 0);
+
+#pragma omp parallel num_threads(nbStripes)
+    {
+#pragma omp for schedule(static, 1)
+        for(int idxStripe = 0 ; idxStripe < nbStripes ; ++idxStripe){
+            const IndexType stripeFirst = std::min(size, stripeSize*IndexType(idxStripe));
+            const IndexType stripeLast = std::min(size, stripeFirst + stripeSize);
+            SortType* stripeBuffers = &buffers[IndexType(idxStripe)*nbBuckets*BlockSize];
+            IndexType* stripeFills = &fills[IndexType(idxStripe)*nbBuckets];
+            IndexType* stripeCounts = &counts[IndexType(idxStripe)*nbBuckets];
+            IndexType written = stripeFirst;
+            int buckets[ChunkSize];
+            for(IndexType first = stripeFirst ; first < stripeLast ; first += ChunkSize){
+                const IndexType nbInChunk = std::min(ChunkSize, stripeLast - first);
+                CorePartitionKClassify<SortType,IndexType>(tree, &array[first], nbInChunk, buckets);
+                for(IndexType idx = 0 ; idx < nbInChunk ; ++idx){
+                    const IndexType bucket = IndexType(buckets[idx]);
+                    stripeBuffers[bucket*BlockSize + stripeFills[bucket]] = array[first + idx];
+                    stripeFills[bucket] += 1;
+                    if(stripeFills[bucket] == BlockSize){
+                        std::copy(&stripeBuffers[bucket*BlockSize], &stripeBuffers[(bucket + 1)*BlockSize], &array[written]);
+                        written += BlockSize;
+                        stripeCounts[bucket] += BlockSize;
+                        stripeFills[bucket] = 0;
+                    }
+                }
+            }
+            nbWritten[idxStripe] = written - stripeFirst;
+        }
+#pragma omp single
+        {
+            for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+                bucketOffsets[idxBucket + 1] = 0;
+                for(int idxOther = 0 ; idxOther < nbStripes ; ++idxOther){
+                    bucketOffsets[idxBucket + 1] += counts[IndexType(idxOther)*nbBuckets + idxBucket]
+                                                    + fills[IndexType(idxOther)*nbBuckets + idxBucket];
+                }
+            }
+            CorePartitionKOffsets<IndexType>(nbBuckets, bucketOffsets);
+        }
+
+        // The full blocks of a bucket region go before the empty ones
+        const auto isFull = [&](const IndexType position){
+            const IndexType stripe = position/stripeSize;
+            return position < size && position - stripe*stripeSize < nbWritten[stripe];
+        };
+#pragma omp for schedule(dynamic, 1)
+        for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+            IndexType first = roundUp(bucketOffsets[idxBucket]);
+            IndexType last = std::max(first, roundUp(bucketOffsets[idxBucket + 1]));
+            writes[idxBucket] = first;
+            while(true){
+                while(first < last && isFull(first)){
+                    first += BlockSize;
+                }
+                while(first < last && !isFull(last - BlockSize)){
+                    last -= BlockSize;
+                }
+                if(first == last){
+                    break;
+                }
+                std::copy(&array[last - BlockSize], &array[last], &array[first]);
+                first += BlockSize;
+                last -= BlockSize;
+            }
+            reads[idxBucket] = first;
+        }
+
+        // Each thread starts from a different bucket, a bucket is done
+        // when its blocks have all been taken (reads only decreases)
+        {
+            std::unique_ptr<SortType[]> swapBlocks(new SortType[2*BlockSize]);
+            SortType* current = &swapBlocks[0];
+            SortType* other = &swapBlocks[BlockSize];
+            const IndexType firstBucket = IndexType(omp_get_thread_num())*nbBuckets/IndexType(CoreTeamSize());
+            for(IndexType idxStep = 0 ; idxStep < nbBuckets ; ++idxStep){
+                const IndexType idxBucket = (firstBucket + idxStep) % nbBuckets;
+                while(true){
+                    IndexType position = 0;
+                    omp_set_lock(&locks[idxBucket]);
+                    const bool hasBlock = (writes[idxBucket] < reads[idxBucket]);
+                    if(hasBlock){
+                        reads[idxBucket] -= BlockSize;
+                        position = reads[idxBucket];
+                        #pragma omp atomic
+                        pendingReads[idxBucket] += 1;
+                    }
+                    omp_unset_lock(&locks[idxBucket]);
+                    if(!hasBlock){
+                        break;
+                    }
+                    std::copy(&array[position], &array[position] + BlockSize, current);
+                    #pragma omp flush
+                    #pragma omp atomic
+                    pendingReads[idxBucket] -= 1;
+
+                    IndexType destination = IndexType(tree.bucket(current[0]));
+                    while(true){
+                        omp_set_lock(&locks[destination]);
+                        position = writes[destination];
+                        writes[destination] += BlockSize;
+                        const bool occupied = (position < reads[destination]);
+                        omp_unset_lock(&locks[destination]);
+                        if(occupied){
+                            const IndexType next = IndexType(tree.bucket(array[position]));
+                            // Otherwise the block is already in its bucket
+                            if(next != destination){
+                                std::copy(&array[position], &array[position] + BlockSize, other);
+                                std::copy(current, current + BlockSize, &array[position]);
+                                std::swap(current, other);
+                                destination = next;
+                            }
+                        }
+                        else{
+                            while(true){
+                                int nbPending;
+                                #pragma omp atomic read
+                                nbPending = pendingReads[destination];
+                                if(nbPending == 0){
+                                    break;
+                                }
+                            }
+                            #pragma omp flush
+                            if(position + BlockSize <= size){
+                                std::copy(current, current + BlockSize, &array[position]);
+                            }
+                            else{
+                                std::copy(current, current + BlockSize, overflow.get());
+                                overflowBucket = destination;
+                            }
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+#pragma omp barrier
+
+        // The values of a bucket beyond its end are in the head of the next
+        // bucket, they are all copied before the free positions are filled
+        const auto blocksEnd = [&](const IndexType idxBucket){
+            return writes[idxBucket] - (idxBucket == overflowBucket ? BlockSize : 0);
+        };
+#pragma omp for schedule(static)
+        for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+            const IndexType beyondEnd = std::max(bucketOffsets[idxBucket + 1], roundUp(bucketOffsets[idxBucket]));
+            if(beyondEnd < blocksEnd(idxBucket)){
+                nbBeyond[idxBucket] = blocksEnd(idxBucket) - beyondEnd;
+                std::copy(&array[beyondEnd], &array[blocksEnd(idxBucket)], &beyond[idxBucket*BlockSize]);
+            }
+        }
+#pragma omp for schedule(dynamic, 1)
+        for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+            const IndexType headEnd = std::min(roundUp(bucketOffsets[idxBucket]), bucketOffsets[idxBucket + 1]);
+            const IndexType tailBegin = blocksEnd(idxBucket);
+            IndexType position = bucketOffsets[idxBucket];
+            const auto moveToFree = [&](const SortType values[], const IndexType nbValues){
+                for(IndexType idx = 0 ; idx < nbValues ; ++idx){
+                    if(position == headEnd){
+                        position = tailBegin;
+                    }
+                    array[position++] = values[idx];
+                }
+            };
+            moveToFree(&beyond[idxBucket*BlockSize], nbBeyond[idxBucket]);
+            if(idxBucket == overflowBucket){
+                moveToFree(overflow.get(), BlockSize);
+            }
+            for(int idxOther = 0 ; idxOther < nbStripes ; ++idxOther){
+                moveToFree(&buffers[(IndexType(idxOther)*nbBuckets + idxBucket)*BlockSize],
+                           fills[IndexType(idxOther)*nbBuckets + idxBucket]);
+            }
+        }
+    }
+
+    for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+        omp_destroy_lock(&locks[idxBucket]);
+    }
+}
+
+// Sample sort where the large ranges are partitioned by all the threads
+// (Partition512KOmp) and the buckets are then sorted by a thread each
+// (CoreSampleSort), the largest first
+template <class SortType, class IndexType = size_t>
+static inline void SortOmpSampleSort(SortType array[], const IndexType size){
+    IndexType nbThreads = 1;
+#pragma omp parallel
+    {
+#pragma omp single
+        nbThreads = IndexType(CoreTeamSize());
+    }
+    if(nbThreads == 1 || size <= IndexType(SampleSortLimit)*nbThreads){
+        CoreSampleSort<SortType,IndexType>(array, size);
+        return;
+    }
+    const IndexType parallelLimit = size/nbThreads;
+
+    // Pairs of (first, size) and (size, first) to sort the sequential ones by size
+    std::vector<std::pair<IndexType,IndexType>> parallelRanges(1, std::make_pair(IndexType(0), size));
+    std::vector<std::pair<IndexType,IndexType>> sequentialRanges;
+    SortType splitters[SampleSortMaxBuckets];
+    bool equalBuckets[SampleSortMaxBuckets];
+    IndexType bucketOffsets[SampleSortMaxBuckets + 1];
+    while(parallelRanges.size()){
+        const IndexType first = parallelRanges.back().first;
+        const IndexType rangeSize = parallelRanges.back().second;
+        parallelRanges.pop_back();
+        const IndexType nbBuckets = CoreSampleSortSplitters<SortType,IndexType>(&array[first], rangeSize,
+                                                                                CoreSampleSortNbBuckets(rangeSize),
+                                                                                splitters, equalBuckets);
+        Partition512KOmp<SortType,IndexType>(&array[first], rangeSize, splitters, nbBuckets, bucketOffsets);
+        for(IndexType idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+            const IndexType bucketSize = bucketOffsets[idxBucket + 1] - bucketOffsets[idxBucket];
+            if(equalBuckets[idxBucket] || bucketSize < 2){
+                continue;
+            }
+            if(parallelLimit < bucketSize && bucketSize != rangeSize){
+                parallelRanges.push_back(std::make_pair(first + bucketOffsets[idxBucket], bucketSize));
+            }
+            else{
+                sequentialRanges.push_back(std::make_pair(bucketSize, first + bucketOffsets[idxBucket]));
+            }
+        }
+    }
+
+    std::sort(sequentialRanges.begin(), sequentialRanges.end(), std::greater<std::pair<IndexType,IndexType>>());
+#pragma omp parallel for schedule(dynamic, 1)
+    for(IndexType idxRange = 0 ; idxRange < IndexType(sequentialRanges.size()) ; ++idxRange){
+        CoreSampleSort<SortType,IndexType>(&array[sequentialRanges[idxRange].second], sequentialRanges[idxRange].first);
+    }
+}
+
 #endif
 
 }
@@ -0,0 +1,470 @@
+//////////////////////////////////////////////////////////
+/// Code of a priority queue of integers or doubles
+/// (or key/value pairs) made of sorted blocks of one vector
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Classes to use:
+/// Sort512::BlockHeap<SortType>; to get the lowest values first
+/// Sort512kv::BlockHeap<SortType>; to get the pairs with the lowest keys first
+///
+/// Each node of the binary heap is a sorted vector (16 int or 8 double) and
+/// all its values are lower or equal to the values of its children.
+/// A block is pushed at the end and sifted up, the root block is popped and
+/// the last block is sifted down, each step merges two vectors with the
+/// bitonic network (a node and its parent or the two children then the node).
+/// The values pushed one by one are gathered in a small buffer until there
+/// is a full block, the values popped one by one come from the last root
+/// block popped or from this buffer.
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512HEAP_HPP
+#define SORT512HEAP_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <vector>
+
+#include "sort512.hpp"
+#include "sort512kv.hpp"
+
+namespace Sort512 {
+
+////////////////////////////////////////////////////////////////////////////////
+/// Vector blocks
+////////////////////////////////////////////////////////////////////////////////
+
+inline void CoreBlockHeapSort(__m512i& input, __m512i& input_val, const bool withValues){
+    if(withValues){
+        Sort512kv::CoreSmallSort(input, input_val);
+    }
+    else{
+        input = CoreSmallSort(input);
+    }
+}
+
+inline void CoreBlockHeapSort(__m512d& input, __m512d& input_val, const bool withValues){
+    if(withValues){
+        Sort512kv::CoreSmallSort(input, input_val);
+    }
+    else{
+        input = CoreSmallSort(input);
+    }
+}
+
+// input gets the lowest values of both vectors and input2 the greatest ones
+inline void CoreBlockHeapExchange(__m512i& input, __m512i& input2, __m512i& input_val, __m512i& input2_val,
+                                  const bool withValues){
+    if(withValues){
+        Sort512kv::CoreExchangeSort2V(input, input2, input_val, input2_val);
+    }
+    else{
+        CoreExchangeSort2V(input, input2);
+    }
+}
+
+inline void CoreBlockHeapExchange(__m512d& input, __m512d& input2, __m512d& input_val, __m512d& input2_val,
+                                  const bool withValues){
+    if(withValues){
+        Sort512kv::CoreExchangeSort2V(input, input2, input_val, input2_val);
+    }
+    else{
+        CoreExchangeSort2V(input, input2);
+    }
+}
+
+inline int CoreBlockHeapFirst(const __m512i input){
+    return _mm_cvtsi128_si32(_mm512_castsi512_si128(input));
+}
+
+inline double CoreBlockHeapFirst(const __m512d input){
+    return _mm_cvtsd_f64(_mm512_castpd512_pd128(input));
+}
+
+inline int CoreBlockHeapLast(const __m512i input){
+    return _mm_extract_epi32(_mm512_extracti32x4_epi32(input, 3), 3);
+}
+
+inline double CoreBlockHeapLast(const __m512d input){
+    const __m128d upper = _mm256_extractf128_pd(_mm512_extractf64x4_pd(input, 1), 1);
+    return _mm_cvtsd_f64(_mm_unpackhi_pd(upper, upper));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Block heap
+////////////////////////////////////////////////////////////////////////////////
+
+// The values are moved only if WithValues is true
+template <class SortType, class IndexType, bool WithValues>
+class CoreBlockHeap {
+    typedef CoreMergeVec<SortType> Vec;
+    typedef typename Vec::VecType VecType;
+
+public:
+    static const IndexType S = 64/sizeof(SortType);
+
+private:
+    // The sorted blocks of the heap, the children of block idx are 2*idx+1 and 2*idx+2
+    std::vector<SortType> blockKeys;
+    std::vector<SortType> blockValues;
+    IndexType nbBlocks;
+    // The values pushed one by one (not sorted)
+    SortType insertedKeys[S];
+    SortType insertedValues[S];
+    IndexType nbInserted;
+    // What remains of the last root block popped, lower or equal to every block
+    SortType frontKeys[S];
+    SortType frontValues[S];
+    IndexType frontFirst;
+    IndexType frontLast;
+
+    void loadBlock(const IndexType idxBlock, VecType& keys, VecType& values) const{
+        keys = Vec::Load(&blockKeys[idxBlock*S]);
+        if(WithValues){
+            values = Vec::Load(&blockValues[idxBlock*S]);
+        }
+        else{
+            values = keys;
+        }
+    }
+
+    void storeBlock(const IndexType idxBlock, const VecType keys, const VecType values){
+        Vec::Store(&blockKeys[idxBlock*S], keys);
+        if(WithValues){
+            Vec::Store(&blockValues[idxBlock*S], values);
+        }
+    }
+
+    // The new block is put at the end and its lowest values go up
+    // (merged with the parent that keeps the lowest half) until the parent
+    // is already lower
+    void siftUp(VecType keys, VecType values){
+        if(blockKeys.size() == nbBlocks*S){
+            blockKeys.resize(std::max(blockKeys.size()*2, size_t(64*S)));
+            if(WithValues){
+                blockValues.resize(blockKeys.size());
+            }
+        }
+        IndexType idxBlock = nbBlocks++;
+        while(idxBlock){
+            const IndexType idxParent = (idxBlock - 1)/2;
+            if(blockKeys[idxParent*S + S - 1] <= CoreBlockHeapFirst(keys)){
+                break;
+            }
+            VecType parentKeys, parentValues;
+            loadBlock(idxParent, parentKeys, parentValues);
+            CoreBlockHeapExchange(parentKeys, keys, parentValues, values, WithValues);
+            storeBlock(idxBlock, keys, values);
+            keys = parentKeys;
+            values = parentValues;
+            idxBlock = idxParent;
+        }
+        storeBlock(idxBlock, keys, values);
+    }
+
+    // The block is put at the root and goes down: the two children are merged,
+    // the child with the greatest value keeps the greatest half (which is then
+    // lower than its own children), the lowest half is merged with the block
+    // that keeps the lowest values, the rest goes down in the other child
+    void siftDown(VecType keys, VecType values){
+        IndexType idxBlock = 0;
+        while(true){
+            const IndexType idxLeft = 2*idxBlock + 1;
+            const IndexType idxRight = idxLeft + 1;
+            if(nbBlocks <= idxLeft){
+                break;
+            }
+            if(nbBlocks == idxRight){
+                if(blockKeys[idxLeft*S] < CoreBlockHeapLast(keys)){
+                    VecType leftKeys, leftValues;
+                    loadBlock(idxLeft, leftKeys, leftValues);
+                    CoreBlockHeapExchange(keys, leftKeys, values, leftValues, WithValues);
+                    storeBlock(idxLeft, leftKeys, leftValues);
+                }
+                break;
+            }
+            if(CoreBlockHeapLast(keys) <= std::min(blockKeys[idxLeft*S], blockKeys[idxRight*S])){
+                break;
+            }
+            const bool leftIsGreatest = (blockKeys[idxRight*S + S - 1] <= blockKeys[idxLeft*S + S - 1]);
+            VecType lowKeys, lowValues, highKeys, highValues;
+            loadBlock(idxLeft, lowKeys, lowValues);
+            loadBlock(idxRight, highKeys, highValues);
+            CoreBlockHeapExchange(lowKeys, highKeys, lowValues, highValues, WithValues);
+            storeBlock(leftIsGreatest ? idxLeft : idxRight, highKeys, highValues);
+
+            CoreBlockHeapExchange(keys, lowKeys, values, lowValues, WithValues);
+            storeBlock(idxBlock, keys, values);
+            keys = lowKeys;
+            values = lowValues;
+            idxBlock = (leftIsGreatest ? idxRight : idxLeft);
+        }
+        storeBlock(idxBlock, keys, values);
+    }
+
+    void popRoot(SortType destKeys[], SortType destValues[]){
+        std::copy(&blockKeys[0], &blockKeys[S], destKeys);
+        if(WithValues){
+            std::copy(&blockValues[0], &blockValues[S], destValues);
+        }
+        nbBlocks -= 1;
+        if(nbBlocks){
+            VecType keys, values;
+            loadBlock(nbBlocks, keys, values);
+            siftDown(keys, values);
+        }
+    }
+
+    // A sorted block is exchanged with the front if it has lower values
+    // (the front keeps as many values as before) and then it goes in the heap
+    void pushSorted(VecType keys, VecType values){
+        if(frontFirst != frontLast && CoreBlockHeapFirst(keys) < frontKeys[frontLast - 1]){
+            SortType mergedKeys[2*S];
+            SortType mergedValues[2*S];
+            SortType blockKeysBuffer[S];
+            SortType blockValuesBuffer[S];
+            Vec::Store(blockKeysBuffer, keys);
+            if(WithValues){
+                Vec::Store(blockValuesBuffer, values);
+            }
+            IndexType idxFront = frontFirst;
+            IndexType idxBlock = 0;
+            IndexType nbMerged = 0;
+            while(idxFront != frontLast || idxBlock != S){
+                if(idxBlock == S || (idxFront != frontLast && frontKeys[idxFront] <= blockKeysBuffer[idxBlock])){
+                    mergedKeys[nbMerged] = frontKeys[idxFront];
+                    mergedValues[nbMerged] = (WithValues ? frontValues[idxFront] : SortType());
+                    idxFront += 1;
+                }
+                else{
+                    mergedKeys[nbMerged] = blockKeysBuffer[idxBlock];
+                    mergedValues[nbMerged] = (WithValues ? blockValuesBuffer[idxBlock] : SortType());
+                    idxBlock += 1;
+                }
+                nbMerged += 1;
+            }
+            const IndexType nbFront = frontLast - frontFirst;
+            std::copy(&mergedKeys[0], &mergedKeys[nbFront], frontKeys);
+            std::copy(&mergedValues[0], &mergedValues[nbFront], frontValues);
+            frontFirst = 0;
+            frontLast = nbFront;
+            keys = Vec::Load(&mergedKeys[nbFront]);
+            values = Vec::Load(&mergedValues[nbFront]);
+        }
+        siftUp(keys, values);
+    }
+
+    // Returns the position in the inserted buffer of the lowest key,
+    // or S if it has the lowest key
+    IndexType lowestPosition(){
+        if(frontFirst == frontLast && nbBlocks){
+            popRoot(frontKeys, frontValues);
+            frontFirst = 0;
+            frontLast = S;
+        }
+        const IndexType idxInserted = IndexType(std::min_element(insertedKeys, insertedKeys + nbInserted) - insertedKeys);
+        if(idxInserted != nbInserted && (frontFirst == frontLast || insertedKeys[idxInserted] < frontKeys[frontFirst])){
+            return idxInserted;
+        }
+        return S;
+    }
+
+public:
+    CoreBlockHeap() : nbBlocks(0), nbInserted(0), frontFirst(0), frontLast(0){
+    }
+
+    CoreBlockHeap(const CoreBlockHeap&) = delete;
+    CoreBlockHeap& operator=(const CoreBlockHeap&) = delete;
+
+    void push(const SortType key, const SortType value){
+        insertedKeys[nbInserted] = key;
+        insertedValues[nbInserted] = value;
+        nbInserted += 1;
+        if(nbInserted == S){
+            VecType keys = Vec::Load(insertedKeys);
+            VecType values = Vec::Load(insertedValues);
+            CoreBlockHeapSort(keys, values, WithValues);
+            nbInserted = 0;
+            pushSorted(keys, values);
+        }
+    }
+
+    // The full blocks go directly in the heap
+    void push(const SortType keys[], const SortType values[], const IndexType size){
+        IndexType idx = 0;
+        for( ; idx + S <= size ; idx += S){
+            VecType keysVec = Vec::Load(&keys[idx]);
+            VecType valuesVec = (WithValues ? Vec::Load(&values[idx]) : keysVec);
+            CoreBlockHeapSort(keysVec, valuesVec, WithValues);
+            pushSorted(keysVec, valuesVec);
+        }
+        for( ; idx < size ; ++idx){
+            push(keys[idx], (WithValues ? values[idx] : SortType()));
+        }
+    }
+
+    // The heap must not be empty
+    void top(SortType& key, SortType& value){
+        const IndexType idxLowest = lowestPosition();
+        if(idxLowest != S){
+            key = insertedKeys[idxLowest];
+            value = insertedValues[idxLowest];
+        }
+        else{
+            key = frontKeys[frontFirst];
+            value = frontValues[frontFirst];
+        }
+    }
+
+    // The heap must not be empty
+    void pop(SortType& key, SortType& value){
+        const IndexType idxLowest = lowestPosition();
+        if(idxLowest != S){
+            key = insertedKeys[idxLowest];
+            value = insertedValues[idxLowest];
+            nbInserted -= 1;
+            insertedKeys[idxLowest] = insertedKeys[nbInserted];
+            insertedValues[idxLowest] = insertedValues[nbInserted];
+        }
+        else{
+            key = frontKeys[frontFirst];
+            value = frontValues[frontFirst];
+            frontFirst += 1;
+        }
+    }
+
+    // Pop at most S values, in increasing order, returns the number of values written.
+    // When nothing has been pushed or popped one by one the root block is taken directly.
+    IndexType popBlock(SortType destKeys[], SortType destValues[]){
+        if(nbInserted == 0 && frontFirst == frontLast && nbBlocks){
+            popRoot(destKeys, destValues);
+            return S;
+        }
+        const IndexType nbPopped = std::min(IndexType(S), size());
+        for(IndexType idx = 0 ; idx < nbPopped ; ++idx){
+            SortType value;
+            pop(destKeys[idx], value);
+            if(WithValues){
+                destValues[idx] = value;
+            }
+        }
+        return nbPopped;
+    }
+
+    IndexType size() const{
+        return nbBlocks*S + nbInserted + (frontLast - frontFirst);
+    }
+
+    void clear(){
+        nbBlocks = 0;
+        nbInserted = 0;
+        frontFirst = 0;
+        frontLast = 0;
+    }
+};
+
+// Priority queue that gives the lowest value first
+template <class SortType, class IndexType = size_t>
+class BlockHeap {
+    CoreBlockHeap<SortType, IndexType, false> heap;
+
+public:
+    // The maximum number of values given by popBlock
+    static const IndexType BlockSize = CoreBlockHeap<SortType, IndexType, false>::S;
+
+    void push(const SortType value){
+        heap.push(value, SortType());
+    }
+
+    void push(const SortType values[], const IndexType size){
+        heap.push(values, nullptr, size);
+    }
+
+    SortType top(){
+        SortType value, unused;
+        heap.top(value, unused);
+        return value;
+    }
+
+    SortType pop(){
+        SortType value, unused;
+        heap.pop(value, unused);
+        return value;
+    }
+
+    // Write the BlockSize lowest values in dest (or less if the heap is smaller)
+    IndexType popBlock(SortType dest[]){
+        return heap.popBlock(dest, nullptr);
+    }
+
+    IndexType size() const{
+        return heap.size();
+    }
+
+    bool empty() const{
+        return heap.size() == 0;
+    }
+
+    void clear(){
+        heap.clear();
+    }
+};
+
+}
+
+namespace Sort512kv {
+
+// Priority queue of pairs that gives the lowest key first
+// (the pairs with equal keys are given in no particular order)
+template <class SortType, class IndexType = size_t>
+class BlockHeap {
+    Sort512::CoreBlockHeap<SortType, IndexType, true> heap;
+
+public:
+    static const IndexType BlockSize = Sort512::CoreBlockHeap<SortType, IndexType, true>::S;
+
+    void push(const SortType key, const SortType value){
+        heap.push(key, value);
+    }
+
+    void push(const SortType keys[], const SortType values[], const IndexType size){
+        heap.push(keys, values, size);
+    }
+
+    void top(SortType& key, SortType& value){
+        heap.top(key, value);
+    }
+
+    void pop(SortType& key, SortType& value){
+        heap.pop(key, value);
+    }
+
+    IndexType popBlock(SortType destKeys[], SortType destValues[]){
+        return heap.popBlock(destKeys, destValues);
+    }
+
+    IndexType size() const{
+        return heap.size();
+    }
+
+    bool empty() const{
+        return heap.size() == 0;
+    }
+
+    void clear(){
+        heap.clear();
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,235 @@
+//////////////////////////////////////////////////////////
+/// Code to join two arrays of key/value pairs of integers
+/// (sort-merge equi-join)
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Functions to call:
+/// Sort512join::SortMergeJoin(); to sort both sides and join them
+/// Sort512join::SortMergeJoinOmp(); to sort and join in parallel
+/// Sort512join::MergeJoin(); to join two sides already sorted by key
+/// Sort512join::MergeJoinOmp(); to join in parallel
+///
+/// For each pair of equal keys, the left value and the right value are
+/// appended to the two output vectors (in no particular order).
+/// With JoinType::LeftOuter the left values that have no match are
+/// also given with missingValue as right value.
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512JOIN_HPP
+#define SORT512JOIN_HPP
+
+#include <immintrin.h>
+#include <climits>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "sort512.hpp"
+#include "sort512kv.hpp"
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace Sort512join {
+
+enum class JoinType {
+    Inner,
+    LeftOuter
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// Merge join
+////////////////////////////////////////////////////////////////////////////////
+
+// Rotate the bits of a 16 bits mask by shift to the right
+inline __mmask16 CoreRotateMask(const __mmask16 mask, const int shift){
+    return __mmask16((mask >> shift) | (mask << ((16 - shift) & 15)));
+}
+
+// Make sure 16 more pairs can be written
+template <class IndexType>
+inline void CoreReserveOutput(std::vector<int>& outLeftValues, std::vector<int>& outRightValues,
+                              const IndexType nbPairs){
+    if(outLeftValues.size() < nbPairs + 16){
+        const size_t newSize = std::max(outLeftValues.size()*2, size_t(nbPairs + 16));
+        outLeftValues.resize(newSize);
+        outRightValues.resize(newSize);
+    }
+}
+
+// The left side is processed by blocks of 16 keys, each left block is
+// compared with all the right blocks whose interval of keys overlaps its own.
+// The all-pairs compare of two blocks uses the 16 rotations of the right block,
+// the matches are compress-stored at the end of the output vectors.
+// Every right block from rightFirst is taken (their positions do not need to be aligned).
+template <class IndexType>
+inline IndexType CoreMergeJoin(const int leftKeys[], const int leftValues[], const IndexType leftFirst,
+                               const IndexType leftLast, const int rightKeys[], const int rightValues[],
+                               const IndexType rightFirst, const IndexType rightSize,
+                               std::vector<int>& outLeftValues, std::vector<int>& outRightValues,
+                               IndexType nbPairs, const JoinType type, const int missingValue){
+    const IndexType S = 16;
+    const __m512i rotationStep = _mm512_set1_epi32(1);
+    const __m512i rotationMask = _mm512_set1_epi32(15);
+    const __m512i identity = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+                                              7, 6, 5, 4, 3, 2, 1, 0);
+    IndexType blockStart = rightFirst;
+
+    for(IndexType idx = leftFirst ; idx < leftLast ; idx += S){
+        const IndexType nbLeft = std::min(S, leftLast - idx);
+        const __mmask16 leftMask = __mmask16(0xFFFF >> (S - nbLeft));
+        const __m512i leftKeysVec = _mm512_maskz_loadu_epi32(leftMask, &leftKeys[idx]);
+        const __m512i leftValuesVec = _mm512_maskz_loadu_epi32(leftMask, &leftValues[idx]);
+        const int leftMin = leftKeys[idx];
+        const int leftMax = leftKeys[idx + nbLeft - 1];
+
+        // The right blocks that are entirely lower cannot match the next left blocks
+        while(blockStart < rightSize && rightKeys[std::min(blockStart + S, rightSize) - 1] < leftMin){
+            blockStart += S;
+        }
+
+        __mmask16 matched = 0;
+        for(IndexType jdx = blockStart ; jdx < rightSize && rightKeys[jdx] <= leftMax ; jdx += S){
+            const __mmask16 rightMask = __mmask16(0xFFFF >> (S - std::min(S, rightSize - jdx)));
+            const __m512i rightKeysVec = _mm512_maskz_loadu_epi32(rightMask, &rightKeys[jdx]);
+            const __m512i rightValuesVec = _mm512_maskz_loadu_epi32(rightMask, &rightValues[jdx]);
+
+            __m512i rotation = identity;
+            for(int idxRotation = 0 ; idxRotation < int(S) ; ++idxRotation){
+                // Lane i is compared with the lane (i+idxRotation)%16 of the right block
+                const __m512i rotatedKeys = _mm512_permutexvar_epi32(rotation, rightKeysVec);
+                const __mmask16 equal = _mm512_mask_cmp_epi32_mask(leftMask & CoreRotateMask(rightMask, idxRotation),
+                                                                   leftKeysVec, rotatedKeys, _MM_CMPINT_EQ);
+                if(equal){
+                    CoreReserveOutput(outLeftValues, outRightValues, nbPairs);
+                    _mm512_mask_compressstoreu_epi32(&outLeftValues[nbPairs], equal, leftValuesVec);
+                    _mm512_mask_compressstoreu_epi32(&outRightValues[nbPairs], equal,
+                                                     _mm512_permutexvar_epi32(rotation, rightValuesVec));
+                    nbPairs += Sort512kv::popcount(equal);
+                    matched |= equal;
+                }
+                rotation = _mm512_and_si512(_mm512_add_epi32(rotation, rotationStep), rotationMask);
+            }
+        }
+
+        if(type == JoinType::LeftOuter){
+            const __mmask16 unmatched = leftMask & ~matched;
+            if(unmatched){
+                CoreReserveOutput(outLeftValues, outRightValues, nbPairs);
+                _mm512_mask_compressstoreu_epi32(&outLeftValues[nbPairs], unmatched, leftValuesVec);
+                _mm512_mask_storeu_epi32(&outRightValues[nbPairs], __mmask16(0xFFFF >> (S - Sort512kv::popcount(unmatched))),
+                                         _mm512_set1_epi32(missingValue));
+                nbPairs += Sort512kv::popcount(unmatched);
+            }
+        }
+    }
+    return nbPairs;
+}
+
+// The two sides must be sorted by key, the output vectors are replaced
+template <class IndexType = size_t>
+inline void MergeJoin(const int leftKeys[], const int leftValues[], const IndexType leftSize,
+                      const int rightKeys[], const int rightValues[], const IndexType rightSize,
+                      std::vector<int>& outLeftValues, std::vector<int>& outRightValues,
+                      const JoinType type = JoinType::Inner, const int missingValue = INT_MIN){
+    outLeftValues.clear();
+    outRightValues.clear();
+    const IndexType nbPairs = CoreMergeJoin<IndexType>(leftKeys, leftValues, 0, leftSize, rightKeys, rightValues,
+                                                       0, rightSize, outLeftValues, outRightValues, 0,
+                                                       type, missingValue);
+    outLeftValues.resize(nbPairs);
+    outRightValues.resize(nbPairs);
+}
+
+// The pairs of both sides are sorted in place
+template <class IndexType = size_t>
+inline void SortMergeJoin(int leftKeys[], int leftValues[], const IndexType leftSize,
+                          int rightKeys[], int rightValues[], const IndexType rightSize,
+                          std::vector<int>& outLeftValues, std::vector<int>& outRightValues,
+                          const JoinType type = JoinType::Inner, const int missingValue = INT_MIN){
+    Sort512kv::Sort<int,IndexType>(leftKeys, leftValues, leftSize);
+    Sort512kv::Sort<int,IndexType>(rightKeys, rightValues, rightSize);
+    MergeJoin<IndexType>(leftKeys, leftValues, leftSize, rightKeys, rightValues, rightSize,
+                         outLeftValues, outRightValues, type, missingValue);
+}
+
+#if defined(_OPENMP)
+
+// The left side is split along the merge path of the two sides such
+// that each thread has the same number of keys to process,
+// a thread starts on the right side at the first key equal to its first left key
+template <class IndexType = size_t>
+inline void MergeJoinOmp(const int leftKeys[], const int leftValues[], const IndexType leftSize,
+                         const int rightKeys[], const int rightValues[], const IndexType rightSize,
+                         std::vector<int>& outLeftValues, std::vector<int>& outRightValues,
+                         const JoinType type = JoinType::Inner, const int missingValue = INT_MIN){
+    const int nbThreads = omp_get_max_threads();
+    std::unique_ptr<std::vector<int>[]> threadLeftValues(new std::vector<int>[nbThreads]);
+    std::unique_ptr<std::vector<int>[]> threadRightValues(new std::vector<int>[nbThreads]);
+    std::unique_ptr<IndexType[]> offsets(new IndexType[nbThreads+1]);
+
+#pragma omp parallel num_threads(nbThreads)
+    {
+        const int nbWorkers = Sort512::CoreTeamSize();
+        const int idxThread = omp_get_thread_num();
+        const IndexType totalSize = leftSize + rightSize;
+        const IndexType leftFirst = Sort512::MergePathSplit(leftKeys, leftSize, rightKeys, rightSize,
+                                                            IndexType(totalSize*idxThread/nbWorkers));
+        const IndexType leftLast = Sort512::MergePathSplit(leftKeys, leftSize, rightKeys, rightSize,
+                                                           IndexType(totalSize*(idxThread+1)/nbWorkers));
+        IndexType nbPairs = 0;
+        if(leftFirst < leftLast){
+            const IndexType rightFirst = IndexType(std::lower_bound(rightKeys, rightKeys + rightSize, leftKeys[leftFirst])
+                                                   - rightKeys);
+            nbPairs = CoreMergeJoin<IndexType>(leftKeys, leftValues, leftFirst, leftLast, rightKeys, rightValues,
+                                               rightFirst, rightSize, threadLeftValues[idxThread],
+                                               threadRightValues[idxThread], 0, type, missingValue);
+        }
+        offsets[idxThread+1] = nbPairs;
+
+#pragma omp barrier
+#pragma omp master
+        {
+            offsets[0] = 0;
+            for(int idxOffset = 0 ; idxOffset < nbWorkers ; ++idxOffset){
+                offsets[idxOffset+1] += offsets[idxOffset];
+            }
+            outLeftValues.resize(offsets[nbWorkers]);
+            outRightValues.resize(offsets[nbWorkers]);
+        }
+#pragma omp barrier
+
+        std::copy(threadLeftValues[idxThread].begin(), threadLeftValues[idxThread].begin() + nbPairs,
+                  outLeftValues.begin() + offsets[idxThread]);
+        std::copy(threadRightValues[idxThread].begin(), threadRightValues[idxThread].begin() + nbPairs,
+                  outRightValues.begin() + offsets[idxThread]);
+    }
+}
+
+template <class IndexType = size_t>
+inline void SortMergeJoinOmp(int leftKeys[], int leftValues[], const IndexType leftSize,
+                             int rightKeys[], int rightValues[], const IndexType rightSize,
+                             std::vector<int>& outLeftValues, std::vector<int>& outRightValues,
+                             const JoinType type = JoinType::Inner, const int missingValue = INT_MIN){
+    Sort512kv::SortOmpPartition<int,IndexType>(leftKeys, leftValues, leftSize);
+    Sort512kv::SortOmpPartition<int,IndexType>(rightKeys, rightValues, rightSize);
+    MergeJoinOmp<IndexType>(leftKeys, leftValues, leftSize, rightKeys, rightValues, rightSize,
+                            outLeftValues, outRightValues, type, missingValue);
+}
+
+#endif
+
+}
+
+#endif
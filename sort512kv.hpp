@@ -1,5 +1,5 @@
 //////////////////////////////////////////////////////////
-/// Code to sort an 2 arrays of integers
+/// Code to sort an 2 arrays of integers or doubles
 /// using avx 512 (targeting intel KNL/SKL).
 /// By berenger.bramas@mpcdf.mpg.de 2017.
 /// Licence is MIT.
@@ -9,9 +9,23 @@
 /// Functions to call:
 /// Sort512kv::Sort(); to sort an array
 /// Sort512kv::SortOmp(); to sort in parallel
+/// Sort512kv::SortOmpMergePath(); to sort in parallel with merges split along the merge paths
 /// Sort512kv::Partition512(); to partition
 /// Sort512kv::SmallSort16V(); to sort a small array
 /// (should be less than 16 AVX512 vectors)
+/// Sort512kv::NthElement(); to put the kth pair in its sorted position
+/// Sort512kv::PartialSort(); to sort only the k pairs with the lowest keys
+/// Sort512kv::SortUnique(); to sort and keep one pair per key
+/// Sort512kv::ReduceByKey(); to sort and reduce the values per key
+/// Sort512kv::ReduceByKeyOmp(); to sort and reduce in parallel
+/// Sort512kv::MergeCompact(); to merge two sorted runs keeping the new pair of each key
+/// Sort512kv::MergePathSplit(); to find where the merge of two arrays of pairs is split
+/// Sort512kv::Merge(); to merge two arrays of pairs sorted by key
+/// Sort512kv::MergeInsert(); to insert a batch of pairs in pairs sorted by key
+///
+/// The small sorts pad with INT_MAX (or DBL_MAX), the functions that sort pairs
+/// put the pairs with such key at the end apart before calling CoreSort(),
+/// so their values are never exchanged with the padding values.
 ///
 /// To compile such flags can be used to enable avx 512 and openmp:
 /// - KNL
@@ -24,12 +38,15 @@
 /// Or use "-march=native -mtune=native" if you are already on the right platform ("native can be replaced by "knl" or "skylake")
 //////////////////////////////////////////////////////////
 #ifndef SORT512KV_HPP
-#define SORT512LV_HPP
+#define SORT512KV_HPP
 
 #include <immintrin.h>
 #include <climits>
 #include <cfloat>
 #include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
 
 #if defined(_OPENMP)
 #include <omp.h>
@@ -5232,6 +5249,29 @@ inline void CoreSmallSort16(int* __restrict__ ptr1, int* __restrict__ values ){
 
 
 
+/// The small sorts pad the last vector with the greatest possible key,
+/// so the values attached to real keys equal to the padding could be
+/// exchanged with the padding values by the network.
+/// The entry points move such pairs at the end and sort
+/// the others only (the moved pairs are already sorted).
+template <class SortType>
+inline size_t CoreMovePadKeysToEnd(SortType* __restrict__ ptr, SortType* __restrict__ values,
+                                   const size_t length, const SortType padKey){
+    // Nothing has to be moved before the first pad key
+    size_t nbOthers = 0;
+    while(nbOthers < length && ptr[nbOthers] != padKey){
+        nbOthers += 1;
+    }
+    for(size_t idx = nbOthers ; idx < length ; ++idx){
+        if(ptr[idx] != padKey){
+            std::swap(ptr[idx], ptr[nbOthers]);
+            std::swap(values[idx], values[nbOthers]);
+            nbOthers += 1;
+        }
+    }
+    return nbOthers;
+}
+
 inline void SmallSort16V(int* __restrict__ ptr, int* __restrict__ values, const size_t length){
     // length is limited to 4 times size of a vec
     const int nbValuesInVec = 16;
@@ -5913,6 +5953,220 @@ inline void SmallSort16V(int* __restrict__ ptr, int* __restrict__ values, const
     }
 }
 
+/// Double
+
+inline void CoreSmallSort(__m512d& input, __m512d& values){
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xAA, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(4, 5, 6, 7, 0, 1, 2, 3);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xCC, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xAA, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xF0, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(5, 4, 7, 6, 1, 0, 3, 2);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xCC, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xAA, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+}
+
+inline void CoreSmallEnd1(__m512d& input, __m512d& values){
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(3, 2, 1, 0, 7, 6, 5, 4);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xF0, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(5, 4, 7, 6, 1, 0, 3, 2);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xCC, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+    {
+        __m512i idxNoNeigh = _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1);
+        __m512d permNeigh = _mm512_permutexvar_pd(idxNoNeigh, input);
+        __m512d permNeighMin = _mm512_min_pd( input,permNeigh);
+        __m512d permNeighMax = _mm512_max_pd(permNeigh, input);
+        __m512d tmp_input = _mm512_mask_mov_pd(permNeighMin, 0xAA, permNeighMax);
+
+        values = _mm512_mask_mov_pd(_mm512_permutexvar_pd(idxNoNeigh, values), _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ ),
+                                       values);
+
+        input = tmp_input;
+    }
+}
+
+/// Compare-exchange between two vectors lane by lane:
+/// input receives the minimums and input2 the maximums.
+inline void CoreExchange(__m512d& input, __m512d& input2,
+                           __m512d& input_val, __m512d& input2_val){
+    const __m512d tmp_input = _mm512_min_pd(input, input2);
+    const __m512d tmp_input2 = _mm512_max_pd(input2, input);
+    const __mmask8 keepOrder = _mm512_cmp_pd_mask(tmp_input, input, _CMP_EQ_OQ);
+
+    const __m512d tmp_input_val = _mm512_mask_mov_pd(input2_val, keepOrder, input_val);
+    input2_val = _mm512_mask_mov_pd(input_val, keepOrder, input2_val);
+    input_val = tmp_input_val;
+
+    input = tmp_input;
+    input2 = tmp_input2;
+}
+
+/// Compare the values of input with the reversed values of input2:
+/// input receives the minimums and input2 the maximums in reversed order,
+/// such that two sorted sequences of vectors become two bitonic sequences.
+inline void CoreReverseExchange(__m512d& input, __m512d& input2,
+                           __m512d& input_val, __m512d& input2_val){
+    const __m512i idxReverse = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+    __m512d permNeigh = _mm512_permutexvar_pd(idxReverse, input2);
+    __m512d permNeigh_val = _mm512_permutexvar_pd(idxReverse, input2_val);
+    CoreExchange(input, permNeigh, input_val, permNeigh_val);
+    input2 = _mm512_permutexvar_pd(idxReverse, permNeigh);
+    input2_val = _mm512_permutexvar_pd(idxReverse, permNeigh_val);
+}
+
+/// Merge two sorted vectors: input receives the 8 lowest pairs
+/// and input2 the 8 greatest, both sorted.
+inline void CoreExchangeSort2V(__m512d& input, __m512d& input2,
+                               __m512d& input_val, __m512d& input2_val){
+    CoreReverseExchange(input, input2, input_val, input2_val);
+    CoreSmallEnd1(input, input_val);
+    CoreSmallEnd1(input2, input2_val);
+}
+
+/// Bitonic sort of nbVecs vectors, nbVecs must be a power of 2
+inline void CoreSmallSortPow2(__m512d inputs[], __m512d inputs_val[], const int nbVecs){
+    for(int idxVec = 0 ; idxVec < nbVecs ; ++idxVec){
+        CoreSmallSort(inputs[idxVec], inputs_val[idxVec]);
+    }
+    for(int width = 1 ; width < nbVecs ; width *= 2){
+        for(int base = 0 ; base < nbVecs ; base += 2*width){
+            for(int idxVec = 0 ; idxVec < width ; ++idxVec){
+                CoreReverseExchange(inputs[base+idxVec], inputs[base+2*width-1-idxVec],
+                                    inputs_val[base+idxVec], inputs_val[base+2*width-1-idxVec]);
+            }
+            for(int dist = width/2 ; dist ; dist /= 2){
+                for(int idxVec = base ; idxVec < base+2*width ; ++idxVec){
+                    if((idxVec & dist) == 0){
+                        CoreExchange(inputs[idxVec], inputs[idxVec+dist],
+                                     inputs_val[idxVec], inputs_val[idxVec+dist]);
+                    }
+                }
+            }
+            for(int idxVec = base ; idxVec < base+2*width ; ++idxVec){
+                CoreSmallEnd1(inputs[idxVec], inputs_val[idxVec]);
+            }
+        }
+    }
+}
+
+inline void SmallSort16V(double* __restrict__ ptr, double* __restrict__ values, const size_t length){
+    // length is limited to 16 times size of a vec
+    const int nbValuesInVec = 8;
+    const int nbVecs = (length+nbValuesInVec-1)/nbValuesInVec;
+    const int rest = nbVecs*nbValuesInVec-length;
+    int nbVecsPow2 = 1;
+    while(nbVecsPow2 < nbVecs) nbVecsPow2 *= 2;
+    if(length == 0){
+        return;
+    }
+
+    __m512d inputs[16];
+    __m512d inputs_val[16];
+    for(int idxVec = 0 ; idxVec < nbVecs-1 ; ++idxVec){
+        inputs[idxVec] = _mm512_loadu_pd(ptr+idxVec*nbValuesInVec);
+        inputs_val[idxVec] = _mm512_loadu_pd(values+idxVec*nbValuesInVec);
+    }
+    inputs[nbVecs-1] = _mm512_mask_loadu_pd(_mm512_set1_pd(DBL_MAX), 0xFF>>rest, ptr+(nbVecs-1)*nbValuesInVec);
+    inputs_val[nbVecs-1] = _mm512_mask_loadu_pd(_mm512_set1_pd(DBL_MAX), 0xFF>>rest, values+(nbVecs-1)*nbValuesInVec);
+    for(int idxVec = nbVecs ; idxVec < nbVecsPow2 ; ++idxVec){
+        inputs[idxVec] = _mm512_set1_pd(DBL_MAX);
+        inputs_val[idxVec] = _mm512_set1_pd(DBL_MAX);
+    }
+
+    CoreSmallSortPow2(inputs, inputs_val, nbVecsPow2);
+
+    for(int idxVec = 0 ; idxVec < nbVecs-1 ; ++idxVec){
+        _mm512_storeu_pd(ptr+idxVec*nbValuesInVec, inputs[idxVec]);
+        _mm512_storeu_pd(values+idxVec*nbValuesInVec, inputs_val[idxVec]);
+    }
+    _mm512_mask_compressstoreu_pd(ptr+(nbVecs-1)*nbValuesInVec, 0xFF>>rest, inputs[nbVecs-1]);
+    _mm512_mask_compressstoreu_pd(values+(nbVecs-1)*nbValuesInVec, 0xFF>>rest, inputs_val[nbVecs-1]);
+}
+
 
 
 
@@ -6079,6 +6333,129 @@ static inline IndexType Partition512(int array[], int values[], IndexType left,
 
 
 
+template <class IndexType>
+static inline IndexType Partition512(double array[], double values[], IndexType left, IndexType right,
+                                         const double pivot){
+    const IndexType S = 8;//(512/8)/sizeof(double);
+
+    if(right-left+1 < 2*S){
+        return CoreScalarPartition<double,IndexType>(array, values, left, right, pivot);
+    }
+
+    __m512d pivotvec = _mm512_set1_pd(pivot);
+
+    __m512d left_val = _mm512_loadu_pd(&array[left]);
+    __m512d left_val_val = _mm512_loadu_pd(&values[left]);
+    IndexType left_w = left;
+    left += S;
+
+    IndexType right_w = right+1;
+    right -= S-1;
+    __m512d right_val = _mm512_loadu_pd(&array[right]);
+    __m512d right_val_val = _mm512_loadu_pd(&values[right]);
+
+    while(left + S <= right){
+        const IndexType free_left = left - left_w;
+        const IndexType free_right = right_w - right;
+
+        __m512d val;
+        __m512d val_val;
+        if( free_left <= free_right ){
+            val = _mm512_loadu_pd(&array[left]);
+            val_val = _mm512_loadu_pd(&values[left]);
+            left += S;
+        }
+        else{
+            right -= S;
+            val = _mm512_loadu_pd(&array[right]);
+            val_val = _mm512_loadu_pd(&values[right]);
+        }
+
+        __mmask8 mask = _mm512_cmp_pd_mask(val, pivotvec, _CMP_LE_OQ);
+
+        const IndexType nb_low = popcount(mask); // count mask
+        // intel _popcnt32 or _mm_countbits_32 or __builtin_popcount(mask)
+        const IndexType nb_high = S-nb_low; // S-nb_low
+
+        //if(mask){// if nb_low
+            _mm512_mask_compressstoreu_pd(&array[left_w],mask,val);
+            _mm512_mask_compressstoreu_pd(&values[left_w],mask,val_val);
+            left_w += nb_low;
+        //}
+        //if(mask != 0xFF){// if nb_high
+            right_w -= nb_high;
+            _mm512_mask_compressstoreu_pd(&array[right_w],~mask,val);
+            _mm512_mask_compressstoreu_pd(&values[right_w],~mask,val_val);
+        //}
+    }
+
+    {
+        const IndexType remaining = right - left;
+        __m512d val = _mm512_loadu_pd(&array[left]);
+        __m512d val_val = _mm512_loadu_pd(&values[left]);
+        left = right;
+
+        __mmask8 mask = _mm512_cmp_pd_mask(val, pivotvec, _CMP_LE_OQ);
+
+        __mmask8 mask_low = mask & ~(0xFF << remaining);
+        __mmask8 mask_high = (~mask) & ~(0xFF << remaining);
+
+        const IndexType nb_low = popcount(mask_low); // count mask
+        // intel _popcnt32 or _mm_countbits_32 or __builtin_popcount(mask)
+        const IndexType nb_high = popcount(mask_high); // S-nb_low
+
+        //if(mask_low){// if nb_low
+            _mm512_mask_compressstoreu_pd(&array[left_w],mask_low,val);
+            _mm512_mask_compressstoreu_pd(&values[left_w],mask_low,val_val);
+            left_w += nb_low;
+        //}
+        //if(mask_high){// if nb_high
+            right_w -= nb_high;
+            _mm512_mask_compressstoreu_pd(&array[right_w],mask_high,val);
+            _mm512_mask_compressstoreu_pd(&values[right_w],mask_high,val_val);
+        //}
+    }
+    {
+        __mmask8 mask = _mm512_cmp_pd_mask(left_val, pivotvec, _CMP_LE_OQ);
+
+        const IndexType nb_low = popcount(mask); // count mask
+        // intel _popcnt32 or _mm_countbits_32 or __builtin_popcount(mask)
+        const IndexType nb_high = S-nb_low; // S-nb_low
+
+        //if(mask){// if nb_low
+            _mm512_mask_compressstoreu_pd(&array[left_w],mask,left_val);
+            _mm512_mask_compressstoreu_pd(&values[left_w],mask,left_val_val);
+            left_w += nb_low;
+        //}
+        //if(mask != 0xFF){// if nb_high
+            right_w -= nb_high;
+            _mm512_mask_compressstoreu_pd(&array[right_w],~mask,left_val);
+            _mm512_mask_compressstoreu_pd(&values[right_w],~mask,left_val_val);
+        //}
+    }
+    {
+        __mmask8 mask = _mm512_cmp_pd_mask(right_val, pivotvec, _CMP_LE_OQ);
+
+        const IndexType nb_low = popcount(mask); // count mask
+        // intel _popcnt32 or _mm_countbits_32 or __builtin_popcount(mask)
+        const IndexType nb_high = S-nb_low; // S-nb_low
+
+        //if(mask){// if nb_low
+            _mm512_mask_compressstoreu_pd(&array[left_w],mask,right_val);
+            _mm512_mask_compressstoreu_pd(&values[left_w],mask,right_val_val);
+            left_w += nb_low;
+        //}
+        //if(mask != 0xFF){// if nb_high
+            right_w -= nb_high;
+            _mm512_mask_compressstoreu_pd(&array[right_w],~mask,right_val);
+            _mm512_mask_compressstoreu_pd(&values[right_w],~mask,right_val_val);
+         //}
+    }
+    return left_w;
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Main functions
 ////////////////////////////////////////////////////////////////////////////////
@@ -6116,6 +6493,28 @@ static inline IndexType CoreSortPartition(SortType array[], SortType values[],
     return  Partition512(array, values, left, right, pivot);
 }
 
+// Greatest value lower than value
+inline int CoreSortPreviousValue(const int value){
+    return value - 1;
+}
+
+inline double CoreSortPreviousValue(const double value){
+    return std::nextafter(value, -std::numeric_limits<double>::infinity());
+}
+
+// When most of the values are on the left of the pivot, the values equal to
+// the pivot are moved next to it (to avoid a quadratic complexity with many
+// duplicates), returns the position of the first value equal to the pivot
+template <class SortType, class IndexType = size_t>
+static inline IndexType CoreSortEqualPartition(SortType array[], SortType values[], const IndexType left,
+                                               const IndexType part, const IndexType right){
+    if(left < part && (right-left)/8*7 < part-left
+            && array[part] != std::numeric_limits<SortType>::lowest()){
+        return Partition512(array, values, left, part-1, CoreSortPreviousValue(array[part]));
+    }
+    return part;
+}
+
 template <class SortType, class IndexType = size_t>
 static void CoreSort(SortType array[], SortType values[], const IndexType left, const IndexType right){
     static const int SortLimite = 16*64/sizeof(SortType);
@@ -6124,19 +6523,873 @@ static void CoreSort(SortType array[], SortType values[], const IndexType left,
     }
     else{
         const IndexType part = CoreSortPivotPartition<SortType,IndexType>(array, values, left, right);
+        const IndexType firstEqual = CoreSortEqualPartition<SortType,IndexType>(array, values, left, part, right);
         if(part+1 < right) CoreSort<SortType,IndexType>(array,values,part+1,right);
-        if(part && left < part-1)  CoreSort<SortType,IndexType>(array,values,left,part - 1);
+        if(firstEqual && left < firstEqual-1)  CoreSort<SortType,IndexType>(array,values,left,firstEqual - 1);
     }
 }
 
 template <class SortType, class IndexType = size_t>
 static inline void Sort(SortType array[], SortType values[], const IndexType size){
-    CoreSort<SortType,IndexType>(array, values, 0, size-1);
+    const IndexType nbOthers = IndexType(CoreMovePadKeysToEnd(array, values, size_t(size),
+                                                              std::numeric_limits<SortType>::max()));
+    if(nbOthers > 1){
+        CoreSort<SortType,IndexType>(array, values, 0, nbOthers-1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Selection
+////////////////////////////////////////////////////////////////////////////////
+
+template <class SortType, class IndexType>
+inline IndexType CoreSelectMedian3(const SortType array[], const IndexType idx1, const IndexType idx2,
+                                   const IndexType idx3){
+    if(array[idx1] < array[idx2]){
+        return (array[idx2] < array[idx3] ? idx2 : (array[idx1] < array[idx3] ? idx3 : idx1));
+    }
+    return (array[idx1] < array[idx3] ? idx1 : (array[idx2] < array[idx3] ? idx3 : idx2));
+}
+
+// Pseudo-median of nine keys spread over the interval (median of three medians)
+template <class SortType, class IndexType>
+inline IndexType CoreSelectGetPivot(const SortType array[], const IndexType left, const IndexType right){
+    const IndexType step = (right-left)/8;
+    const IndexType median1 = CoreSelectMedian3(array, left, left + step, left + 2*step);
+    const IndexType median2 = CoreSelectMedian3(array, left + 3*step, left + 4*step, left + 5*step);
+    const IndexType median3 = CoreSelectMedian3(array, left + 6*step, left + 7*step, right);
+    return CoreSelectMedian3(array, median1, median2, median3);
+}
+
+template <class SortType, class IndexType>
+inline IndexType CoreSelectPivotPartition(SortType array[], SortType values[], const IndexType left, const IndexType right){
+    const IndexType pivotIdx = CoreSelectGetPivot(array, left, right);
+    std::swap(array[pivotIdx], array[right]);
+    std::swap(values[pivotIdx], values[right]);
+    const IndexType part = Partition512(array, values, left, right-1, array[right]);
+    std::swap(array[part], array[right]);
+    std::swap(values[part], values[right]);
+    return part;
+}
+
+// Partition the pairs until the key at position kth is in its sorted position,
+// only the side that contains kth is partitioned again
+template <class SortType, class IndexType>
+inline void CoreSelect(SortType array[], SortType values[], IndexType left, IndexType right, const IndexType kth){
+    static const int SortLimite = 16*64/sizeof(SortType);
+    int nbPartitionsLeft = 0;
+    for(IndexType size = right-left+1 ; size ; size >>= 1){
+        nbPartitionsLeft += 2;
+    }
+    while(SortLimite <= right-left){
+        if(nbPartitionsLeft == 0){
+            CoreSort<SortType,IndexType>(array, values, left, right);
+            return;
+        }
+        nbPartitionsLeft -= 1;
+        const IndexType part = CoreSelectPivotPartition<SortType,IndexType>(array, values, left, right);
+        if(part < kth){
+            left = part + 1;
+        }
+        else{
+            const IndexType firstEqual = CoreSortEqualPartition<SortType,IndexType>(array, values, left, part, right);
+            if(firstEqual <= kth){
+                return;
+            }
+            right = firstEqual - 1;
+        }
+    }
+    SmallSort16V(array+left, values+left, right-left+1);
+}
+
+// Put in array[kth] (and values[kth]) the pair that would be there if the pairs were sorted
+template <class SortType, class IndexType = size_t>
+static inline void NthElement(SortType array[], SortType values[], const IndexType size, const IndexType kth){
+    if(kth < size){
+        const IndexType nbOthers = IndexType(CoreMovePadKeysToEnd(array, values, size_t(size),
+                                                                  std::numeric_limits<SortType>::max()));
+        if(kth < nbOthers){
+            CoreSelect<SortType,IndexType>(array, values, 0, nbOthers-1, kth);
+        }
+    }
+}
+
+// Sort the nbFirst pairs with the lowest keys at the beginning of the arrays
+template <class SortType, class IndexType = size_t>
+static inline void PartialSort(SortType array[], SortType values[], const IndexType size, const IndexType nbFirst){
+    if(nbFirst == 0 || size == 0){
+        return;
+    }
+    const IndexType nbOthers = IndexType(CoreMovePadKeysToEnd(array, values, size_t(size),
+                                                              std::numeric_limits<SortType>::max()));
+    const IndexType nbToSort = std::min(nbFirst, nbOthers);
+    if(nbToSort == 0){
+        return;
+    }
+    if(nbToSort < nbOthers){
+        CoreSelect<SortType,IndexType>(array, values, 0, nbOthers-1, nbToSort-1);
+    }
+    CoreSort<SortType,IndexType>(array, values, 0, nbToSort-1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Reductions by key
+////////////////////////////////////////////////////////////////////////////////
+
+struct ReduceSum {
+    static inline __m512i Apply(const __m512i v1, const __m512i v2){
+        return _mm512_add_epi32(v1, v2);
+    }
+    static inline __m512d Apply(const __m512d v1, const __m512d v2){
+        return _mm512_add_pd(v1, v2);
+    }
+    template <class NumType>
+    static inline NumType Apply(const NumType v1, const NumType v2){
+        return v1 + v2;
+    }
+};
+
+struct ReduceMin {
+    static inline __m512i Apply(const __m512i v1, const __m512i v2){
+        return _mm512_min_epi32(v1, v2);
+    }
+    static inline __m512d Apply(const __m512d v1, const __m512d v2){
+        return _mm512_min_pd(v1, v2);
+    }
+    template <class NumType>
+    static inline NumType Apply(const NumType v1, const NumType v2){
+        return std::min(v1, v2);
+    }
+};
+
+struct ReduceMax {
+    static inline __m512i Apply(const __m512i v1, const __m512i v2){
+        return _mm512_max_epi32(v1, v2);
+    }
+    static inline __m512d Apply(const __m512d v1, const __m512d v2){
+        return _mm512_max_pd(v1, v2);
+    }
+    template <class NumType>
+    static inline NumType Apply(const NumType v1, const NumType v2){
+        return std::max(v1, v2);
+    }
+};
+
+inline int CoreExtractLane(const __m512i vec, const int lane){
+    return _mm_cvtsi128_si32(_mm512_castsi512_si128(_mm512_permutexvar_epi32(_mm512_set1_epi32(lane), vec)));
+}
+
+inline double CoreExtractLane(const __m512d vec, const int lane){
+    return _mm_cvtsd_f64(_mm512_castpd512_pd128(_mm512_permutexvar_pd(_mm512_set1_epi64(lane), vec)));
+}
+
+// The keys must be sorted, the values of each group of equal keys are reduced
+// with Operator and the pairs (key, reduction) are stored in outKeys/outValues
+// that can be the same arrays as keys/values.
+// Each vector is processed with a segmented scan, the group that crosses
+// the vector boundary is carried to the next vector.
+template <class Operator, class IndexType>
+inline IndexType CoreReduceSorted(const int keys[], const int values[], const IndexType size,
+                                  int outKeys[], int outValues[]){
+    const IndexType S = 16;
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i previous = zero;
+    int carryKey = 0;
+    int carryValue = 0;
+    IndexType nbGroups = 0;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask16 remaining = (size - idx >= S ? 0xFFFF : __mmask16(0xFFFF >> (S - (size - idx))));
+        const __m512i keysVec = _mm512_maskz_loadu_epi32(remaining, &keys[idx]);
+        __m512i valuesVec = _mm512_maskz_loadu_epi32(remaining, &values[idx]);
+        const __mmask16 starts = _mm512_mask_cmp_epi32_mask(remaining, keysVec, _mm512_alignr_epi32(keysVec, previous, 15),
+                                                            _MM_CMPINT_NE) | (idx == 0 ? 1 : 0);
+        previous = keysVec;
+
+        if(idx && (starts & 1)){
+            outKeys[nbGroups] = carryKey;
+            outValues[nbGroups] = carryValue;
+            nbGroups += 1;
+        }
+
+        __mmask16 flags = starts;
+        valuesVec = _mm512_mask_mov_epi32(valuesVec, __mmask16(~flags & (0xFFFF << 1)), Operator::Apply(valuesVec, _mm512_alignr_epi32(valuesVec, zero, 15)));
+        flags = __mmask16(flags | (flags << 1));
+        valuesVec = _mm512_mask_mov_epi32(valuesVec, __mmask16(~flags & (0xFFFF << 2)), Operator::Apply(valuesVec, _mm512_alignr_epi32(valuesVec, zero, 14)));
+        flags = __mmask16(flags | (flags << 2));
+        valuesVec = _mm512_mask_mov_epi32(valuesVec, __mmask16(~flags & (0xFFFF << 4)), Operator::Apply(valuesVec, _mm512_alignr_epi32(valuesVec, zero, 12)));
+        flags = __mmask16(flags | (flags << 4));
+        valuesVec = _mm512_mask_mov_epi32(valuesVec, __mmask16(~flags & (0xFFFF << 8)), Operator::Apply(valuesVec, _mm512_alignr_epi32(valuesVec, zero, 8)));
+
+        if((starts & 1) == 0){
+            // The lanes before the first start continue the carried group
+            const __mmask16 continued = (starts ? __mmask16((starts & -starts) - 1) : remaining);
+            valuesVec = _mm512_mask_mov_epi32(valuesVec, continued, Operator::Apply(valuesVec, _mm512_set1_epi32(carryValue)));
+        }
+
+        // A group ends on the left of each start
+        const __mmask16 ends = (starts >> 1);
+        _mm512_mask_compressstoreu_epi32(&outKeys[nbGroups], ends, keysVec);
+        _mm512_mask_compressstoreu_epi32(&outValues[nbGroups], ends, valuesVec);
+        nbGroups += popcount(ends);
+
+        const int lastLane = int(size - idx >= S ? S - 1 : size - idx - 1);
+        carryKey = CoreExtractLane(keysVec, lastLane);
+        carryValue = CoreExtractLane(valuesVec, lastLane);
+    }
+    if(size){
+        outKeys[nbGroups] = carryKey;
+        outValues[nbGroups] = carryValue;
+        nbGroups += 1;
+    }
+    return nbGroups;
+}
+
+template <class Operator, class IndexType>
+inline IndexType CoreReduceSorted(const double keys[], const double values[], const IndexType size,
+                                  double outKeys[], double outValues[]){
+    const IndexType S = 8;
+    const __m512i zero = _mm512_setzero_si512();
+    __m512d previous = _mm512_setzero_pd();
+    double carryKey = 0;
+    double carryValue = 0;
+    IndexType nbGroups = 0;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask8 remaining = (size - idx >= S ? 0xFF : __mmask8(0xFF >> (S - (size - idx))));
+        const __m512d keysVec = _mm512_maskz_loadu_pd(remaining, &keys[idx]);
+        __m512d valuesVec = _mm512_maskz_loadu_pd(remaining, &values[idx]);
+        const __mmask8 starts = _mm512_mask_cmp_pd_mask(remaining, keysVec,
+                                                        _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(keysVec),
+                                                                                                _mm512_castpd_si512(previous), 7)),
+                                                        _CMP_NEQ_UQ) | (idx == 0 ? 1 : 0);
+        previous = keysVec;
+
+        if(idx && (starts & 1)){
+            outKeys[nbGroups] = carryKey;
+            outValues[nbGroups] = carryValue;
+            nbGroups += 1;
+        }
+
+        __mmask8 flags = starts;
+        valuesVec = _mm512_mask_mov_pd(valuesVec, __mmask8(~flags & (0xFF << 1)),
+                                       Operator::Apply(valuesVec, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(valuesVec), zero, 7))));
+        flags = __mmask8(flags | (flags << 1));
+        valuesVec = _mm512_mask_mov_pd(valuesVec, __mmask8(~flags & (0xFF << 2)),
+                                       Operator::Apply(valuesVec, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(valuesVec), zero, 6))));
+        flags = __mmask8(flags | (flags << 2));
+        valuesVec = _mm512_mask_mov_pd(valuesVec, __mmask8(~flags & (0xFF << 4)),
+                                       Operator::Apply(valuesVec, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(valuesVec), zero, 4))));
+
+        if((starts & 1) == 0){
+            // The lanes before the first start continue the carried group
+            const __mmask8 continued = (starts ? __mmask8((starts & -starts) - 1) : remaining);
+            valuesVec = _mm512_mask_mov_pd(valuesVec, continued, Operator::Apply(valuesVec, _mm512_set1_pd(carryValue)));
+        }
+
+        // A group ends on the left of each start
+        const __mmask8 ends = (starts >> 1);
+        _mm512_mask_compressstoreu_pd(&outKeys[nbGroups], ends, keysVec);
+        _mm512_mask_compressstoreu_pd(&outValues[nbGroups], ends, valuesVec);
+        nbGroups += popcount(ends);
+
+        const int lastLane = int(size - idx >= S ? S - 1 : size - idx - 1);
+        carryKey = CoreExtractLane(keysVec, lastLane);
+        carryValue = CoreExtractLane(valuesVec, lastLane);
+    }
+    if(size){
+        outKeys[nbGroups] = carryKey;
+        outValues[nbGroups] = carryValue;
+        nbGroups += 1;
+    }
+    return nbGroups;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sort unique
+////////////////////////////////////////////////////////////////////////////////
+
+enum class KeepValue {
+    First,
+    Last
+};
+
+template <class IndexType>
+inline void CoreGatherValues(const int source[], const int positions[], int dest[], const IndexType size){
+    const IndexType S = 16;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask16 remaining = (size - idx >= S ? 0xFFFF : __mmask16(0xFFFF >> (S - (size - idx))));
+        const __m512i indexes = _mm512_maskz_loadu_epi32(remaining, &positions[idx]);
+        _mm512_mask_storeu_epi32(&dest[idx], remaining,
+                                 _mm512_mask_i32gather_epi32(indexes, remaining, indexes, source, sizeof(int)));
+    }
+}
+
+template <class IndexType>
+inline void CoreGatherValues(const double source[], const double positions[], double dest[], const IndexType size){
+    const IndexType S = 8;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask8 remaining = (size - idx >= S ? 0xFF : __mmask8(0xFF >> (S - (size - idx))));
+        const __m256i indexes = _mm512_cvttpd_epi32(_mm512_maskz_loadu_pd(remaining, &positions[idx]));
+        _mm512_mask_storeu_pd(&dest[idx], remaining,
+                              _mm512_mask_i32gather_pd(_mm512_setzero_pd(), remaining, indexes, source, sizeof(double)));
+    }
+}
+
+// Sort the pairs and keep one pair per key, the value of the first
+// (or last) occurrence of the key in the original array is kept.
+// The keys are sorted with their positions as values, the min (or max)
+// position of each group is obtained with a segmented reduction.
+// Returns the number of unique keys stored at the beginning of the arrays.
+template <class SortType, class IndexType = size_t>
+static inline IndexType SortUnique(SortType array[], SortType values[], const IndexType size,
+                                   const KeepValue keep = KeepValue::First){
+    if(size == 0){
+        return 0;
+    }
+    std::unique_ptr<SortType[]> source(new SortType[size]);
+    std::copy(values, values+size, source.get());
+    for(IndexType idx = 0 ; idx < size ; ++idx){
+        values[idx] = SortType(idx);
+    }
+    Sort<SortType,IndexType>(array, values, size);
+
+    const IndexType nbUnique = (keep == KeepValue::First ?
+                                CoreReduceSorted<ReduceMin>(array, values, size, array, values)
+                              : CoreReduceSorted<ReduceMax>(array, values, size, array, values));
+
+    CoreGatherValues(source.get(), values, values, nbUnique);
+    return nbUnique;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+/// Reduce by key
+////////////////////////////////////////////////////////////////////////////////
+
+// Sort the pairs and reduce the values of each key with op (ReduceSum(),
+// ReduceMin() or ReduceMax()), the keys and their reductions are stored
+// at the beginning of the arrays, returns the number of distinct keys
+template <class SortType, class Operator, class IndexType = size_t>
+static inline IndexType ReduceByKey(SortType keys[], SortType values[], const IndexType size, const Operator /*op*/){
+    if(size == 0){
+        return 0;
+    }
+    Sort<SortType,IndexType>(keys, values, size);
+    return CoreReduceSorted<Operator>(keys, values, size, keys, values);
+}
+
+template <class IndexType>
+inline void CoreConvertKeys(const int keys[], double dest[], const IndexType size){
+    const IndexType S = 8;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask8 remaining = (size - idx >= S ? 0xFF : __mmask8(0xFF >> (S - (size - idx))));
+        _mm512_mask_storeu_pd(&dest[idx], remaining,
+                              _mm512_cvtepi32_pd(_mm512_castsi512_si256(_mm512_maskz_loadu_epi32(remaining, &keys[idx]))));
+    }
+}
+
+template <class IndexType>
+inline void CoreConvertKeys(const double keys[], int dest[], const IndexType size){
+    const IndexType S = 8;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask8 remaining = (size - idx >= S ? 0xFF : __mmask8(0xFF >> (S - (size - idx))));
+        _mm512_mask_storeu_epi32(&dest[idx], remaining,
+                                 _mm512_castsi256_si512(_mm512_cvttpd_epi32(_mm512_maskz_loadu_pd(remaining, &keys[idx]))));
+    }
+}
+
+// Int keys with double values, the keys are converted
+// to double (which is exact) to use the double pairs
+template <class Operator, class IndexType = size_t>
+static inline IndexType ReduceByKey(int keys[], double values[], const IndexType size, const Operator op){
+    std::unique_ptr<double[]> doubleKeys(new double[size]);
+    CoreConvertKeys(keys, doubleKeys.get(), size);
+    const IndexType nbKeys = ReduceByKey<double,Operator,IndexType>(doubleKeys.get(), values, size, op);
+    CoreConvertKeys(doubleKeys.get(), keys, nbKeys);
+    return nbKeys;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Merge compaction
+////////////////////////////////////////////////////////////////////////////////
+
+template <class SortType>
+struct CoreMergeVec;
+
+template <>
+struct CoreMergeVec<int> {
+    static const int S = 16;
+    typedef __mmask16 Mask;
+    typedef __m512i VecType;
+
+    static inline Mask FirstLanes(const int nbLanes){
+        return Mask(0xFFFF >> (S - nbLanes));
+    }
+    static inline VecType Load(const int* ptr){
+        return _mm512_loadu_si512(ptr);
+    }
+    static inline VecType Load(const Mask mask, const int* ptr){
+        return _mm512_maskz_loadu_epi32(mask, ptr);
+    }
+    static inline void Store(int* ptr, const VecType vec){
+        _mm512_storeu_si512(ptr, vec);
+    }
+    static inline void CompressStore(int* ptr, const Mask mask, const VecType vec){
+        _mm512_mask_compressstoreu_epi32(ptr, mask, vec);
+    }
+    // Lane i is set if keys[i] is equal to one of the keys of others (all-pairs
+    // compare with the 16 rotations of others)
+    static inline Mask MatchMask(const Mask mask, const VecType keys, const Mask othersMask, const VecType others){
+        const __m512i rotationStep = _mm512_set1_epi32(1);
+        const __m512i rotationMask = _mm512_set1_epi32(15);
+        __m512i rotation = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+                                            7, 6, 5, 4, 3, 2, 1, 0);
+        Mask match = 0;
+        for(int idxRotation = 0 ; idxRotation < S ; ++idxRotation){
+            const Mask rotatedMask = Mask((othersMask >> idxRotation) | (othersMask << ((S - idxRotation) & 15)));
+            match |= _mm512_mask_cmp_epi32_mask(mask & rotatedMask, keys, _mm512_permutexvar_epi32(rotation, others),
+                                                _MM_CMPINT_EQ);
+            rotation = _mm512_and_si512(_mm512_add_epi32(rotation, rotationStep), rotationMask);
+        }
+        return match;
+    }
+};
+
+template <>
+struct CoreMergeVec<double> {
+    static const int S = 8;
+    typedef __mmask8 Mask;
+    typedef __m512d VecType;
+
+    static inline Mask FirstLanes(const int nbLanes){
+        return Mask(0xFF >> (S - nbLanes));
+    }
+    static inline VecType Load(const double* ptr){
+        return _mm512_loadu_pd(ptr);
+    }
+    static inline VecType Load(const Mask mask, const double* ptr){
+        return _mm512_maskz_loadu_pd(mask, ptr);
+    }
+    static inline void Store(double* ptr, const VecType vec){
+        _mm512_storeu_pd(ptr, vec);
+    }
+    static inline void CompressStore(double* ptr, const Mask mask, const VecType vec){
+        _mm512_mask_compressstoreu_pd(ptr, mask, vec);
+    }
+    // Lane i is set if keys[i] is equal to one of the keys of others (all-pairs
+    // compare with the 8 rotations of others)
+    static inline Mask MatchMask(const Mask mask, const VecType keys, const Mask othersMask, const VecType others){
+        const __m512i rotationStep = _mm512_set1_epi64(1);
+        const __m512i rotationMask = _mm512_set1_epi64(7);
+        __m512i rotation = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+        Mask match = 0;
+        for(int idxRotation = 0 ; idxRotation < S ; ++idxRotation){
+            const Mask rotatedMask = Mask((othersMask >> idxRotation) | (othersMask << ((S - idxRotation) & 7)));
+            match |= _mm512_mask_cmp_pd_mask(mask & rotatedMask, keys, _mm512_permutexvar_pd(rotation, others),
+                                             _CMP_EQ_OQ);
+            rotation = _mm512_and_si512(_mm512_add_epi64(rotation, rotationStep), rotationMask);
+        }
+        return match;
+    }
+};
+
+// Scalar merge of the last pairs: the pairs of the three first arrays have
+// distinct keys, a pair of the old run is dropped if its key is in one of them.
+// Once the old run is exhausted, the pairs of an array that are lower than
+// the next keys of the two others are copied in bulk.
+template <class SortType, class IndexType>
+inline IndexType CoreMergeCompactTail(const SortType* keys[3], const SortType* values[3], const IndexType sizes[3],
+                                      const SortType oldKeys[], const SortType oldValues[], const IndexType oldSize,
+                                      SortType outKeys[], SortType outValues[], IndexType nbOut){
+    IndexType positions[3] = {0, 0, 0};
+    IndexType idxOld = 0;
+    while(true){
+        int selected = -1;
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(positions[idxArray] != sizes[idxArray]
+                    && (selected == -1 || keys[idxArray][positions[idxArray]] < keys[selected][positions[selected]])){
+                selected = idxArray;
+            }
+        }
+        if(selected == -1){
+            break;
+        }
+        if(idxOld == oldSize){
+            const SortType* selectedKeys = keys[selected];
+            IndexType runEnd = sizes[selected];
+            for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+                if(idxArray != selected && positions[idxArray] != sizes[idxArray]){
+                    runEnd = IndexType(std::lower_bound(&selectedKeys[positions[selected]], &selectedKeys[runEnd],
+                                                        keys[idxArray][positions[idxArray]]) - selectedKeys);
+                }
+            }
+            std::copy(&selectedKeys[positions[selected]], &selectedKeys[runEnd], &outKeys[nbOut]);
+            std::copy(&values[selected][positions[selected]], &values[selected][runEnd], &outValues[nbOut]);
+            nbOut += runEnd - positions[selected];
+            positions[selected] = runEnd;
+            continue;
+        }
+        const SortType key = keys[selected][positions[selected]];
+        for( ; idxOld != oldSize && oldKeys[idxOld] <= key ; ++idxOld){
+            if(oldKeys[idxOld] != key){
+                outKeys[nbOut] = oldKeys[idxOld];
+                outValues[nbOut] = oldValues[idxOld];
+                nbOut += 1;
+            }
+        }
+        outKeys[nbOut] = key;
+        outValues[nbOut] = values[selected][positions[selected]];
+        nbOut += 1;
+        positions[selected] += 1;
+    }
+    std::copy(&oldKeys[idxOld], &oldKeys[oldSize], &outKeys[nbOut]);
+    std::copy(&oldValues[idxOld], &oldValues[oldSize], &outValues[nbOut]);
+    return nbOut + (oldSize - idxOld);
+}
+
+// Merge two runs of pairs sorted by key, each run having distinct keys,
+// when a key is in both runs only the pair of the new run is kept.
+// The pairs of the old run whose key is in the new run are removed on the fly
+// (compare of each block of the old run with the blocks of the new run that
+// overlap it and compress store in a small buffer), then the remaining pairs
+// are merged with the new run one vector at a time with the bitonic network.
+// The output arrays must be able to contain oldSize + newSize pairs,
+// returns the number of pairs written.
+template <class SortType, class IndexType = size_t>
+static inline IndexType MergeCompact(const SortType oldKeys[], const SortType oldValues[], const IndexType oldSize,
+                                     const SortType newKeys[], const SortType newValues[], const IndexType newSize,
+                                     SortType outKeys[], SortType outValues[]){
+    typedef CoreMergeVec<SortType> Vec;
+    const IndexType S = Vec::S;
+
+    // The old pairs whose key is not in the new run
+    SortType bufferKeys[2*Vec::S];
+    SortType bufferValues[2*Vec::S];
+    IndexType nbBuffered = 0;
+    IndexType idxOld = 0;
+    IndexType idxFilter = 0;
+
+    auto refill = [&](){
+        while(nbBuffered < S && idxOld < oldSize){
+            const IndexType nbOld = std::min(S, oldSize - idxOld);
+            const typename Vec::Mask oldMask = Vec::FirstLanes(int(nbOld));
+            const typename Vec::VecType keys = Vec::Load(oldMask, &oldKeys[idxOld]);
+            const SortType firstKey = oldKeys[idxOld];
+            const SortType lastKey = oldKeys[idxOld + nbOld - 1];
+
+            while(idxFilter < newSize && newKeys[std::min(idxFilter + S, newSize) - 1] < firstKey){
+                idxFilter += S;
+            }
+            typename Vec::Mask found = 0;
+            for(IndexType idxBlock = idxFilter ; idxBlock < newSize && newKeys[idxBlock] <= lastKey ; idxBlock += S){
+                const typename Vec::Mask newMask = Vec::FirstLanes(int(std::min(S, newSize - idxBlock)));
+                found |= Vec::MatchMask(oldMask, keys, newMask, Vec::Load(newMask, &newKeys[idxBlock]));
+            }
+
+            const typename Vec::Mask kept = oldMask & typename Vec::Mask(~found);
+            Vec::CompressStore(&bufferKeys[nbBuffered], kept, keys);
+            Vec::CompressStore(&bufferValues[nbBuffered], kept, Vec::Load(oldMask, &oldValues[idxOld]));
+            nbBuffered += popcount(kept);
+            idxOld += nbOld;
+        }
+    };
+    auto consume = [&](){
+        std::copy(&bufferKeys[S], &bufferKeys[nbBuffered], &bufferKeys[0]);
+        std::copy(&bufferValues[S], &bufferValues[nbBuffered], &bufferValues[0]);
+        nbBuffered -= S;
+    };
+
+    IndexType idxNew = 0;
+    IndexType nbOut = 0;
+    SortType greatestKeys[Vec::S];
+    SortType greatestValues[Vec::S];
+    IndexType nbGreatest = 0;
+
+    refill();
+    if(nbBuffered >= S && newSize >= S){
+        typename Vec::VecType lowest = Vec::Load(bufferKeys);
+        typename Vec::VecType lowest_val = Vec::Load(bufferValues);
+        consume();
+        typename Vec::VecType greatest = Vec::Load(newKeys);
+        typename Vec::VecType greatest_val = Vec::Load(newValues);
+        idxNew = S;
+
+        while(true){
+            CoreExchangeSort2V(lowest, greatest, lowest_val, greatest_val);
+            Vec::Store(&outKeys[nbOut], lowest);
+            Vec::Store(&outValues[nbOut], lowest_val);
+            nbOut += S;
+
+            refill();
+            if(nbBuffered < S || idxNew + S > newSize){
+                break;
+            }
+            if(bufferKeys[0] < newKeys[idxNew]){
+                lowest = Vec::Load(bufferKeys);
+                lowest_val = Vec::Load(bufferValues);
+                consume();
+            }
+            else{
+                lowest = Vec::Load(&newKeys[idxNew]);
+                lowest_val = Vec::Load(&newValues[idxNew]);
+                idxNew += S;
+            }
+        }
+        Vec::Store(greatestKeys, greatest);
+        Vec::Store(greatestValues, greatest_val);
+        nbGreatest = S;
+    }
+
+    const SortType* keys[3] = {greatestKeys, bufferKeys, &newKeys[idxNew]};
+    const SortType* values[3] = {greatestValues, bufferValues, &newValues[idxNew]};
+    const IndexType sizes[3] = {nbGreatest, nbBuffered, newSize - idxNew};
+    return CoreMergeCompactTail(keys, values, sizes, &oldKeys[idxOld], &oldValues[idxOld], oldSize - idxOld,
+                                outKeys, outValues, nbOut);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Merge
+////////////////////////////////////////////////////////////////////////////////
+
+// Returns the number of keys that come from keys1 in the first diag pairs
+// of the merge of keys1 and keys2 (the pairs of keys1 go first when equal)
+template <class SortType, class IndexType = size_t>
+inline IndexType MergePathSplit(const SortType keys1[], const IndexType size1,
+                                const SortType keys2[], const IndexType size2, const IndexType diag){
+    IndexType low = (diag > size2 ? diag - size2 : 0);
+    IndexType high = std::min(diag, size1);
+    while(low < high){
+        const IndexType middle = low + (high-low)/2;
+        if(keys1[middle] <= keys2[diag - middle - 1]){
+            low = middle + 1;
+        }
+        else{
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Scalar merge of the three sorted arrays of pairs, the pairs of the array with the lowest
+// key are copied up to the lowest key of the others (which are often small)
+template <class SortType, class IndexType>
+inline void CoreMergeTail(const SortType* keys[3], const SortType* values[3], const IndexType sizes[3],
+                          SortType destKeys[], SortType destValues[]){
+    IndexType positions[3] = {0, 0, 0};
+    while(true){
+        int selected = -1;
+        int nbNotEmpty = 0;
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(positions[idxArray] != sizes[idxArray]){
+                nbNotEmpty += 1;
+                if(selected == -1 || keys[idxArray][positions[idxArray]] < keys[selected][positions[selected]]){
+                    selected = idxArray;
+                }
+            }
+        }
+        if(nbNotEmpty <= 1){
+            if(selected != -1){
+                std::copy(&keys[selected][positions[selected]], &keys[selected][sizes[selected]], destKeys);
+                std::copy(&values[selected][positions[selected]], &values[selected][sizes[selected]], destValues);
+            }
+            return;
+        }
+        bool hasLimit = false;
+        SortType limit = SortType();
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(idxArray != selected && positions[idxArray] != sizes[idxArray]
+                    && (hasLimit == false || keys[idxArray][positions[idxArray]] < limit)){
+                limit = keys[idxArray][positions[idxArray]];
+                hasLimit = true;
+            }
+        }
+        const IndexType runSize = IndexType(std::upper_bound(&keys[selected][positions[selected]] + 1,
+                                                             &keys[selected][sizes[selected]], limit)
+                                            - &keys[selected][positions[selected]]);
+        destKeys = std::copy(&keys[selected][positions[selected]], &keys[selected][positions[selected] + runSize], destKeys);
+        destValues = std::copy(&values[selected][positions[selected]], &values[selected][positions[selected] + runSize], destValues);
+        positions[selected] += runSize;
+    }
+}
+
+// Merge two arrays of pairs sorted by key in dest, one vector at a time: the next
+// vector is taken from the array with the lowest next key and merged with the vector
+// of the greatest keys by the bitonic network, the lowest pairs are stored.
+// The destination can end where the second array starts (destKeys + size1 == keys2
+// and destValues + size1 == values2) as the pairs are loaded before being overwritten.
+template <class SortType, class IndexType = size_t>
+static inline void Merge(const SortType keys1[], const SortType values1[], const IndexType size1,
+                         const SortType keys2[], const SortType values2[], const IndexType size2,
+                         SortType destKeys[], SortType destValues[]){
+    typedef CoreMergeVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    IndexType idx1 = 0;
+    IndexType idx2 = 0;
+    IndexType nbOut = 0;
+    SortType greatestKeys[Vec::S];
+    SortType greatestValues[Vec::S];
+    IndexType nbGreatest = 0;
+
+    if(size1 >= S && size2 >= S){
+        typename Vec::VecType lowest = Vec::Load(&keys1[0]);
+        typename Vec::VecType lowest_val = Vec::Load(&values1[0]);
+        typename Vec::VecType greatest = Vec::Load(&keys2[0]);
+        typename Vec::VecType greatest_val = Vec::Load(&values2[0]);
+        idx1 = S;
+        idx2 = S;
+        while(true){
+            CoreExchangeSort2V(lowest, greatest, lowest_val, greatest_val);
+            Vec::Store(&destKeys[nbOut], lowest);
+            Vec::Store(&destValues[nbOut], lowest_val);
+            nbOut += S;
+
+            // The next vector must come from the array with the lowest key
+            if(idx1 != size1 && (idx2 == size2 || keys1[idx1] <= keys2[idx2])){
+                if(idx1 + S > size1) break;
+                lowest = Vec::Load(&keys1[idx1]);
+                lowest_val = Vec::Load(&values1[idx1]);
+                idx1 += S;
+            }
+            else if(idx2 != size2){
+                if(idx2 + S > size2) break;
+                lowest = Vec::Load(&keys2[idx2]);
+                lowest_val = Vec::Load(&values2[idx2]);
+                idx2 += S;
+            }
+            else{
+                break;
+            }
+        }
+        Vec::Store(greatestKeys, greatest);
+        Vec::Store(greatestValues, greatest_val);
+        nbGreatest = S;
+    }
+
+    const SortType* keys[3] = {greatestKeys, &keys1[idx1], &keys2[idx2]};
+    const SortType* values[3] = {greatestValues, &values1[idx1], &values2[idx2]};
+    const IndexType sizes[3] = {nbGreatest, size1 - idx1, size2 - idx2};
+    CoreMergeTail(keys, values, sizes, &destKeys[nbOut], &destValues[nbOut]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Merge insert
+////////////////////////////////////////////////////////////////////////////////
+
+// Scalar merge of the last pairs from their ends, one array can be
+// the beginning of the destination (it is not moved when it is the last one)
+template <class SortType, class IndexType>
+inline void CoreMergeBackwardTail(const SortType* keys[3], const SortType* values[3], IndexType sizes[3],
+                                  SortType destKeysEnd[], SortType destValuesEnd[]){
+    while(true){
+        int selected = -1;
+        int nbNotEmpty = 0;
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(sizes[idxArray]){
+                nbNotEmpty += 1;
+                if(selected == -1 || keys[selected][sizes[selected]-1] < keys[idxArray][sizes[idxArray]-1]){
+                    selected = idxArray;
+                }
+            }
+        }
+        if(nbNotEmpty <= 1){
+            if(selected != -1 && &keys[selected][sizes[selected]] != destKeysEnd){
+                std::copy_backward(&keys[selected][0], &keys[selected][sizes[selected]], destKeysEnd);
+                std::copy_backward(&values[selected][0], &values[selected][sizes[selected]], destValuesEnd);
+            }
+            return;
+        }
+        bool hasLimit = false;
+        SortType limit = SortType();
+        for(int idxArray = 0 ; idxArray < 3 ; ++idxArray){
+            if(idxArray != selected && sizes[idxArray]
+                    && (hasLimit == false || limit < keys[idxArray][sizes[idxArray]-1])){
+                limit = keys[idxArray][sizes[idxArray]-1];
+                hasLimit = true;
+            }
+        }
+        const IndexType runStart = IndexType(std::lower_bound(&keys[selected][0], &keys[selected][sizes[selected]-1], limit)
+                                             - &keys[selected][0]);
+        destKeysEnd = std::copy_backward(&keys[selected][runStart], &keys[selected][sizes[selected]], destKeysEnd);
+        destValuesEnd = std::copy_backward(&values[selected][runStart], &values[selected][sizes[selected]], destValuesEnd);
+        sizes[selected] = runStart;
+    }
+}
+
+// Merge the batch of pairs sorted by key into the pairs of keys/values
+// from the end (the arrays must have room for size+batchSize pairs)
+template <class SortType, class IndexType>
+inline void CoreMergeBackward(SortType keys[], SortType values[], const IndexType size,
+                              const SortType batchKeys[], const SortType batchValues[], const IndexType batchSize){
+    typedef CoreMergeVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    IndexType idxArray = size;
+    IndexType idxBatch = batchSize;
+    IndexType idxOut = size + batchSize;
+    SortType lowestKeys[Vec::S];
+    SortType lowestValues[Vec::S];
+    IndexType nbLowest = 0;
+
+    if(size >= S && batchSize >= S){
+        typename Vec::VecType lowest;
+        typename Vec::VecType lowest_val;
+        typename Vec::VecType greatest;
+        typename Vec::VecType greatest_val;
+        if(batchKeys[idxBatch-1] < keys[idxArray-1]){
+            idxArray -= S;
+            lowest = Vec::Load(&keys[idxArray]);
+            lowest_val = Vec::Load(&values[idxArray]);
+        }
+        else{
+            idxBatch -= S;
+            lowest = Vec::Load(&batchKeys[idxBatch]);
+            lowest_val = Vec::Load(&batchValues[idxBatch]);
+        }
+        while(idxArray >= S && idxBatch >= S){
+            if(batchKeys[idxBatch-1] < keys[idxArray-1]){
+                idxArray -= S;
+                greatest = Vec::Load(&keys[idxArray]);
+                greatest_val = Vec::Load(&values[idxArray]);
+            }
+            else{
+                idxBatch -= S;
+                greatest = Vec::Load(&batchKeys[idxBatch]);
+                greatest_val = Vec::Load(&batchValues[idxBatch]);
+            }
+            CoreExchangeSort2V(lowest, greatest, lowest_val, greatest_val);
+            idxOut -= S;
+            Vec::Store(&keys[idxOut], greatest);
+            Vec::Store(&values[idxOut], greatest_val);
+        }
+        Vec::Store(lowestKeys, lowest);
+        Vec::Store(lowestValues, lowest_val);
+        nbLowest = S;
+    }
+
+    const SortType* arraysKeys[3] = {keys, batchKeys, lowestKeys};
+    const SortType* arraysValues[3] = {values, batchValues, lowestValues};
+    IndexType sizes[3] = {idxArray, idxBatch, nbLowest};
+    CoreMergeBackwardTail(arraysKeys, arraysValues, sizes, &keys[idxOut], &values[idxOut]);
+}
+
+// Insert the batch of pairs in the pairs sorted by key, the batch is sorted
+// (in place) and merged from the end of the arrays
+template <class SortType, class IndexType = size_t>
+static inline void MergeInsert(SortType keys[], SortType values[], const IndexType size,
+                               SortType batchKeys[], SortType batchValues[], const IndexType batchSize){
+    if(batchSize == 0){
+        return;
+    }
+    Sort<SortType,IndexType>(batchKeys, batchValues, batchSize);
+    CoreMergeBackward<SortType,IndexType>(keys, values, size, batchKeys, batchValues, batchSize);
+}
+
+
 
 #if defined(_OPENMP)
 
+// As Sort512::CoreTeamSize()
+inline int CoreTeamSize(){
+    return omp_get_num_threads();
+}
+
 template <class SortType, class IndexType = size_t>
 static inline void CoreSortTaskPartition(SortType array[], SortType values[], const IndexType left, const IndexType right, const int deep){
     static const int SortLimite = 16*64/sizeof(SortType);
@@ -6163,20 +7416,152 @@ static inline void CoreSortTaskPartition(SortType array[], SortType values[], co
 
 template <class SortType, class IndexType = size_t>
 static inline void SortOmpPartition(SortType array[], SortType values[], const IndexType size){
+    const IndexType nbOthers = IndexType(CoreMovePadKeysToEnd(array, values, size_t(size),
+                                                              std::numeric_limits<SortType>::max()));
+    if(nbOthers <= 1){
+        return;
+    }
     // const int nbTasksRequiere = (omp_get_max_threads() * 5);
     // int deep = 0;
     // while( (1 << deep) < nbTasksRequiere ) deep += 1;
     int deep = 0;
-    while( (IndexType(1) << deep) < size ) deep += 1;
+    while( (IndexType(1) << deep) < nbOthers ) deep += 1;
 
 #pragma omp parallel
     {
 #pragma omp master
         {
-            CoreSortTaskPartition<SortType,IndexType>(array, values, 0, size - 1 , deep);
+            CoreSortTaskPartition<SortType,IndexType>(array, values, 0, nbOthers - 1 , deep);
+        }
+    }
+}
+
+// Each thread sorts a chunk, then at each level the pairs of runs are merged
+// out-of-place, the output of the level is split in equal slices along the merge paths
+template <class SortType, class IndexType = size_t>
+static inline void CoreSortOmpMergePath(SortType array[], SortType values[], const IndexType size){
+    const int nbThreads = omp_get_max_threads();
+    if(size < IndexType(nbThreads)*64){
+        CoreSort<SortType,IndexType>(array,values,0,size-1);
+        return;
+    }
+    std::unique_ptr<SortType[]> bufferKeys(new SortType[size]);
+    std::unique_ptr<SortType[]> bufferValues(new SortType[size]);
+
+#pragma omp parallel num_threads(nbThreads)
+    {
+        const int nbWorkers = CoreTeamSize();
+        const int idxThread = omp_get_thread_num();
+        const IndexType chunk = (size + nbWorkers - 1)/nbWorkers;
+        {
+            const IndexType first = std::min(size, chunk * idxThread);
+            const IndexType last = std::min(size, chunk * (idxThread + 1));
+            if(first < last) CoreSort<SortType,IndexType>(array,values,first,last-1);
+        }
+
+        SortType* srcKeys = array;
+        SortType* srcValues = values;
+        SortType* dstKeys = bufferKeys.get();
+        SortType* dstValues = bufferValues.get();
+        const IndexType sliceFirst = IndexType(size*idxThread/nbWorkers);
+        const IndexType sliceLast = IndexType(size*(idxThread+1)/nbWorkers);
+
+        for(IndexType width = chunk ; width < size ; width *= 2){
+#pragma omp barrier
+            for(IndexType first = (sliceFirst/(2*width))*(2*width) ; first < sliceLast ; first += 2*width){
+                const IndexType middle = std::min(size, first + width);
+                const IndexType last = std::min(size, first + 2*width);
+                const IndexType diagFirst = std::max(sliceFirst, first) - first;
+                const IndexType diagLast = std::min(sliceLast, last) - first;
+
+                const IndexType firstFrom1 = MergePathSplit(&srcKeys[first], middle-first, &srcKeys[middle],
+                                                            last-middle, diagFirst);
+                const IndexType lastFrom1 = MergePathSplit(&srcKeys[first], middle-first, &srcKeys[middle],
+                                                           last-middle, diagLast);
+                const IndexType firstFrom2 = middle + diagFirst - firstFrom1;
+                Merge<SortType,IndexType>(&srcKeys[first + firstFrom1], &srcValues[first + firstFrom1], lastFrom1 - firstFrom1,
+                                          &srcKeys[firstFrom2], &srcValues[firstFrom2],
+                                          (diagLast - lastFrom1) - (diagFirst - firstFrom1),
+                                          &dstKeys[first + diagFirst], &dstValues[first + diagFirst]);
+            }
+            std::swap(srcKeys, dstKeys);
+            std::swap(srcValues, dstValues);
+        }
+
+        // The last level still reads the array
+        if(srcKeys != array){
+#pragma omp barrier
+            std::copy(&srcKeys[sliceFirst], &srcKeys[sliceLast], &array[sliceFirst]);
+            std::copy(&srcValues[sliceFirst], &srcValues[sliceLast], &values[sliceFirst]);
         }
     }
 }
+
+template <class SortType, class IndexType = size_t>
+static inline void SortOmpMergePath(SortType array[], SortType values[], const IndexType size){
+    const IndexType nbOthers = IndexType(CoreMovePadKeysToEnd(array, values, size_t(size),
+                                                              std::numeric_limits<SortType>::max()));
+    if(nbOthers > 1){
+        CoreSortOmpMergePath<SortType,IndexType>(array, values, nbOthers);
+    }
+}
+
+// Each thread reduces a chunk in place, then the groups that cross
+// the chunk boundaries are merged and the chunks are packed
+template <class SortType, class Operator, class IndexType = size_t>
+static inline IndexType CoreReduceSortedOmp(SortType keys[], SortType values[], const IndexType size){
+    const int nbThreads = omp_get_max_threads();
+    std::unique_ptr<IndexType[]> firsts(new IndexType[nbThreads]);
+    std::unique_ptr<IndexType[]> nbGroups(new IndexType[nbThreads]);
+    int nbTeam = 1;
+
+#pragma omp parallel num_threads(nbThreads)
+    {
+        const int nbWorkers = CoreTeamSize();
+#pragma omp single nowait
+        nbTeam = nbWorkers;
+        const IndexType chunk = ((size + nbWorkers*64 - 1)/(nbWorkers*64))*64;
+        const IndexType first = std::min(size, chunk * omp_get_thread_num());
+        const IndexType last = std::min(size, chunk * (omp_get_thread_num() + 1));
+        firsts[omp_get_thread_num()] = first;
+        nbGroups[omp_get_thread_num()] = CoreReduceSorted<Operator>(&keys[first], &values[first], last-first,
+                                                                    &keys[first], &values[first]);
+    }
+
+    IndexType nbKeys = 0;
+    for(int idxThread = 0 ; idxThread < nbTeam ; ++idxThread){
+        IndexType idxGroup = 0;
+        if(nbKeys && nbGroups[idxThread] && keys[nbKeys-1] == keys[firsts[idxThread]]){
+            values[nbKeys-1] = Operator::Apply(values[nbKeys-1], values[firsts[idxThread]]);
+            idxGroup = 1;
+        }
+        if(nbKeys != firsts[idxThread]+idxGroup){
+            // The destination is always before the source
+            std::copy(&keys[firsts[idxThread]+idxGroup], &keys[firsts[idxThread]+nbGroups[idxThread]], &keys[nbKeys]);
+            std::copy(&values[firsts[idxThread]+idxGroup], &values[firsts[idxThread]+nbGroups[idxThread]], &values[nbKeys]);
+        }
+        nbKeys += nbGroups[idxThread] - idxGroup;
+    }
+    return nbKeys;
+}
+
+template <class SortType, class Operator, class IndexType = size_t>
+static inline IndexType ReduceByKeyOmp(SortType keys[], SortType values[], const IndexType size, const Operator /*op*/){
+    if(size == 0){
+        return 0;
+    }
+    SortOmpPartition<SortType,IndexType>(keys, values, size);
+    return CoreReduceSortedOmp<SortType,Operator,IndexType>(keys, values, size);
+}
+
+template <class Operator, class IndexType = size_t>
+static inline IndexType ReduceByKeyOmp(int keys[], double values[], const IndexType size, const Operator op){
+    std::unique_ptr<double[]> doubleKeys(new double[size]);
+    CoreConvertKeys(keys, doubleKeys.get(), size);
+    const IndexType nbKeys = ReduceByKeyOmp<double,Operator,IndexType>(doubleKeys.get(), values, size, op);
+    CoreConvertKeys(doubleKeys.get(), keys, nbKeys);
+    return nbKeys;
+}
 #endif
 
 }
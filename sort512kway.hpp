@@ -0,0 +1,534 @@
+//////////////////////////////////////////////////////////
+/// Code to merge k sorted arrays of integers or doubles
+/// (or key/value pairs) in one pass
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Functions to call:
+/// Sort512::MergeKWay(); to merge sorted arrays
+/// Sort512::MergeKWayOmp(); to merge in parallel
+/// Sort512kv::MergeKWay(); to merge arrays of pairs sorted by key
+/// Sort512kv::MergeKWayOmp(); to merge pairs in parallel
+///
+/// The arrays are the leaves of a tournament tree, each node of the tree merges
+/// the heads of its two children one vector at a time (with the bitonic
+/// network) in a small buffer, such that the values are read once from the
+/// memory and written once in the destination.
+/// The parallel versions split the destination in equal parts and find
+/// where each part starts in every array (multi-sequence selection).
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512KWAY_HPP
+#define SORT512KWAY_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "sort512.hpp"
+#include "sort512kv.hpp"
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace Sort512 {
+
+////////////////////////////////////////////////////////////////////////////////
+/// Tournament tree
+////////////////////////////////////////////////////////////////////////////////
+
+// The last vector of an array is completed with the greatest possible value
+template <class SortType>
+inline SortType CoreKWayPadValue(){
+    return (std::numeric_limits<SortType>::has_infinity ? std::numeric_limits<SortType>::infinity()
+                                                        : std::numeric_limits<SortType>::max());
+}
+
+inline __m512i CoreKWayLoad(const int ptr[], const int nbValues, const int pad){
+    return _mm512_mask_loadu_epi32(_mm512_set1_epi32(pad), __mmask16(0xFFFF >> (16 - nbValues)), ptr);
+}
+
+inline __m512d CoreKWayLoad(const double ptr[], const int nbValues, const double pad){
+    return _mm512_mask_loadu_pd(_mm512_set1_pd(pad), __mmask8(0xFF >> (8 - nbValues)), ptr);
+}
+
+inline void CoreKWayExchange(__m512i& input, __m512i& input2, __m512i& input_val, __m512i& input2_val,
+                             const bool withValues){
+    if(withValues){
+        Sort512kv::CoreExchangeSort2V(input, input2, input_val, input2_val);
+    }
+    else{
+        CoreExchangeSort2V(input, input2);
+    }
+}
+
+inline void CoreKWayExchange(__m512d& input, __m512d& input2, __m512d& input_val, __m512d& input2_val,
+                             const bool withValues){
+    if(withValues){
+        Sort512kv::CoreExchangeSort2V(input, input2, input_val, input2_val);
+    }
+    else{
+        CoreExchangeSort2V(input, input2);
+    }
+}
+
+// The values are moved only if WithValues is true.
+// The padding values are merged as if they were part of the arrays and they
+// are the greatest, so they are the last ones and never written (a real key
+// equal to the padding would exchange its value with a padding one, such
+// arrays are merged two by two instead, see CoreKWayHasPadKey).
+template <class SortType, class IndexType, bool WithValues>
+class CoreKWayTree {
+    typedef CoreMergeVec<SortType> Vec;
+    static const int S = Vec::S;
+    // Number of values in the buffer of an inner node
+    static const int BufferSize = 16*Vec::S;
+
+    struct Node {
+        // The values that can be read (the array for a leaf, the buffer for an inner node)
+        const SortType* keys;
+        const SortType* values;
+        IndexType available;
+        // Number of values that an inner node still has to merge
+        IndexType remaining;
+        int children[2];
+        // An inner node outputs its first vector after the second load
+        bool started;
+        std::unique_ptr<SortType[]> bufferKeys;
+        std::unique_ptr<SortType[]> bufferValues;
+        SortType greatestKeys[Vec::S];
+        SortType greatestValues[Vec::S];
+    };
+
+    std::vector<Node> nodes;
+    int root;
+
+    int buildNode(const SortType* keys[], const SortType* values[], const IndexType sizes[],
+                  const int firstRun, const int lastRun){
+        const int idxNode = int(nodes.size());
+        nodes.emplace_back();
+        if(lastRun - firstRun == 1){
+            nodes[idxNode].keys = keys[firstRun];
+            nodes[idxNode].values = (WithValues ? values[firstRun] : nullptr);
+            nodes[idxNode].available = sizes[firstRun];
+            nodes[idxNode].remaining = 0;
+            nodes[idxNode].children[0] = -1;
+            nodes[idxNode].children[1] = -1;
+        }
+        else{
+            const int middleRun = (firstRun + lastRun)/2;
+            const int left = buildNode(keys, values, sizes, firstRun, middleRun);
+            const int right = buildNode(keys, values, sizes, middleRun, lastRun);
+            Node& node = nodes[idxNode];
+            node.children[0] = left;
+            node.children[1] = right;
+            node.remaining = nodes[left].available + nodes[left].remaining
+                             + nodes[right].available + nodes[right].remaining;
+            node.available = 0;
+            node.bufferKeys.reset(new SortType[BufferSize]);
+            node.keys = node.bufferKeys.get();
+            if(WithValues){
+                node.bufferValues.reset(new SortType[BufferSize]);
+            }
+            node.values = node.bufferValues.get();
+            node.started = false;
+        }
+        return idxNode;
+    }
+
+    // Merge the values of the children of idxNode after outKeys[end-1], while
+    // there is room for a vector, at the end the node has at least S values or
+    // has merged everything
+    void produce(const int idxNode, SortType outKeys[], SortType outValues[],
+                 IndexType& end, const IndexType capacity){
+        Node& node = nodes[idxNode];
+        Node& left = nodes[node.children[0]];
+        Node& right = nodes[node.children[1]];
+        // The nodes are not aligned in the vector, the greatest values are kept in arrays
+        typename Vec::VecType greatest = Vec::Load(node.greatestKeys);
+        typename Vec::VecType greatest_val = greatest;
+        if(WithValues){
+            greatest_val = Vec::Load(node.greatestValues);
+        }
+
+        while(node.remaining && end + S <= capacity){
+            if(left.remaining && left.available < S){
+                refill(node.children[0]);
+            }
+            if(right.remaining && right.available < S){
+                refill(node.children[1]);
+            }
+
+            // Both children have full vectors
+            while(node.started && left.available >= S && right.available >= S && end + S <= capacity){
+                Node& child = (left.keys[0] < right.keys[0] ? left : right);
+                typename Vec::VecType lowest = Vec::Load(child.keys);
+                typename Vec::VecType lowest_val = lowest;
+                child.keys += S;
+                if(WithValues){
+                    lowest_val = Vec::Load(child.values);
+                    child.values += S;
+                }
+                child.available -= S;
+                CoreKWayExchange(lowest, greatest, lowest_val, greatest_val, WithValues);
+                Vec::Store(&outKeys[end], lowest);
+                if(WithValues){
+                    Vec::Store(&outValues[end], lowest_val);
+                }
+                end += S;
+                node.remaining -= S;
+            }
+            if(end + S > capacity || (left.remaining && left.available < S) || (right.remaining && right.available < S)){
+                continue;
+            }
+
+            // One child has less than a vector (padded) or nothing
+            Node* selected = nullptr;
+            if(left.available && (!right.available || left.keys[0] < right.keys[0])){
+                selected = &left;
+            }
+            else if(right.available){
+                selected = &right;
+            }
+
+            typename Vec::VecType lowest;
+            typename Vec::VecType lowest_val;
+            if(selected == nullptr){
+                // Every value is in the vector of the greatest ones
+                lowest = greatest;
+                lowest_val = greatest_val;
+            }
+            else{
+                const int nbLoaded = int(std::min(IndexType(S), selected->available));
+                lowest = CoreKWayLoad(selected->keys, nbLoaded, CoreKWayPadValue<SortType>());
+                lowest_val = lowest;
+                selected->keys += nbLoaded;
+                if(WithValues){
+                    lowest_val = CoreKWayLoad(selected->values, nbLoaded, SortType());
+                    selected->values += nbLoaded;
+                }
+                selected->available -= nbLoaded;
+                if(!node.started){
+                    greatest = lowest;
+                    greatest_val = lowest_val;
+                    node.started = true;
+                    continue;
+                }
+                CoreKWayExchange(lowest, greatest, lowest_val, greatest_val, WithValues);
+            }
+
+            const IndexType nbOut = std::min(IndexType(S), node.remaining);
+            if(nbOut == IndexType(S)){
+                Vec::Store(&outKeys[end], lowest);
+                if(WithValues){
+                    Vec::Store(&outValues[end], lowest_val);
+                }
+            }
+            else{
+                SortType lastKeys[Vec::S];
+                SortType lastValues[Vec::S];
+                Vec::Store(lastKeys, lowest);
+                std::copy(lastKeys, lastKeys + nbOut, &outKeys[end]);
+                if(WithValues){
+                    Vec::Store(lastValues, lowest_val);
+                    std::copy(lastValues, lastValues + nbOut, &outValues[end]);
+                }
+            }
+            end += nbOut;
+            node.remaining -= nbOut;
+        }
+
+        Vec::Store(node.greatestKeys, greatest);
+        if(WithValues){
+            Vec::Store(node.greatestValues, greatest_val);
+        }
+    }
+
+    // Move the unread values at the beginning of the buffer and merge more
+    void refill(const int idxNode){
+        Node& node = nodes[idxNode];
+        SortType* bufferKeys = node.bufferKeys.get();
+        SortType* bufferValues = node.bufferValues.get();
+        std::copy(node.keys, node.keys + node.available, bufferKeys);
+        if(WithValues){
+            std::copy(node.values, node.values + node.available, bufferValues);
+        }
+        node.keys = bufferKeys;
+        node.values = bufferValues;
+        IndexType end = node.available;
+        produce(idxNode, bufferKeys, bufferValues, end, BufferSize);
+        node.available = end;
+    }
+
+public:
+    CoreKWayTree(const SortType* keys[], const SortType* values[], const IndexType sizes[], const int nbRuns){
+        nodes.reserve(2*nbRuns);
+        root = buildNode(keys, values, sizes, 0, nbRuns);
+    }
+
+    void merge(SortType destKeys[], SortType destValues[]){
+        IndexType end = 0;
+        const IndexType total = nodes[root].remaining;
+        produce(root, destKeys, destValues, end, total + S);
+    }
+};
+
+// Merge the arrays two by two (with Merge() or Sort512kv::Merge()) in a buffer
+template <class SortType, class IndexType>
+inline void CoreKWayPairwise(const SortType* keys[], const SortType* values[], const IndexType sizes[],
+                             const int nbRuns, SortType destKeys[], SortType destValues[]){
+    IndexType total = 0;
+    for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+        total += sizes[idxRun];
+    }
+    std::unique_ptr<SortType[]> bufferKeys(new SortType[total]);
+    std::unique_ptr<SortType[]> bufferValues(new SortType[values ? total : 0]);
+    std::vector<IndexType> offsets(1, 0);
+    for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+        std::copy(keys[idxRun], keys[idxRun] + sizes[idxRun], &destKeys[offsets.back()]);
+        if(values){
+            std::copy(values[idxRun], values[idxRun] + sizes[idxRun], &destValues[offsets.back()]);
+        }
+        offsets.push_back(offsets.back() + sizes[idxRun]);
+    }
+
+    SortType* srcKeys = destKeys;
+    SortType* srcValues = destValues;
+    SortType* dstKeys = bufferKeys.get();
+    SortType* dstValues = bufferValues.get();
+    while(offsets.size() > 2){
+        std::vector<IndexType> newOffsets(1, 0);
+        for(size_t idxRun = 0 ; idxRun + 1 < offsets.size() ; idxRun += 2){
+            const IndexType first = offsets[idxRun];
+            if(idxRun + 2 < offsets.size()){
+                const IndexType middle = offsets[idxRun+1];
+                const IndexType last = offsets[idxRun+2];
+                if(values){
+                    Sort512kv::Merge<SortType,IndexType>(&srcKeys[first], &srcValues[first], middle-first,
+                                                         &srcKeys[middle], &srcValues[middle], last-middle,
+                                                         &dstKeys[first], &dstValues[first]);
+                }
+                else{
+                    Merge<SortType,IndexType>(&srcKeys[first], middle-first, &srcKeys[middle], last-middle, &dstKeys[first]);
+                }
+                newOffsets.push_back(last);
+            }
+            else{
+                const IndexType last = offsets[idxRun+1];
+                std::copy(&srcKeys[first], &srcKeys[last], &dstKeys[first]);
+                if(values){
+                    std::copy(&srcValues[first], &srcValues[last], &dstValues[first]);
+                }
+                newOffsets.push_back(last);
+            }
+        }
+        offsets.swap(newOffsets);
+        std::swap(srcKeys, dstKeys);
+        std::swap(srcValues, dstValues);
+    }
+    if(srcKeys != destKeys){
+        std::copy(srcKeys, srcKeys + total, destKeys);
+        if(values){
+            std::copy(srcValues, srcValues + total, destValues);
+        }
+    }
+}
+
+// Tells if a key is equal to the padding value (only the last one of each array is checked)
+template <class SortType, class IndexType>
+inline bool CoreKWayHasPadKey(const SortType* keys[], const IndexType sizes[], const int nbRuns){
+    for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+        if(sizes[idxRun] && keys[idxRun][sizes[idxRun]-1] == CoreKWayPadValue<SortType>()){
+            return true;
+        }
+    }
+    return false;
+}
+
+template <class SortType, class IndexType>
+inline void CoreMergeKWay(const SortType* keys[], const SortType* values[], const IndexType sizes[],
+                          const int nbRuns, SortType destKeys[], SortType destValues[]){
+    if(nbRuns == 0){
+        return;
+    }
+    if(nbRuns == 1){
+        std::copy(keys[0], keys[0] + sizes[0], destKeys);
+        if(values){
+            std::copy(values[0], values[0] + sizes[0], destValues);
+        }
+    }
+    else if(nbRuns == 2 && values){
+        Sort512kv::Merge<SortType,IndexType>(keys[0], values[0], sizes[0], keys[1], values[1], sizes[1],
+                                             destKeys, destValues);
+    }
+    else if(nbRuns == 2){
+        Merge<SortType,IndexType>(keys[0], sizes[0], keys[1], sizes[1], destKeys);
+    }
+    else if(values && CoreKWayHasPadKey(keys, sizes, nbRuns)){
+        CoreKWayPairwise(keys, values, sizes, nbRuns, destKeys, destValues);
+    }
+    else if(values){
+        CoreKWayTree<SortType,IndexType,true>(keys, values, sizes, nbRuns).merge(destKeys, destValues);
+    }
+    else{
+        CoreKWayTree<SortType,IndexType,false>(keys, values, sizes, nbRuns).merge(destKeys, nullptr);
+    }
+}
+
+// Merge the nbRuns sorted arrays runs[idxRun][0 ... sizes[idxRun]-1] in dest
+template <class SortType, class IndexType = size_t>
+static inline void MergeKWay(const SortType* runs[], const IndexType sizes[], const int nbRuns, SortType dest[]){
+    CoreMergeKWay<SortType,IndexType>(runs, nullptr, sizes, nbRuns, dest, nullptr);
+}
+
+#if defined(_OPENMP)
+
+////////////////////////////////////////////////////////////////////////////////
+/// Multi-sequence selection
+////////////////////////////////////////////////////////////////////////////////
+
+// Find splits such that the values before the splits are the rank lowest ones,
+// the pivot is the median of the middle values of the intervals weighted by their
+// sizes, so at least a quarter of the values left in the intervals is removed
+template <class SortType, class IndexType>
+inline void CoreMultiSequenceSelect(const SortType* runs[], const IndexType sizes[], const int nbRuns,
+                                    const IndexType rank, IndexType splits[]){
+    std::vector<IndexType> lows(nbRuns, 0);
+    std::vector<IndexType> highs(sizes, sizes + nbRuns);
+    std::vector<std::pair<SortType,IndexType>> middles;
+
+    while(true){
+        middles.clear();
+        IndexType nbCandidates = 0;
+        for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+            if(lows[idxRun] < highs[idxRun]){
+                const IndexType middle = lows[idxRun] + (highs[idxRun] - lows[idxRun])/2;
+                middles.emplace_back(runs[idxRun][middle], highs[idxRun] - lows[idxRun]);
+                nbCandidates += highs[idxRun] - lows[idxRun];
+            }
+        }
+        if(nbCandidates == 0){
+            std::copy(lows.begin(), lows.end(), splits);
+            return;
+        }
+        std::sort(middles.begin(), middles.end());
+        IndexType weight = 0;
+        size_t idxPivot = 0;
+        while(2*(weight + middles[idxPivot].second) < nbCandidates){
+            weight += middles[idxPivot].second;
+            idxPivot += 1;
+        }
+        const SortType pivot = middles[idxPivot].first;
+
+        IndexType nbLowerThanPivot = 0;
+        IndexType nbLowerOrEqual = 0;
+        for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+            nbLowerThanPivot += IndexType(std::lower_bound(runs[idxRun], runs[idxRun] + sizes[idxRun], pivot) - runs[idxRun]);
+            nbLowerOrEqual += IndexType(std::upper_bound(runs[idxRun], runs[idxRun] + sizes[idxRun], pivot) - runs[idxRun]);
+        }
+
+        if(nbLowerThanPivot <= rank && rank <= nbLowerOrEqual){
+            // The values equal to the pivot are taken from the first arrays
+            IndexType nbEqualToTake = rank - nbLowerThanPivot;
+            for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+                const IndexType first = IndexType(std::lower_bound(runs[idxRun], runs[idxRun] + sizes[idxRun], pivot) - runs[idxRun]);
+                const IndexType last = IndexType(std::upper_bound(runs[idxRun], runs[idxRun] + sizes[idxRun], pivot) - runs[idxRun]);
+                const IndexType taken = std::min(nbEqualToTake, last - first);
+                splits[idxRun] = first + taken;
+                nbEqualToTake -= taken;
+            }
+            return;
+        }
+        for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+            if(nbLowerOrEqual < rank){
+                const IndexType last = IndexType(std::upper_bound(runs[idxRun], runs[idxRun] + sizes[idxRun], pivot) - runs[idxRun]);
+                lows[idxRun] = std::max(lows[idxRun], last);
+            }
+            else{
+                const IndexType first = IndexType(std::lower_bound(runs[idxRun], runs[idxRun] + sizes[idxRun], pivot) - runs[idxRun]);
+                highs[idxRun] = std::min(highs[idxRun], first);
+            }
+        }
+    }
+}
+
+template <class SortType, class IndexType>
+inline void CoreMergeKWayOmp(const SortType* keys[], const SortType* values[], const IndexType sizes[],
+                             const int nbRuns, SortType destKeys[], SortType destValues[]){
+    IndexType total = 0;
+    for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+        total += sizes[idxRun];
+    }
+
+#pragma omp parallel
+    {
+        const int nbThreads = omp_get_num_threads();
+        const int idxThread = omp_get_thread_num();
+        const IndexType firstRank = IndexType(total*idxThread/nbThreads);
+        const IndexType lastRank = IndexType(total*(idxThread+1)/nbThreads);
+
+        std::vector<IndexType> firsts(nbRuns);
+        std::vector<IndexType> lasts(nbRuns);
+        CoreMultiSequenceSelect(keys, sizes, nbRuns, firstRank, firsts.data());
+        CoreMultiSequenceSelect(keys, sizes, nbRuns, lastRank, lasts.data());
+
+        std::vector<const SortType*> partKeys;
+        std::vector<const SortType*> partValues;
+        std::vector<IndexType> partSizes;
+        for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+            if(firsts[idxRun] < lasts[idxRun]){
+                partKeys.push_back(keys[idxRun] + firsts[idxRun]);
+                partValues.push_back(values ? values[idxRun] + firsts[idxRun] : nullptr);
+                partSizes.push_back(lasts[idxRun] - firsts[idxRun]);
+            }
+        }
+        CoreMergeKWay<SortType,IndexType>(partKeys.data(), (values ? partValues.data() : nullptr), partSizes.data(),
+                                          int(partSizes.size()), destKeys + firstRank,
+                                          (values ? destValues + firstRank : nullptr));
+    }
+}
+
+template <class SortType, class IndexType = size_t>
+static inline void MergeKWayOmp(const SortType* runs[], const IndexType sizes[], const int nbRuns, SortType dest[]){
+    CoreMergeKWayOmp<SortType,IndexType>(runs, nullptr, sizes, nbRuns, dest, nullptr);
+}
+
+#endif
+
+}
+
+namespace Sort512kv {
+
+// Merge the nbRuns arrays of pairs sorted by key in destKeys/destValues
+template <class SortType, class IndexType = size_t>
+static inline void MergeKWay(const SortType* keys[], const SortType* values[], const IndexType sizes[],
+                             const int nbRuns, SortType destKeys[], SortType destValues[]){
+    Sort512::CoreMergeKWay<SortType,IndexType>(keys, values, sizes, nbRuns, destKeys, destValues);
+}
+
+#if defined(_OPENMP)
+
+template <class SortType, class IndexType = size_t>
+static inline void MergeKWayOmp(const SortType* keys[], const SortType* values[], const IndexType sizes[],
+                                const int nbRuns, SortType destKeys[], SortType destValues[]){
+    Sort512::CoreMergeKWayOmp<SortType,IndexType>(keys, values, sizes, nbRuns, destKeys, destValues);
+}
+
+#endif
+
+}
+
+#endif
@@ -43,6 +43,8 @@
 
 #include "sort512.hpp"
 #include "sort512kv.hpp"
+#include "sort512radix.hpp"
+#include "sort512kway.hpp"
 
 // Default alignement for the complete application by redirecting the new operator
 static const int DefaultMemAlignement = 128;
@@ -376,7 +378,7 @@ void timeAll(std::ostream& fres){
 
     std::unique_ptr<NumType[]> array(new NumType[MaxSize]);
 
-    fres << "#size\tstdsort\tsort512";
+    fres << "#size\tstdsort\tsort512\tsort512radix";
 #ifdef USE_IPP
     fres << "\tipp\tipplogn";
 #endif
@@ -386,7 +388,8 @@ void timeAll(std::ostream& fres){
         std::cout << "currentSize " << currentSize << std::endl;
 
 
-        double allTimes[3][3] = {{ std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+        double allTimes[4][3] = {{ std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+                            { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
                             { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
                             { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. }};
 #ifdef USE_IPP
@@ -423,6 +426,19 @@ void timeAll(std::ostream& fres){
                 allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
                 allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
             }
+            {
+                srand48((long int)(idxLoop));
+                createRandVec(array.get(), currentSize);
+                dtimer timer;
+                Sort512::SortRadix<NumType, size_t>(array.get(), currentSize);
+                timer.stop();
+                std::cout << "    Sort512Radix " << timer.getElapsed() << std::endl;
+                useVec(array.get(), currentSize);
+                const int idxType = 3;
+                allTimes[idxType][0] = std::min(allTimes[idxType][0], timer.getElapsed());
+                allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
+                allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
+            }
 #ifdef USE_IPP
             {
                 srand48((long int)(idxLoop));
@@ -443,11 +459,13 @@ void timeAll(std::ostream& fres){
         std::cout << currentSize << ",\"stdsort\"," << allTimes[0][0] << "," << allTimes[0][1] << "," << allTimes[0][2] << "\n";
         std::cout << currentSize << ",\"sort512\"," << allTimes[1][0] << "," << allTimes[1][1] << "," << allTimes[1][2] << "\n";
         std::cout << currentSize << ",\"ipp\"," << allTimes[2][0] << "," << allTimes[2][1] << "," << allTimes[2][2] << "\n";
+        std::cout << currentSize << ",\"sort512radix\"," << allTimes[3][0] << "," << allTimes[3][1] << "," << allTimes[3][2] << "\n";
 
 
         fres << currentSize << "\t"
              << allTimes[0][2] << "\t" << allTimes[0][2]/(currentSize*std::log(currentSize)) << "\t"
-             << allTimes[1][2] << "\t" << allTimes[1][2]/(currentSize*std::log(currentSize));
+             << allTimes[1][2] << "\t" << allTimes[1][2]/(currentSize*std::log(currentSize)) << "\t"
+             << allTimes[3][2] << "\t" << allTimes[3][2]/(currentSize*std::log(currentSize));
 
 #ifdef USE_IPP
         fres << "\t" << allTimes[2][2] << "\t" <<
@@ -469,13 +487,14 @@ void timeAll_pair(std::ostream& fres){
 
     std::unique_ptr<std::array<NumType,2>[]> arrayStruct(new std::array<NumType,2>[MaxSize]());
 
-    fres << "#size\tstdsort\tsort512";
+    fres << "#size\tstdsort\tsort512\tsort512radix";
     fres << "\n";
 
     for(size_t currentSize = 64 ; currentSize <= MaxSize ; currentSize *= 8 ){
         std::cout << "currentSize " << currentSize << std::endl;
 
-        double allTimes[2][3] = {{ std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+        double allTimes[3][3] = {{ std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+                            { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
                             { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. }};
 
         for(int idxLoop = 0 ; idxLoop < NbLoops ; ++idxLoop){
@@ -511,14 +530,29 @@ void timeAll_pair(std::ostream& fres){
                 allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
                 allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
             }
+            {
+                srand48((long int)(idxLoop));
+                createRandVec(array.get(), currentSize);
+                dtimer timer;
+                Sort512kv::SortRadix<NumType, size_t>(array.get(), values.get(), currentSize);
+                timer.stop();
+                std::cout << "    sort512radix " << timer.getElapsed() << std::endl;
+                useVec(array.get(), currentSize);
+                const int idxType = 2;
+                allTimes[idxType][0] = std::min(allTimes[idxType][0], timer.getElapsed());
+                allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
+                allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
+            }
         }
 
         std::cout << currentSize << ",\"stdsort\"," << allTimes[0][0] << "," << allTimes[0][1] << "," << allTimes[0][2] << "\n";
         std::cout << currentSize << ",\"sort512\"," << allTimes[1][0] << "," << allTimes[1][1] << "," << allTimes[1][2] << "\n";
+        std::cout << currentSize << ",\"sort512radix\"," << allTimes[2][0] << "," << allTimes[2][1] << "," << allTimes[2][2] << "\n";
 
         fres << currentSize << "\t"
              << allTimes[0][2] << "\t" << allTimes[0][2]/(currentSize*std::log(currentSize)) << "\t"
-             << allTimes[1][2] << "\t" << allTimes[1][2]/(currentSize*std::log(currentSize));
+             << allTimes[1][2] << "\t" << allTimes[1][2]/(currentSize*std::log(currentSize)) << "\t"
+             << allTimes[2][2] << "\t" << allTimes[2][2]/(currentSize*std::log(currentSize));
         fres << "\n";
     }
 
@@ -537,7 +571,10 @@ void timeAllOmp(std::ostream& fres, const std::string prefix){
         std::cout << "currentSize " << currentSize << std::endl;
 
 
-        double allTimes[4][3] = {{ std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+        double allTimes[6][3] = {{ std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+                            { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+                            { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+                            { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
                             { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
                             { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. }};
 
@@ -596,12 +633,40 @@ void timeAllOmp(std::ostream& fres, const std::string prefix){
                 allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
                 allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
             }
+            {
+                srand48((long int)(idxLoop));
+                createRandVec(array.get(), currentSize);
+                dtimer timer;
+                Sort512::SortOmpMergePath<NumType, size_t>(array.get(), currentSize);
+                timer.stop();
+                std::cout << "    SortOmpMergePath " << timer.getElapsed() << std::endl;
+                useVec(array.get(), currentSize);
+                const int idxType = 4;
+                allTimes[idxType][0] = std::min(allTimes[idxType][0], timer.getElapsed());
+                allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
+                allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
+            }
+            {
+                srand48((long int)(idxLoop));
+                createRandVec(array.get(), currentSize);
+                dtimer timer;
+                Sort512::SortRadixOmp<NumType, size_t>(array.get(), currentSize);
+                timer.stop();
+                std::cout << "    SortRadixOmp " << timer.getElapsed() << std::endl;
+                useVec(array.get(), currentSize);
+                const int idxType = 5;
+                allTimes[idxType][0] = std::min(allTimes[idxType][0], timer.getElapsed());
+                allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
+                allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
+            }
         }
 
         fres << prefix << currentSize << ",\"SortOmpPartition\"," << allTimes[0][0] << "," << allTimes[0][1] << "," << allTimes[0][2] << "\n";
         fres << prefix << currentSize << ",\"SortOmpMerge\"," << allTimes[1][0] << "," << allTimes[1][1] << "," << allTimes[1][2] << "\n";
         fres << prefix << currentSize << ",\"SortOmpMergeDeps\"," << allTimes[2][0] << "," << allTimes[2][1] << "," << allTimes[2][2] << "\n";
         fres << prefix << currentSize << ",\"SortOmpParMerge\"," << allTimes[3][0] << "," << allTimes[3][1] << "," << allTimes[3][2] << "\n";
+        fres << prefix << currentSize << ",\"SortOmpMergePath\"," << allTimes[4][0] << "," << allTimes[4][1] << "," << allTimes[4][2] << "\n";
+        fres << prefix << currentSize << ",\"SortRadixOmp\"," << allTimes[5][0] << "," << allTimes[5][1] << "," << allTimes[5][2] << "\n";
         fres.flush();
     }
 
@@ -911,6 +976,91 @@ void timePartitionAll_pair(std::ostream& fres){
 ////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////
 
+template <class NumType>
+void timeMergeKWay(std::ostream& fres){
+    const size_t TotalSize = 64*1024*1024;
+    const int MaxNbRuns = 256;
+    const int NbLoops = 5;
+
+    std::unique_ptr<NumType[]> array(new NumType[TotalSize]);
+    std::unique_ptr<NumType[]> buffer(new NumType[TotalSize]);
+    std::unique_ptr<NumType[]> dest(new NumType[TotalSize]);
+
+    fres << "#nbruns\tpairwise\tpairwisen\tkway\tkwayn";
+    fres << "\n";
+
+    for(int nbRuns = 2 ; nbRuns <= MaxNbRuns ; nbRuns *= 2 ){
+        std::cout << "nbRuns " << nbRuns << std::endl;
+
+        std::vector<size_t> offsets(nbRuns+1);
+        for(int idxRun = 0 ; idxRun <= nbRuns ; ++idxRun){
+            offsets[idxRun] = TotalSize*idxRun/nbRuns;
+        }
+        auto createRuns = [&](const int idxLoop){
+            srand48((long int)(idxLoop));
+            createRandVec(array.get(), TotalSize);
+            for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+                Sort512::Sort<NumType, size_t>(&array[offsets[idxRun]], offsets[idxRun+1]-offsets[idxRun]);
+            }
+        };
+
+        double allTimes[2][3] = {{ std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. },
+                            { std::numeric_limits<double>::max(), std::numeric_limits<double>::min(), 0. }};
+
+        for(int idxLoop = 0 ; idxLoop < NbLoops ; ++idxLoop){
+            std::cout << "  idxLoop " << idxLoop << std::endl;
+            {
+                createRuns(idxLoop);
+                dtimer timer;
+                // Merge the runs two by two until one remains, log2(nbRuns) passes
+                NumType* src = array.get();
+                NumType* dst = buffer.get();
+                for(int width = 1 ; width < nbRuns ; width *= 2){
+                    for(int idxRun = 0 ; idxRun < nbRuns ; idxRun += 2*width){
+                        const size_t first = offsets[idxRun];
+                        const size_t middle = offsets[std::min(nbRuns, idxRun+width)];
+                        const size_t last = offsets[std::min(nbRuns, idxRun+2*width)];
+                        Sort512::Merge<NumType, size_t>(&src[first], middle-first, &src[middle], last-middle, &dst[first]);
+                    }
+                    std::swap(src, dst);
+                }
+                timer.stop();
+                std::cout << "    pairwise Merge " << timer.getElapsed() << std::endl;
+                useVec(src, TotalSize);
+                const int idxType = 0;
+                allTimes[idxType][0] = std::min(allTimes[idxType][0], timer.getElapsed());
+                allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
+                allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
+            }
+            {
+                createRuns(idxLoop);
+                std::vector<const NumType*> runs(nbRuns);
+                std::vector<size_t> sizes(nbRuns);
+                for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+                    runs[idxRun] = &array[offsets[idxRun]];
+                    sizes[idxRun] = offsets[idxRun+1]-offsets[idxRun];
+                }
+                dtimer timer;
+                Sort512::MergeKWay<NumType, size_t>(runs.data(), sizes.data(), nbRuns, dest.get());
+                timer.stop();
+                std::cout << "    MergeKWay " << timer.getElapsed() << std::endl;
+                useVec(dest.get(), TotalSize);
+                const int idxType = 1;
+                allTimes[idxType][0] = std::min(allTimes[idxType][0], timer.getElapsed());
+                allTimes[idxType][1] = std::max(allTimes[idxType][1], timer.getElapsed());
+                allTimes[idxType][2] += timer.getElapsed()/double(NbLoops);
+            }
+        }
+
+        std::cout << nbRuns << ",\"pairwise\"," << allTimes[0][0] << "," << allTimes[0][1] << "," << allTimes[0][2] << "\n";
+        std::cout << nbRuns << ",\"kway\"," << allTimes[1][0] << "," << allTimes[1][1] << "," << allTimes[1][2] << "\n";
+
+        fres << nbRuns << "\t"
+             << allTimes[0][2] << "\t" << allTimes[0][2]/(TotalSize) << "\t"
+             << allTimes[1][2] << "\t" << allTimes[1][2]/(TotalSize) << "\n";
+    }
+}
+
 int main(){
     #ifdef USE_IPP
     IppStatus status=ippInit();
@@ -957,6 +1107,14 @@ int main(){
         std::ofstream fres("res-pair-int.data");
         timeAll_pair<int>(fres);
     }
+    {
+        std::ofstream fres("mergekway-int.data");
+        timeMergeKWay<int>(fres);
+    }
+    {
+        std::ofstream fres("mergekway-double.data");
+        timeMergeKWay<double>(fres);
+    }
 #if defined(_OPENMP)
     {
         std::ofstream fres("res-int-openmp.data");
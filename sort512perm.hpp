@@ -0,0 +1,363 @@
+//////////////////////////////////////////////////////////
+/// Code to apply or invert a permutation of indexes
+/// (typically obtained with Sort512kv by sorting the keys
+/// with their positions as values)
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Functions to call:
+/// Sort512perm::ApplyPermutation(); to permute one or more arrays in place
+/// Sort512perm::ApplyPermutationOmp(); to permute one or more arrays in place in parallel
+/// Sort512perm::GatherPermutation(); to permute an array out-of-place
+/// Sort512perm::GatherPermutationOmp(); to permute an array out-of-place in parallel
+/// Sort512perm::InvertPermutation(); to compute the inverse of a permutation
+/// Sort512perm::InvertPermutationOmp(); to compute the inverse in parallel
+///
+/// A permutation is an array of int where permutation[idx] is the position
+/// of the value that must go at idx, such that after the call:
+/// array[idx] == old_array[permutation[idx]]
+/// (this is the argsort convention, the one given by Sort512kv::Sort
+/// when the values are initialized with 0, 1, 2 ...).
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512PERM_HPP
+#define SORT512PERM_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <cstring>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace Sort512perm {
+
+////////////////////////////////////////////////////////////////////////////////
+/// Visited bitmap
+////////////////////////////////////////////////////////////////////////////////
+
+typedef unsigned long long BitmapWord;
+static const int BitsPerWord = 64;
+
+template <class IndexType>
+inline bool BitmapTest(const BitmapWord bitmap[], const IndexType idx){
+    return (bitmap[idx/BitsPerWord] >> (idx%BitsPerWord)) & 1;
+}
+
+template <class IndexType>
+inline void BitmapSet(BitmapWord bitmap[], const IndexType idx){
+    bitmap[idx/BitsPerWord] |= (BitmapWord(1) << (idx%BitsPerWord));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// In place (cycle-leader)
+////////////////////////////////////////////////////////////////////////////////
+
+// Move the values of the cycle that starts at leader,
+// the positions are marked in visited if it is not null
+template <class NumType, class IndexType>
+inline void CoreRotateCycle(NumType array[], const int permutation[], const IndexType leader,
+                            BitmapWord visited[]){
+    const NumType first = array[leader];
+    IndexType current = leader;
+    IndexType next = IndexType(permutation[current]);
+    while(next != leader){
+        if(visited) BitmapSet(visited, current);
+        array[current] = array[next];
+        current = next;
+        next = IndexType(permutation[current]);
+    }
+    if(visited) BitmapSet(visited, current);
+    array[current] = first;
+}
+
+template <class IndexType>
+inline void CoreRotateCycleAll(const int /*permutation*/[], const IndexType /*leader*/,
+                               BitmapWord /*visited*/[]){
+}
+
+template <class IndexType, class NumType, class ... ArrayTypes>
+inline void CoreRotateCycleAll(const int permutation[], const IndexType leader,
+                               BitmapWord visited[], NumType array[], ArrayTypes* ... arrays){
+    CoreRotateCycle(array, permutation, leader, visited);
+    // The cycle is already marked by the first array
+    CoreRotateCycleAll(permutation, leader, static_cast<BitmapWord*>(nullptr), arrays...);
+}
+
+template <class IndexType, class ... ArrayTypes>
+inline void ApplyPermutation(const int permutation[], const IndexType size, ArrayTypes* ... arrays){
+    static_assert(sizeof...(ArrayTypes) > 0, "ApplyPermutation needs at least one array to permute");
+    const IndexType nbWords = (size+BitsPerWord-1)/BitsPerWord;
+    std::unique_ptr<BitmapWord[]> visited(new BitmapWord[nbWords]());
+
+    for(IndexType idxWord = 0 ; idxWord < nbWords ; ++idxWord){
+        // Skip the words where everything has been done
+        while(visited[idxWord] != ~BitmapWord(0)){
+            const IndexType leader = idxWord*BitsPerWord + __builtin_ctzll(~visited[idxWord]);
+            if(leader >= size){
+                break;
+            }
+            if(IndexType(permutation[leader]) == leader){
+                BitmapSet(visited.get(), leader);
+            }
+            else{
+                CoreRotateCycleAll(permutation, leader, visited.get(), arrays...);
+            }
+        }
+    }
+}
+
+#if defined(_OPENMP)
+
+// A part of a cycle that is owned by a single thread:
+// from first to last following the permutation.
+template <class IndexType>
+struct CycleSegment{
+    IndexType first;
+    IndexType last;
+};
+
+// Returns true if idx was not marked before (the calling thread owns it)
+template <class IndexType>
+inline bool BitmapClaim(BitmapWord bitmap[], const IndexType idx){
+    const BitmapWord bit = (BitmapWord(1) << (idx%BitsPerWord));
+    BitmapWord previous;
+    #pragma omp atomic capture
+    { previous = bitmap[idx/BitsPerWord]; bitmap[idx/BitsPerWord] |= bit; }
+    return (previous & bit) == 0;
+}
+
+// Each segment gets the value of the first position of the next segment
+// of the cycle, these are saved before anyone moves a value.
+template <class NumType, class IndexType>
+inline void CoreShiftSegments(NumType array[], const int permutation[],
+                              const std::vector<CycleSegment<IndexType>>& segments){
+    std::unique_ptr<NumType[]> nextValues(new NumType[segments.size()+1]);
+    for(size_t idxSegment = 0 ; idxSegment < segments.size() ; ++idxSegment){
+        nextValues[idxSegment] = array[permutation[segments[idxSegment].last]];
+    }
+
+    #pragma omp barrier
+
+    for(size_t idxSegment = 0 ; idxSegment < segments.size() ; ++idxSegment){
+        IndexType current = segments[idxSegment].first;
+        while(current != segments[idxSegment].last){
+            const IndexType next = IndexType(permutation[current]);
+            array[current] = array[next];
+            current = next;
+        }
+        array[current] = nextValues[idxSegment];
+    }
+
+    #pragma omp barrier
+}
+
+template <class IndexType>
+inline void CoreShiftSegmentsAll(const int /*permutation*/[],
+                                 const std::vector<CycleSegment<IndexType>>& /*segments*/){
+}
+
+template <class IndexType, class NumType, class ... ArrayTypes>
+inline void CoreShiftSegmentsAll(const int permutation[],
+                                 const std::vector<CycleSegment<IndexType>>& segments,
+                                 NumType array[], ArrayTypes* ... arrays){
+    CoreShiftSegments(array, permutation, segments);
+    CoreShiftSegmentsAll(permutation, segments, arrays...);
+}
+
+// The threads claim the positions in the bitmap with atomic operations.
+// A thread that claims a complete cycle rotates it directly, otherwise
+// the cycle is split in segments (one per thread that walked on it)
+// that are shifted in a second stage once the boundary values are saved.
+template <class IndexType, class ... ArrayTypes>
+inline void ApplyPermutationOmp(const int permutation[], const IndexType size, ArrayTypes* ... arrays){
+    static_assert(sizeof...(ArrayTypes) > 0, "ApplyPermutationOmp needs at least one array to permute");
+    const IndexType nbWords = (size+BitsPerWord-1)/BitsPerWord;
+    std::unique_ptr<BitmapWord[]> visited(new BitmapWord[nbWords]());
+
+#pragma omp parallel
+    {
+        std::vector<CycleSegment<IndexType>> segments;
+
+        const IndexType chunk = ((nbWords + omp_get_num_threads() - 1)/omp_get_num_threads())*BitsPerWord;
+        const IndexType first = std::min(size, chunk * omp_get_thread_num());
+        const IndexType last = std::min(size, chunk * (omp_get_thread_num() + 1));
+
+        for(IndexType leader = first ; leader < last ; ++leader){
+            if(!BitmapClaim(visited.get(), leader) || IndexType(permutation[leader]) == leader){
+                continue;
+            }
+            IndexType current = leader;
+            while(true){
+                const IndexType next = IndexType(permutation[current]);
+                if(next == leader){
+                    // The complete cycle belongs to the current thread
+                    CoreRotateCycleAll(permutation, leader, static_cast<BitmapWord*>(nullptr), arrays...);
+                    break;
+                }
+                if(!BitmapClaim(visited.get(), next)){
+                    // next is the first position of a segment owned by another thread
+                    segments.push_back(CycleSegment<IndexType>{leader, current});
+                    break;
+                }
+                current = next;
+            }
+        }
+
+        #pragma omp barrier
+
+        CoreShiftSegmentsAll(permutation, segments, arrays...);
+    }
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+/// Out-of-place (gather)
+////////////////////////////////////////////////////////////////////////////////
+
+// Distance (in number of values) used to prefetch the gathered values
+static const int PrefetchDistance = 64;
+
+template <class NumType, class IndexType>
+inline void CorePrefetchGather(const NumType array[], const int permutation[], const IndexType idx,
+                               const IndexType size){
+    if(idx + 16 <= size){
+#ifdef __AVX512PF__
+        _mm512_prefetch_i32gather_ps(_mm512_loadu_si512(&permutation[idx]), array, sizeof(NumType), _MM_HINT_T0);
+#else
+        for(int idxVal = 0 ; idxVal < 16 ; ++idxVal){
+            _mm_prefetch(reinterpret_cast<const char*>(&array[permutation[idx+idxVal]]), _MM_HINT_T0);
+        }
+#endif
+    }
+}
+
+template <class IndexType>
+inline void CoreGatherPermutation(const int array[], const int permutation[], int dest[],
+                                  const IndexType first, const IndexType last, const IndexType size){
+    const IndexType S = 16;
+    IndexType idx = first;
+    for(; idx + S <= last ; idx += S){
+        if((idx%PrefetchDistance) == 0){
+            for(IndexType idxPref = 0 ; idxPref < IndexType(PrefetchDistance) ; idxPref += S){
+                CorePrefetchGather(array, permutation, idx + PrefetchDistance + idxPref, size);
+            }
+        }
+        const __m512i indexes = _mm512_loadu_si512(&permutation[idx]);
+        _mm512_storeu_si512(&dest[idx], _mm512_i32gather_epi32(indexes, array, sizeof(int)));
+    }
+    if(idx < last){
+        const __mmask16 mask = 0xFFFF >> (S - (last-idx));
+        const __m512i indexes = _mm512_maskz_loadu_epi32(mask, &permutation[idx]);
+        _mm512_mask_storeu_epi32(&dest[idx], mask,
+                                 _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, indexes, array, sizeof(int)));
+    }
+}
+
+template <class IndexType>
+inline void CoreGatherPermutation(const double array[], const int permutation[], double dest[],
+                                  const IndexType first, const IndexType last, const IndexType size){
+    const IndexType S = 8;
+    IndexType idx = first;
+    for(; idx + S <= last ; idx += S){
+        if((idx%PrefetchDistance) == 0){
+            for(IndexType idxPref = 0 ; idxPref < IndexType(PrefetchDistance) ; idxPref += 16){
+                CorePrefetchGather(array, permutation, idx + PrefetchDistance + idxPref, size);
+            }
+        }
+        const __m256i indexes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&permutation[idx]));
+        _mm512_storeu_pd(&dest[idx], _mm512_i32gather_pd(indexes, array, sizeof(double)));
+    }
+    if(idx < last){
+        const __mmask8 mask = 0xFF >> (S - (last-idx));
+        const __m256i indexes = _mm512_castsi512_si256(_mm512_maskz_loadu_epi32(__mmask16(mask), &permutation[idx]));
+        _mm512_mask_storeu_pd(&dest[idx], mask,
+                              _mm512_mask_i32gather_pd(_mm512_setzero_pd(), mask, indexes, array, sizeof(double)));
+    }
+}
+
+// dest[idx] = array[permutation[idx]], dest and array must not overlap
+template <class NumType, class IndexType = size_t>
+inline void GatherPermutation(const NumType array[], const int permutation[], NumType dest[], const IndexType size){
+    CoreGatherPermutation<IndexType>(array, permutation, dest, 0, size, size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Inverse (scatter)
+////////////////////////////////////////////////////////////////////////////////
+
+template <class IndexType>
+inline void CoreInvertPermutation(const int permutation[], int inverse[],
+                                  const IndexType first, const IndexType last){
+    const IndexType S = 16;
+    const __m512i increment = _mm512_set1_epi32(S);
+    __m512i positions = _mm512_add_epi32(_mm512_set1_epi32(int(first)),
+                                         _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+                                                          7, 6, 5, 4, 3, 2, 1, 0));
+    IndexType idx = first;
+    for(; idx + S <= last ; idx += S){
+        _mm512_i32scatter_epi32(inverse, _mm512_loadu_si512(&permutation[idx]), positions, sizeof(int));
+        positions = _mm512_add_epi32(positions, increment);
+    }
+    if(idx < last){
+        const __mmask16 mask = 0xFFFF >> (S - (last-idx));
+        _mm512_mask_i32scatter_epi32(inverse, mask, _mm512_maskz_loadu_epi32(mask, &permutation[idx]),
+                                     positions, sizeof(int));
+    }
+}
+
+// inverse[permutation[idx]] = idx
+template <class IndexType = size_t>
+inline void InvertPermutation(const int permutation[], int inverse[], const IndexType size){
+    CoreInvertPermutation<IndexType>(permutation, inverse, 0, size);
+}
+
+#if defined(_OPENMP)
+
+template <class NumType, class IndexType = size_t>
+inline void GatherPermutationOmp(const NumType array[], const int permutation[], NumType dest[], const IndexType size){
+#pragma omp parallel
+    {
+        // Use chunks of cache lines to avoid false sharing on dest
+        const IndexType nbLines = (size + 15)/16;
+        const IndexType chunk = ((nbLines + omp_get_num_threads() - 1)/omp_get_num_threads())*16;
+        const IndexType first = std::min(size, chunk * omp_get_thread_num());
+        const IndexType last = std::min(size, chunk * (omp_get_thread_num() + 1));
+
+        if(first < last) CoreGatherPermutation<IndexType>(array, permutation, dest, first, last, size);
+    }
+}
+
+template <class IndexType = size_t>
+inline void InvertPermutationOmp(const int permutation[], int inverse[], const IndexType size){
+#pragma omp parallel
+    {
+        const IndexType nbLines = (size + 15)/16;
+        const IndexType chunk = ((nbLines + omp_get_num_threads() - 1)/omp_get_num_threads())*16;
+        const IndexType first = std::min(size, chunk * omp_get_thread_num());
+        const IndexType last = std::min(size, chunk * (omp_get_thread_num() + 1));
+
+        if(first < last) CoreInvertPermutation<IndexType>(permutation, inverse, first, last);
+    }
+}
+
+#endif
+
+}
+
+
+#endif
@@ -0,0 +1,372 @@
+//////////////////////////////////////////////////////////
+/// Code of a least significant digit radix sort of
+/// integers or doubles (or key/value pairs)
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Functions to call:
+/// Sort512::SortRadix(); to sort an array (same arguments as Sort512::Sort)
+/// Sort512::SortRadixOmp(); to sort in parallel
+/// Sort512kv::SortRadix(); to sort pairs by key
+/// Sort512kv::SortRadixOmp(); to sort pairs in parallel
+///
+/// The keys are sorted by digits of 8 bits, from the lowest one (4 passes
+/// for int, 8 for double), each pass moves the values from the array to a
+/// buffer of the same size or back. The bits of the keys are ordered as
+/// unsigned integers (the sign bit is flipped, and all the bits of the
+/// negative doubles) when the digits are taken.
+/// The number of values of each digit is counted for all the passes in a
+/// first read of the array: a vector of digits is counted with one gather and
+/// one scatter, vpconflictd tells each lane which lanes before it have the
+/// same digit, such that the last of them adds the number of all.
+/// A pass where all the values have the same digit is skipped.
+/// The values of a digit go through a buffer of one vector that mirrors the
+/// cache line where they are written, a full line is written at once.
+/// The parallel versions count the digits of a pass per thread and write
+/// the values of a thread after those of the previous threads.
+/// The arrays with less than RadixSortLimit values are sorted by Sort512::Sort.
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512RADIX_HPP
+#define SORT512RADIX_HPP
+
+#include <immintrin.h>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "sort512.hpp"
+#include "sort512kv.hpp"
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace Sort512 {
+
+////////////////////////////////////////////////////////////////////////////////
+/// Radix sort
+////////////////////////////////////////////////////////////////////////////////
+
+const int RadixBits = 8;
+const int RadixSize = 1 << RadixBits;
+// Below this number of values the radix sorts use Sort
+const size_t RadixSortLimit = 1 << 16;
+
+template <class SortType>
+struct CoreRadixDigits;
+
+template <>
+struct CoreRadixDigits<int> {
+    static const int NbPasses = 4;
+
+    // The digits of the pass of ptr[0 ... nbValues-1] (nbValues <= 16)
+    static inline __m512i Digits(const int* ptr, const int nbValues, const int pass){
+        const __m512i keys = _mm512_xor_si512(_mm512_maskz_loadu_epi32(__mmask16(0xFFFF >> (16 - nbValues)), ptr),
+                                              _mm512_set1_epi32(INT_MIN));
+        return _mm512_and_si512(_mm512_srli_epi32(keys, unsigned(pass*RadixBits)), _mm512_set1_epi32(RadixSize - 1));
+    }
+};
+
+template <>
+struct CoreRadixDigits<double> {
+    static const int NbPasses = 8;
+
+    static inline __m256i Digits8(const double* ptr, const int nbValues, const int pass){
+        const __m512i bits = _mm512_castpd_si512(_mm512_maskz_loadu_pd(__mmask8(0xFF >> (8 - std::max(0, std::min(8, nbValues)))), ptr));
+        // All the bits of the negative values are flipped, only the sign of the others
+        const __m512i keys = _mm512_xor_si512(bits, _mm512_or_si512(_mm512_srai_epi64(bits, 63),
+                                                                    _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ULL))));
+        return _mm512_cvtepi64_epi32(_mm512_and_si512(_mm512_srli_epi64(keys, unsigned(pass*RadixBits)),
+                                                      _mm512_set1_epi64(RadixSize - 1)));
+    }
+
+    static inline __m512i Digits(const double* ptr, const int nbValues, const int pass){
+        return _mm512_inserti64x4(_mm512_castsi256_si512(Digits8(ptr, nbValues, pass)),
+                                  Digits8(ptr + 8, nbValues - 8, pass), 1);
+    }
+};
+
+// Number of bits set in each lane (lower than 2^16) with avx512f only
+inline __m512i CoreRadixPopcount16(const __m512i vec){
+    const __m512i pairs = _mm512_sub_epi32(vec, _mm512_and_si512(_mm512_srli_epi32(vec, 1), _mm512_set1_epi32(0x5555)));
+    const __m512i quads = _mm512_add_epi32(_mm512_and_si512(pairs, _mm512_set1_epi32(0x3333)),
+                                           _mm512_and_si512(_mm512_srli_epi32(pairs, 2), _mm512_set1_epi32(0x3333)));
+    const __m512i bytes = _mm512_and_si512(_mm512_add_epi32(quads, _mm512_srli_epi32(quads, 4)), _mm512_set1_epi32(0x0F0F));
+    return _mm512_and_si512(_mm512_add_epi32(bytes, _mm512_srli_epi32(bytes, 8)), _mm512_set1_epi32(0x1F));
+}
+
+// counts[(pass-firstPass)*RadixSize + digit] is set to the number of values
+// of array with the digit at the pass, for nbPasses passes from firstPass.
+// The lane i of the conflict vector has the bit j set if the lane j < i has
+// the same digit, the number of such lanes plus one is added to the count
+// gathered, and when several lanes scatter the same count the last one wins,
+// which is the one that has counted all of them
+template <class SortType, class IndexType>
+inline void CoreRadixCount(const SortType array[], const IndexType size, const int firstPass, const int nbPasses,
+                           IndexType counts[]){
+    // The 32 bits counters are added to counts after at most ChunkSize values
+    const IndexType ChunkSize = IndexType(1) << 30;
+    std::unique_ptr<int[]> chunkCounts(new int[nbPasses*RadixSize]);
+    std::fill(counts, counts + nbPasses*RadixSize, IndexType(0));
+    for(IndexType first = 0 ; first < size ; first += ChunkSize){
+        const IndexType last = std::min(size, first + ChunkSize);
+        std::fill(chunkCounts.get(), chunkCounts.get() + nbPasses*RadixSize, 0);
+        for(IndexType idxValue = first ; idxValue < last ; idxValue += 16){
+            const int nbLanes = int(std::min(IndexType(16), last - idxValue));
+            const __mmask16 lanes = __mmask16(0xFFFF >> (16 - nbLanes));
+            for(int pass = 0 ; pass < nbPasses ; ++pass){
+                const __m512i positions = _mm512_add_epi32(CoreRadixDigits<SortType>::Digits(&array[idxValue], nbLanes, firstPass + pass),
+                                                           _mm512_set1_epi32(pass*RadixSize));
+                const __m512i increments = _mm512_add_epi32(CoreRadixPopcount16(_mm512_maskz_conflict_epi32(lanes, positions)),
+                                                            _mm512_set1_epi32(1));
+                const __m512i previous = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), lanes, positions, chunkCounts.get(), 4);
+                _mm512_mask_i32scatter_epi32(chunkCounts.get(), lanes, positions, _mm512_add_epi32(previous, increments), 4);
+            }
+        }
+        for(int idxCount = 0 ; idxCount < nbPasses*RadixSize ; ++idxCount){
+            counts[idxCount] += IndexType(chunkCounts[idxCount]);
+        }
+    }
+}
+
+// Write src (and srcValues if not null) in dst by digit of the pass, the
+// values of the digit d go from offsets[d] (which is moved after them).
+// The buffer of a digit (64 bytes aligned) mirrors the cache line of dst
+// where its next values go, such that it is full when its cursor reaches the
+// next buffer, a full line is written with a non temporal store (except the
+// first line of a digit). The values follow the same lines if their array
+// has the same alignment as dst, otherwise they are copied
+template <class SortType, class IndexType>
+inline void CoreRadixScatter(const SortType src[], const SortType srcValues[], const IndexType size, const int pass,
+                             IndexType offsets[], SortType dst[], SortType dstValues[]){
+    typedef CorePartitionKVec<SortType> Vec;
+    const int S = Vec::S;
+    const IndexType ChunkSize = 256;
+    const bool sameLines = (dstValues != nullptr
+                            && reinterpret_cast<std::uintptr_t>(dst) % 64 == reinterpret_cast<std::uintptr_t>(dstValues) % 64);
+
+    const int NbAligned = 64/int(sizeof(SortType));
+    std::unique_ptr<SortType[]> buffersMemory(new SortType[(srcValues ? 2 : 1)*RadixSize*S + NbAligned]);
+    SortType* buffers = buffersMemory.get()
+                        + ((64 - reinterpret_cast<std::uintptr_t>(buffersMemory.get()) % 64) % 64)/sizeof(SortType);
+    SortType* valueBuffers = buffers + RadixSize*S;
+    SortType* cursors[RadixSize];
+    SortType* lines[RadixSize];
+    int firstLanes[RadixSize];
+    for(int digit = 0 ; digit < RadixSize ; ++digit){
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(&dst[offsets[digit]]);
+        firstLanes[digit] = int((address % 64)/sizeof(SortType));
+        cursors[digit] = &buffers[digit*S + firstLanes[digit]];
+        lines[digit] = reinterpret_cast<SortType*>(address - address % 64);
+    }
+
+    int digits[ChunkSize];
+    for(IndexType first = 0 ; first < size ; first += ChunkSize){
+        const IndexType nbInChunk = std::min(ChunkSize, size - first);
+        for(IndexType idx = 0 ; idx < nbInChunk ; idx += 16){
+            _mm512_storeu_si512(&digits[idx], CoreRadixDigits<SortType>::Digits(&src[first + idx],
+                                                                                int(std::min(IndexType(16), nbInChunk - idx)), pass));
+        }
+        for(IndexType idx = 0 ; idx < nbInChunk ; ++idx){
+            const int digit = digits[idx];
+            SortType* cursor = cursors[digit];
+            if(srcValues){
+                valueBuffers[cursor - buffers] = srcValues[first + idx];
+            }
+            *cursor++ = src[first + idx];
+            if(reinterpret_cast<std::uintptr_t>(cursor) % 64 == 0){
+                cursor -= S;
+                Vec::StoreLine(lines[digit], firstLanes[digit], Vec::Load(Vec::FirstLanes(S), cursor));
+                if(srcValues){
+                    const SortType* valueBuffer = &valueBuffers[digit*S];
+                    SortType* valueLine = dstValues + (lines[digit] - dst);
+                    if(sameLines){
+                        Vec::StoreLine(valueLine, firstLanes[digit], Vec::Load(Vec::FirstLanes(S), valueBuffer));
+                    }
+                    else{
+                        std::copy(valueBuffer + firstLanes[digit], valueBuffer + S, valueLine + firstLanes[digit]);
+                    }
+                }
+                lines[digit] += S;
+                firstLanes[digit] = 0;
+            }
+            cursors[digit] = cursor;
+        }
+    }
+    _mm_sfence();
+    for(int digit = 0 ; digit < RadixSize ; ++digit){
+        const IndexType nbInBuffer = IndexType(cursors[digit] - &buffers[digit*S]);
+        std::copy(&buffers[digit*S + firstLanes[digit]], cursors[digit], lines[digit] + firstLanes[digit]);
+        if(srcValues){
+            std::copy(&valueBuffers[digit*S + firstLanes[digit]], &valueBuffers[digit*S + nbInBuffer],
+                      dstValues + (lines[digit] - dst) + firstLanes[digit]);
+        }
+        offsets[digit] = IndexType(lines[digit] - dst) + nbInBuffer;
+    }
+}
+
+// A pass is needed if its values do not all have the same digit
+template <class IndexType>
+inline bool CoreRadixPassNeeded(const IndexType counts[], const IndexType size){
+    return std::find(counts, counts + RadixSize, size) == counts + RadixSize;
+}
+
+// values may be null
+template <class SortType, class IndexType>
+inline void CoreSortRadix(SortType array[], SortType values[], const IndexType size){
+    const int NbPasses = CoreRadixDigits<SortType>::NbPasses;
+    std::vector<IndexType> counts(NbPasses*RadixSize);
+    CoreRadixCount<SortType,IndexType>(array, size, 0, NbPasses, counts.data());
+
+    std::unique_ptr<SortType[]> buffer(new SortType[size]);
+    std::unique_ptr<SortType[]> valuesBuffer(new SortType[values ? size : 0]);
+    SortType* src = array;
+    SortType* srcValues = values;
+    SortType* dst = buffer.get();
+    SortType* dstValues = (values ? valuesBuffer.get() : nullptr);
+    for(int pass = 0 ; pass < NbPasses ; ++pass){
+        IndexType* offsets = &counts[pass*RadixSize];
+        if(CoreRadixPassNeeded(offsets, size)){
+            IndexType offset = 0;
+            for(int digit = 0 ; digit < RadixSize ; ++digit){
+                std::swap(offset, offsets[digit]);
+                offset += offsets[digit];
+            }
+            CoreRadixScatter<SortType,IndexType>(src, srcValues, size, pass, offsets, dst, dstValues);
+            std::swap(src, dst);
+            std::swap(srcValues, dstValues);
+        }
+    }
+    if(src != array){
+        std::copy(src, src + size, array);
+        if(values){
+            std::copy(srcValues, srcValues + size, values);
+        }
+    }
+}
+
+// Sort array with a radix sort (it needs a buffer of the same size)
+template <class SortType, class IndexType = size_t>
+static inline void SortRadix(SortType array[], const IndexType size){
+    if(size < IndexType(RadixSortLimit)){
+        if(size > 1) CoreSort<SortType,IndexType>(array, 0, size-1);
+        return;
+    }
+    CoreSortRadix<SortType,IndexType>(array, nullptr, size);
+}
+
+#if defined(_OPENMP)
+
+// Each thread has a slice of the array, at each pass the threads count the
+// digits of their slice and the values of the digit d of the thread t go
+// after the values of the digits lower than d and those of the digit d of
+// the threads lower than t
+template <class SortType, class IndexType>
+inline void CoreSortRadixOmp(SortType array[], SortType values[], const IndexType size){
+    const int NbPasses = CoreRadixDigits<SortType>::NbPasses;
+    const int nbThreads = omp_get_max_threads();
+    std::vector<IndexType> counts(IndexType(nbThreads)*RadixSize);
+    std::unique_ptr<SortType[]> buffer(new SortType[size]);
+    std::unique_ptr<SortType[]> valuesBuffer(new SortType[values ? size : 0]);
+    bool passNeeded = false;
+
+#pragma omp parallel num_threads(nbThreads)
+    {
+        const int nbWorkers = CoreTeamSize();
+        const int idxThread = omp_get_thread_num();
+        const IndexType first = IndexType(size*idxThread/nbWorkers);
+        const IndexType last = IndexType(size*(idxThread + 1)/nbWorkers);
+        IndexType* threadCounts = &counts[IndexType(idxThread)*RadixSize];
+        SortType* src = array;
+        SortType* srcValues = values;
+        SortType* dst = buffer.get();
+        SortType* dstValues = (values ? valuesBuffer.get() : nullptr);
+        for(int pass = 0 ; pass < NbPasses ; ++pass){
+            CoreRadixCount<SortType,IndexType>(&src[first], last - first, pass, 1, threadCounts);
+#pragma omp barrier
+#pragma omp single
+            {
+                std::vector<IndexType> digitCounts(RadixSize, 0);
+                for(int idxOther = 0 ; idxOther < nbWorkers ; ++idxOther){
+                    for(int digit = 0 ; digit < RadixSize ; ++digit){
+                        digitCounts[digit] += counts[IndexType(idxOther)*RadixSize + digit];
+                    }
+                }
+                passNeeded = CoreRadixPassNeeded(digitCounts.data(), size);
+                IndexType offset = 0;
+                for(int digit = 0 ; digit < RadixSize ; ++digit){
+                    for(int idxOther = 0 ; idxOther < nbWorkers ; ++idxOther){
+                        std::swap(offset, counts[IndexType(idxOther)*RadixSize + digit]);
+                        offset += counts[IndexType(idxOther)*RadixSize + digit];
+                    }
+                }
+            }
+            if(passNeeded){
+                CoreRadixScatter<SortType,IndexType>(&src[first], (values ? &srcValues[first] : nullptr), last - first, pass,
+                                                     threadCounts, dst, dstValues);
+                std::swap(src, dst);
+                std::swap(srcValues, dstValues);
+            }
+#pragma omp barrier
+        }
+        if(src != array){
+            std::copy(&src[first], &src[last], &array[first]);
+            if(values){
+                std::copy(&srcValues[first], &srcValues[last], &values[first]);
+            }
+        }
+    }
+}
+
+template <class SortType, class IndexType = size_t>
+static inline void SortRadixOmp(SortType array[], const IndexType size){
+    if(omp_get_max_threads() == 1 || size < IndexType(RadixSortLimit)*IndexType(omp_get_max_threads())){
+        SortRadix<SortType,IndexType>(array, size);
+        return;
+    }
+    CoreSortRadixOmp<SortType,IndexType>(array, nullptr, size);
+}
+
+#endif
+
+}
+
+namespace Sort512kv {
+
+// Sort the pairs by key with a radix sort (it needs buffers of the same size)
+template <class SortType, class IndexType = size_t>
+static inline void SortRadix(SortType array[], SortType values[], const IndexType size){
+    if(size < IndexType(Sort512::RadixSortLimit)){
+        Sort<SortType,IndexType>(array, values, size);
+        return;
+    }
+    Sort512::CoreSortRadix<SortType,IndexType>(array, values, size);
+}
+
+#if defined(_OPENMP)
+
+template <class SortType, class IndexType = size_t>
+static inline void SortRadixOmp(SortType array[], SortType values[], const IndexType size){
+    if(omp_get_max_threads() == 1 || size < IndexType(Sort512::RadixSortLimit)*IndexType(omp_get_max_threads())){
+        SortRadix<SortType,IndexType>(array, values, size);
+        return;
+    }
+    Sort512::CoreSortRadixOmp<SortType,IndexType>(array, values, size);
+}
+
+#endif
+
+}
+
+#endif
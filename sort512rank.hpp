@@ -0,0 +1,259 @@
+//////////////////////////////////////////////////////////
+/// Code to compute the rank of each key of an array
+/// (rank transform) using the key/value sort
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Functions to call:
+/// Sort512::Rank(); to compute the ranks of an array of int or double
+///
+/// The ranks start at 1, ranks[idx] is the rank of keys[idx]
+/// and the equal keys are ranked following the method:
+/// - RankMethod::Ordinal, distinct ranks, equal keys are ranked by position
+/// - RankMethod::Dense, equal keys share a rank, no gap after a group
+/// - RankMethod::Min, equal keys share the lowest rank of their group
+/// - RankMethod::Average, equal keys share the mean rank of their group
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512RANK_HPP
+#define SORT512RANK_HPP
+
+#include <immintrin.h>
+#include <memory>
+#include <limits>
+
+#include "sort512.hpp"
+#include "sort512kv.hpp"
+
+namespace Sort512 {
+
+enum class RankMethod {
+    Ordinal,
+    Dense,
+    Min,
+    Average
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// Groups of equal keys
+////////////////////////////////////////////////////////////////////////////////
+
+/// Int
+
+// Fill starts with the first position of each group and starts[nbGroups] = size
+template <class IndexType>
+inline IndexType CoreRankGroupStarts(const int sorted[], const IndexType size, int starts[]){
+    const IndexType S = 16;
+    const __m512i increment = _mm512_set1_epi32(S);
+    __m512i positions = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0);
+    __m512i previous = _mm512_setzero_si512();
+    IndexType nbGroups = 0;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask16 isStart = CoreGroupStartMask(sorted, idx, size, previous) | (idx == 0 ? 1 : 0);
+        _mm512_mask_compressstoreu_epi32(&starts[nbGroups], isStart, positions);
+        nbGroups += popcount(isStart);
+        positions = _mm512_add_epi32(positions, increment);
+    }
+    starts[nbGroups] = int(size);
+    return nbGroups;
+}
+
+template <class IndexType>
+inline void CoreRankScatter(const int sorted[], const int indexes[], const int starts[], double ranks[],
+                            const IndexType size, const RankMethod method){
+    const IndexType S = 16;
+    const __m512i increment = _mm512_set1_epi32(S);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    __m512i positions = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+                                         7, 6, 5, 4, 3, 2, 1, 0);
+    __m512i previous = _mm512_setzero_si512();
+    int nbPreviousGroups = -1;
+
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask16 remaining = (size - idx >= S ? 0xFFFF : __mmask16(0xFFFF >> (S - (size - idx))));
+        const __mmask16 isStart = CoreGroupStartMask(sorted, idx, size, previous) | (idx == 0 ? 1 : 0);
+
+        // Inclusive prefix count of the group starts gives the group of each lane
+        __m512i groups = _mm512_maskz_mov_epi32(isStart, one);
+        groups = _mm512_add_epi32(groups, _mm512_alignr_epi32(groups, zero, 15));
+        groups = _mm512_add_epi32(groups, _mm512_alignr_epi32(groups, zero, 14));
+        groups = _mm512_add_epi32(groups, _mm512_alignr_epi32(groups, zero, 12));
+        groups = _mm512_add_epi32(groups, _mm512_alignr_epi32(groups, zero, 8));
+        groups = _mm512_add_epi32(groups, _mm512_set1_epi32(nbPreviousGroups));
+        nbPreviousGroups += popcount(isStart);
+
+        __m512d ranksLow;
+        __m512d ranksHigh;
+        if(method == RankMethod::Ordinal || method == RankMethod::Dense){
+            const __m512i rank = _mm512_add_epi32(method == RankMethod::Ordinal ? positions : groups, one);
+            ranksLow = _mm512_cvtepi32_pd(_mm512_castsi512_si256(rank));
+            ranksHigh = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(rank, 1));
+        }
+        else{
+            const __m512i first = _mm512_mask_i32gather_epi32(zero, remaining, groups, starts, sizeof(int));
+            ranksLow = _mm512_cvtepi32_pd(_mm512_castsi512_si256(first));
+            ranksHigh = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(first, 1));
+            if(method == RankMethod::Min){
+                ranksLow = _mm512_add_pd(ranksLow, _mm512_set1_pd(1));
+                ranksHigh = _mm512_add_pd(ranksHigh, _mm512_set1_pd(1));
+            }
+            else{
+                // Mean of first+1 ... next, that is (first + 1 + next) / 2
+                const __m512i next = _mm512_mask_i32gather_epi32(zero, remaining, _mm512_add_epi32(groups, one),
+                                                                 starts, sizeof(int));
+                ranksLow = _mm512_add_pd(ranksLow, _mm512_add_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(next)),
+                                                                 _mm512_set1_pd(1)));
+                ranksHigh = _mm512_add_pd(ranksHigh, _mm512_add_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(next, 1)),
+                                                                   _mm512_set1_pd(1)));
+                ranksLow = _mm512_mul_pd(ranksLow, _mm512_set1_pd(0.5));
+                ranksHigh = _mm512_mul_pd(ranksHigh, _mm512_set1_pd(0.5));
+            }
+        }
+
+        const __m512i dest = _mm512_maskz_loadu_epi32(remaining, &indexes[idx]);
+        _mm512_mask_i32scatter_pd(ranks, __mmask8(remaining), _mm512_castsi512_si256(dest), ranksLow, sizeof(double));
+        _mm512_mask_i32scatter_pd(ranks, __mmask8(remaining >> 8), _mm512_extracti64x4_epi64(dest, 1), ranksHigh, sizeof(double));
+
+        positions = _mm512_add_epi32(positions, increment);
+    }
+}
+
+/// Double
+
+template <class IndexType>
+inline IndexType CoreRankGroupStarts(const double sorted[], const IndexType size, double starts[]){
+    const IndexType S = 8;
+    const __m512d increment = _mm512_set1_pd(S);
+    __m512d positions = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+    __m512d previous = _mm512_setzero_pd();
+    IndexType nbGroups = 0;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask8 isStart = CoreGroupStartMask(sorted, idx, size, previous) | (idx == 0 ? 1 : 0);
+        _mm512_mask_compressstoreu_pd(&starts[nbGroups], isStart, positions);
+        nbGroups += popcount(isStart);
+        positions = _mm512_add_pd(positions, increment);
+    }
+    starts[nbGroups] = double(size);
+    return nbGroups;
+}
+
+template <class IndexType>
+inline void CoreRankScatter(const double sorted[], const double indexes[], const double starts[], double ranks[],
+                            const IndexType size, const RankMethod method){
+    const IndexType S = 8;
+    const __m512d increment = _mm512_set1_pd(S);
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512d one = _mm512_set1_pd(1);
+    __m512d positions = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+    __m512d previous = _mm512_setzero_pd();
+    double nbPreviousGroups = -1;
+
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask8 remaining = (size - idx >= S ? 0xFF : __mmask8(0xFF >> (S - (size - idx))));
+        const __mmask8 isStart = CoreGroupStartMask(sorted, idx, size, previous) | (idx == 0 ? 1 : 0);
+
+        // Inclusive prefix count of the group starts gives the group of each lane
+        __m512d groups = _mm512_maskz_mov_pd(isStart, one);
+        groups = _mm512_add_pd(groups, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(groups), zero, 7)));
+        groups = _mm512_add_pd(groups, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(groups), zero, 6)));
+        groups = _mm512_add_pd(groups, _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(groups), zero, 4)));
+        groups = _mm512_add_pd(groups, _mm512_set1_pd(nbPreviousGroups));
+        nbPreviousGroups += popcount(isStart);
+
+        __m512d rank;
+        if(method == RankMethod::Ordinal){
+            rank = _mm512_add_pd(positions, one);
+        }
+        else if(method == RankMethod::Dense){
+            rank = _mm512_add_pd(groups, one);
+        }
+        else{
+            const __m256i groupIdx = _mm512_cvttpd_epi32(groups);
+            rank = _mm512_add_pd(_mm512_mask_i32gather_pd(_mm512_setzero_pd(), remaining, groupIdx, starts, sizeof(double)),
+                                 one);
+            if(method == RankMethod::Average){
+                // Mean of first+1 ... next, that is (first + 1 + next) / 2
+                const __m256i nextIdx = _mm512_cvttpd_epi32(_mm512_add_pd(groups, one));
+                rank = _mm512_add_pd(rank, _mm512_mask_i32gather_pd(_mm512_setzero_pd(), remaining, nextIdx,
+                                                                    starts, sizeof(double)));
+                rank = _mm512_mul_pd(rank, _mm512_set1_pd(0.5));
+            }
+        }
+
+        const __m256i dest = _mm512_cvttpd_epi32(_mm512_maskz_loadu_pd(remaining, &indexes[idx]));
+        _mm512_mask_i32scatter_pd(ranks, remaining, dest, rank, sizeof(double));
+
+        positions = _mm512_add_pd(positions, increment);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Main functions
+////////////////////////////////////////////////////////////////////////////////
+
+// The sort is not stable, the positions of the equal keys
+// are sorted to rank them in order of appearance
+template <class SortType, class IndexType>
+inline void CoreRankSortGroups(SortType indexes[], const SortType starts[], const IndexType nbGroups){
+    for(IndexType idxGroup = 0 ; idxGroup < nbGroups ; ++idxGroup){
+        const IndexType first = IndexType(starts[idxGroup]);
+        const IndexType groupSize = IndexType(starts[idxGroup+1]) - first;
+        if(groupSize > 1){
+            Sort<SortType,IndexType>(&indexes[first], groupSize);
+        }
+    }
+}
+
+template <class SortType, class IndexType = size_t>
+static inline void Rank(const SortType keys[], double ranks[], const IndexType size,
+                        const RankMethod method = RankMethod::Average){
+    if(size == 0){
+        return;
+    }
+    // The small sorts pad with the greatest value and could exchange the positions
+    // of such keys with the padding, so they are put at the end and not sorted
+    const SortType padKey = std::numeric_limits<SortType>::max();
+    std::unique_ptr<SortType[]> sorted(new SortType[size]);
+    std::unique_ptr<SortType[]> indexes(new SortType[size]);
+    IndexType nbOthers = 0;
+    IndexType nbPadKeys = 0;
+    for(IndexType idx = 0 ; idx < size ; ++idx){
+        if(keys[idx] != padKey){
+            sorted[nbOthers] = keys[idx];
+            indexes[nbOthers] = SortType(idx);
+            nbOthers += 1;
+        }
+        else{
+            nbPadKeys += 1;
+            sorted[size-nbPadKeys] = padKey;
+            indexes[size-nbPadKeys] = SortType(idx);
+        }
+    }
+    if(nbOthers){
+        Sort512kv::Sort<SortType,IndexType>(sorted.get(), indexes.get(), nbOthers);
+    }
+
+    std::unique_ptr<SortType[]> starts(new SortType[size+1]);
+    const IndexType nbGroups = CoreRankGroupStarts(sorted.get(), size, starts.get());
+
+    if(method == RankMethod::Ordinal && nbGroups != size){
+        CoreRankSortGroups(indexes.get(), starts.get(), nbGroups);
+    }
+
+    CoreRankScatter(sorted.get(), indexes.get(), starts.get(), ranks, size, method);
+}
+
+}
+
+#endif
@@ -0,0 +1,698 @@
+//////////////////////////////////////////////////////////
+/// Code to compute the intersection, the union or the
+/// difference of sorted arrays of int or int64_t
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Functions to call:
+/// Sort512set::Intersection(); values that are in both arrays
+/// Sort512set::Union(); values that are in one of the arrays
+/// Sort512set::Difference(); values of the first array that are not in the second
+/// Sort512set::IntersectionOmp(), UnionOmp(), DifferenceOmp(); in parallel
+/// Sort512set::FlatSet<SortType>; sorted set in an array with batched inserts
+///
+/// The input arrays must be sorted and without duplicates (as given by
+/// Sort512::SortUnique), the result is written sorted and without duplicates
+/// in out, which must be able to contain min(size1, size2) values for the
+/// intersection, size1 + size2 for the union and size1 for the difference.
+/// The functions return the number of values written in out.
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512SET_HPP
+#define SORT512SET_HPP
+
+#include <immintrin.h>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "sort512.hpp"
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace Sort512set {
+
+// Above this ratio between the sizes, the values of the small array
+// are searched in the large one instead of merging the two arrays
+const size_t GallopingRatio = 32;
+
+////////////////////////////////////////////////////////////////////////////////
+/// Vector operations
+////////////////////////////////////////////////////////////////////////////////
+
+template <class SortType>
+struct CoreSetVec;
+
+/// Int
+
+template <>
+struct CoreSetVec<int> {
+    static const int S = 16;
+    typedef __mmask16 Mask;
+
+    static inline __m512i Load(const int* ptr){
+        return _mm512_loadu_si512(ptr);
+    }
+
+    // Lane i is set if a[i] is in b (all-pairs compare with the 16 rotations of b)
+    static inline Mask MatchMask(const __m512i a, const __m512i b){
+        const __m512i rotationStep = _mm512_set1_epi32(1);
+        const __m512i rotationMask = _mm512_set1_epi32(15);
+        __m512i rotation = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8,
+                                            7, 6, 5, 4, 3, 2, 1, 0);
+        Mask match = 0;
+        for(int idxRotation = 0 ; idxRotation < S ; ++idxRotation){
+            match |= _mm512_cmp_epi32_mask(a, _mm512_permutexvar_epi32(rotation, b), _MM_CMPINT_EQ);
+            rotation = _mm512_and_si512(_mm512_add_epi32(rotation, rotationStep), rotationMask);
+        }
+        return match;
+    }
+
+    static inline int CompressStore(int* out, const Mask mask, const __m512i values){
+        _mm512_mask_compressstoreu_epi32(out, mask, values);
+        return Sort512::popcount(mask);
+    }
+
+    // input gets the 16 lowest values and input2 the 16 greatest
+    static inline void Merge(__m512i& input, __m512i& input2){
+        Sort512::CoreExchangeSort2V(input, input2);
+    }
+
+    // Lane i is set if the value is different from the one on its left
+    static inline Mask DistinctMask(const __m512i values, const __m512i previous){
+        return _mm512_cmp_epi32_mask(values, _mm512_alignr_epi32(values, previous, 15), _MM_CMPINT_NE);
+    }
+
+    // Number of values lower than value in ptr[0 ... nbValues-1], nbValues <= S
+    static inline int CountLower(const int* ptr, const int nbValues, const int value){
+        const Mask remaining = Mask(0xFFFF >> (S - nbValues));
+        return Sort512::popcount(_mm512_mask_cmp_epi32_mask(remaining, _mm512_maskz_loadu_epi32(remaining, ptr),
+                                                            _mm512_set1_epi32(value), _MM_CMPINT_LT));
+    }
+
+    // Number of values lower than value in ptr[step-1], ptr[2*step-1] ... ptr[S*step-1] (gathered)
+    static inline int CountLowerPivots(const int* ptr, const int step, const int value){
+        const __m512i positions = _mm512_sub_epi32(_mm512_mullo_epi32(_mm512_set_epi32(16, 15, 14, 13, 12, 11, 10, 9,
+                                                                                        8, 7, 6, 5, 4, 3, 2, 1),
+                                                                       _mm512_set1_epi32(step)),
+                                                   _mm512_set1_epi32(1));
+        return Sort512::popcount(_mm512_cmp_epi32_mask(_mm512_i32gather_epi32(positions, ptr, 4),
+                                                       _mm512_set1_epi32(value), _MM_CMPINT_LT));
+    }
+};
+
+/// Int64
+
+template <>
+struct CoreSetVec<int64_t> {
+    static const int S = 8;
+    typedef __mmask8 Mask;
+
+    static inline __m512i Load(const int64_t* ptr){
+        return _mm512_loadu_si512(ptr);
+    }
+
+    // Lane i is set if a[i] is in b (all-pairs compare with the 8 rotations of b)
+    static inline Mask MatchMask(const __m512i a, const __m512i b){
+        const __m512i rotationStep = _mm512_set1_epi64(1);
+        const __m512i rotationMask = _mm512_set1_epi64(7);
+        __m512i rotation = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+        Mask match = 0;
+        for(int idxRotation = 0 ; idxRotation < S ; ++idxRotation){
+            match |= _mm512_cmp_epi64_mask(a, _mm512_permutexvar_epi64(rotation, b), _MM_CMPINT_EQ);
+            rotation = _mm512_and_si512(_mm512_add_epi64(rotation, rotationStep), rotationMask);
+        }
+        return match;
+    }
+
+    static inline int CompressStore(int64_t* out, const Mask mask, const __m512i values){
+        _mm512_mask_compressstoreu_epi64(out, mask, values);
+        return Sort512::popcount(mask);
+    }
+
+    // input gets the 8 lowest values and input2 the 8 greatest
+    static inline void Merge(__m512i& input, __m512i& input2){
+        {
+            __m512i idxNoNeigh = _mm512_set_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+            __m512i permNeigh = _mm512_permutexvar_epi64(idxNoNeigh, input);
+            input = _mm512_min_epi64( permNeigh,input2);
+            input2 = _mm512_max_epi64(input2, permNeigh);
+        }
+        {
+            __m512i idxNoNeigh = _mm512_set_epi64(3, 2, 1, 0, 7, 6, 5, 4);
+            __m512i permNeigh = _mm512_permutexvar_epi64(idxNoNeigh, input);
+            __m512i permNeigh2 = _mm512_permutexvar_epi64(idxNoNeigh, input2);
+            __m512i permNeighMin = _mm512_min_epi64( input,permNeigh);
+            __m512i permNeighMin2 = _mm512_min_epi64( input2,permNeigh2);
+            __m512i permNeighMax = _mm512_max_epi64(permNeigh, input);
+            __m512i permNeighMax2 = _mm512_max_epi64(permNeigh2, input2);
+            input = _mm512_mask_mov_epi64(permNeighMin, 0xF0, permNeighMax);
+            input2 = _mm512_mask_mov_epi64(permNeighMin2, 0xF0, permNeighMax2);
+        }
+        {
+            __m512i idxNoNeigh = _mm512_set_epi64(5, 4, 7, 6, 1, 0, 3, 2);
+            __m512i permNeigh = _mm512_permutexvar_epi64(idxNoNeigh, input);
+            __m512i permNeigh2 = _mm512_permutexvar_epi64(idxNoNeigh, input2);
+            __m512i permNeighMin = _mm512_min_epi64( input,permNeigh);
+            __m512i permNeighMin2 = _mm512_min_epi64( input2,permNeigh2);
+            __m512i permNeighMax = _mm512_max_epi64(permNeigh, input);
+            __m512i permNeighMax2 = _mm512_max_epi64(permNeigh2, input2);
+            input = _mm512_mask_mov_epi64(permNeighMin, 0xCC, permNeighMax);
+            input2 = _mm512_mask_mov_epi64(permNeighMin2, 0xCC, permNeighMax2);
+        }
+        {
+            __m512i idxNoNeigh = _mm512_set_epi64(6, 7, 4, 5, 2, 3, 0, 1);
+            __m512i permNeigh = _mm512_permutexvar_epi64(idxNoNeigh, input);
+            __m512i permNeigh2 = _mm512_permutexvar_epi64(idxNoNeigh, input2);
+            __m512i permNeighMin = _mm512_min_epi64( input,permNeigh);
+            __m512i permNeighMin2 = _mm512_min_epi64( input2,permNeigh2);
+            __m512i permNeighMax = _mm512_max_epi64(permNeigh, input);
+            __m512i permNeighMax2 = _mm512_max_epi64(permNeigh2, input2);
+            input = _mm512_mask_mov_epi64(permNeighMin, 0xAA, permNeighMax);
+            input2 = _mm512_mask_mov_epi64(permNeighMin2, 0xAA, permNeighMax2);
+        }
+    }
+
+    // Lane i is set if the value is different from the one on its left
+    static inline Mask DistinctMask(const __m512i values, const __m512i previous){
+        return _mm512_cmp_epi64_mask(values, _mm512_alignr_epi64(values, previous, 7), _MM_CMPINT_NE);
+    }
+
+    // Number of values lower than value in ptr[0 ... nbValues-1], nbValues <= S
+    static inline int CountLower(const int64_t* ptr, const int nbValues, const int64_t value){
+        const Mask remaining = Mask(0xFF >> (S - nbValues));
+        return Sort512::popcount(_mm512_mask_cmp_epi64_mask(remaining, _mm512_maskz_loadu_epi64(remaining, ptr),
+                                                            _mm512_set1_epi64(value), _MM_CMPINT_LT));
+    }
+
+    // Number of values lower than value in ptr[step-1], ptr[2*step-1] ... ptr[S*step-1] (gathered)
+    static inline int CountLowerPivots(const int64_t* ptr, const int step, const int64_t value){
+        const __m256i positions = _mm256_sub_epi32(_mm256_mullo_epi32(_mm256_set_epi32(8, 7, 6, 5, 4, 3, 2, 1),
+                                                                       _mm256_set1_epi32(step)),
+                                                   _mm256_set1_epi32(1));
+        return Sort512::popcount(_mm512_cmp_epi64_mask(_mm512_i32gather_epi64(positions, ptr, 8),
+                                                       _mm512_set1_epi64(value), _MM_CMPINT_LT));
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sequential set operations
+////////////////////////////////////////////////////////////////////////////////
+
+// Position of the first value not lower than value in array[from ... size-1],
+// by exponential search and then binary search until a vector is left
+template <class SortType, class IndexType>
+inline IndexType CoreGallop(const SortType array[], const IndexType from, const IndexType size,
+                            const SortType value){
+    const IndexType S = CoreSetVec<SortType>::S;
+    IndexType low = from;
+    IndexType step = 1;
+    IndexType high = low;
+    while(high < size && array[high] < value){
+        low = high + 1;
+        step *= 2;
+        high = low + step;
+    }
+    high = std::min(high, size);
+    while(high - low > S){
+        const IndexType middle = low + (high-low)/2;
+        if(array[middle] < value){
+            low = middle + 1;
+        }
+        else{
+            high = middle;
+        }
+    }
+    return low + IndexType(CoreSetVec<SortType>::CountLower(&array[low], int(high - low), value));
+}
+
+// Search the values of array1 (the small one) in array2,
+// keepFound tells if the values found or not found are written
+template <class SortType, class IndexType>
+inline IndexType CoreSetGalloping(const SortType array1[], const IndexType size1,
+                                  const SortType array2[], const IndexType size2,
+                                  SortType out[], const bool keepFound){
+    IndexType nbOut = 0;
+    IndexType idx2 = 0;
+    for(IndexType idx1 = 0 ; idx1 < size1 ; ++idx1){
+        idx2 = CoreGallop(array2, idx2, size2, array1[idx1]);
+        const bool found = (idx2 < size2 && array2[idx2] == array1[idx1]);
+        if(found == keepFound){
+            out[nbOut++] = array1[idx1];
+        }
+    }
+    return nbOut;
+}
+
+// The blocks of array1 and array2 are compared in the order of a merge,
+// the block with the lowest last value is replaced by the next one (or both if equal).
+// For the difference, a block of array1 is written when it is replaced,
+// with the values that have been found in the blocks of array2 removed.
+template <class SortType, class IndexType>
+inline IndexType CoreSetBlocks(const SortType array1[], const IndexType size1,
+                               const SortType array2[], const IndexType size2,
+                               SortType out[], const bool keepFound){
+    typedef CoreSetVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    IndexType idx1 = 0;
+    IndexType idx2 = 0;
+    IndexType nbOut = 0;
+    typename Vec::Mask found = 0;
+
+    while(idx1 + S <= size1 && idx2 + S <= size2){
+        const SortType last1 = array1[idx1 + S - 1];
+        const SortType last2 = array2[idx2 + S - 1];
+        const __m512i values1 = Vec::Load(&array1[idx1]);
+        if(array2[idx2] <= last1 && array1[idx1] <= last2){
+            const typename Vec::Mask match = Vec::MatchMask(values1, Vec::Load(&array2[idx2]));
+            if(keepFound){
+                nbOut += Vec::CompressStore(&out[nbOut], match, values1);
+            }
+            found |= match;
+        }
+        if(last1 <= last2){
+            if(!keepFound){
+                nbOut += Vec::CompressStore(&out[nbOut], typename Vec::Mask(~found), values1);
+            }
+            found = 0;
+            idx1 += S;
+        }
+        if(last2 <= last1){
+            idx2 += S;
+        }
+    }
+
+    // The values of the current block of array1 found previously are after idx1
+    // and cannot be found again in array2 after idx2
+    const IndexType firstTail = idx1;
+    while(idx1 < size1 && idx2 < size2){
+        if(array1[idx1] < array2[idx2]){
+            if(!keepFound && (idx1 - firstTail >= S || ((found >> (idx1 - firstTail)) & 1) == 0)){
+                out[nbOut++] = array1[idx1];
+            }
+            idx1 += 1;
+        }
+        else if(array2[idx2] < array1[idx1]){
+            idx2 += 1;
+        }
+        else{
+            if(keepFound){
+                out[nbOut++] = array1[idx1];
+            }
+            idx1 += 1;
+            idx2 += 1;
+        }
+    }
+    if(!keepFound){
+        for( ; idx1 < size1 ; ++idx1){
+            if(idx1 - firstTail >= S || ((found >> (idx1 - firstTail)) & 1) == 0){
+                out[nbOut++] = array1[idx1];
+            }
+        }
+    }
+    return nbOut;
+}
+
+// Scalar union of the three sorted arrays after what has been written in out
+template <class SortType, class IndexType>
+inline IndexType CoreUnionTail(const SortType array1[], const IndexType size1,
+                               const SortType array2[], const IndexType size2,
+                               const SortType array3[], const IndexType size3,
+                               SortType out[], IndexType nbOut){
+    IndexType idx1 = 0;
+    IndexType idx2 = 0;
+    IndexType idx3 = 0;
+    while(idx1 != size1 || idx2 != size2 || idx3 != size3){
+        SortType value;
+        if(idx1 != size1 && (idx2 == size2 || array1[idx1] <= array2[idx2])
+                && (idx3 == size3 || array1[idx1] <= array3[idx3])){
+            value = array1[idx1++];
+        }
+        else if(idx2 != size2 && (idx3 == size3 || array2[idx2] <= array3[idx3])){
+            value = array2[idx2++];
+        }
+        else{
+            value = array3[idx3++];
+        }
+        if(nbOut == 0 || out[nbOut-1] != value){
+            out[nbOut++] = value;
+        }
+    }
+    return nbOut;
+}
+
+// Union of a small array with a large one after what has been written in out:
+// the position of each value of the small array is found by galloping and the
+// run of the large array before it is copied in bulk, a duplicate can only be
+// at the junction of a run with the value before it
+template <class SortType, class IndexType>
+inline IndexType CoreUnionGalloping(const SortType small[], const IndexType smallSize,
+                                    const SortType large[], const IndexType largeSize,
+                                    SortType out[], IndexType nbOut){
+    IndexType idxLarge = 0;
+    for(IndexType idxSmall = 0 ; idxSmall <= smallSize ; ++idxSmall){
+        const IndexType runEnd = (idxSmall == smallSize ? largeSize
+                                  : CoreGallop(large, idxLarge, largeSize, small[idxSmall]));
+        if(idxLarge != runEnd && nbOut != 0 && out[nbOut-1] == large[idxLarge]){
+            idxLarge += 1;
+        }
+        if(idxLarge < runEnd){
+            std::copy(&large[idxLarge], &large[runEnd], &out[nbOut]);
+            nbOut += runEnd - idxLarge;
+        }
+        idxLarge = runEnd;
+        // A value also in the large array is copied with the next run
+        if(idxSmall != smallSize && (idxLarge == largeSize || large[idxLarge] != small[idxSmall])
+                && (nbOut == 0 || out[nbOut-1] != small[idxSmall])){
+            out[nbOut++] = small[idxSmall];
+        }
+    }
+    return nbOut;
+}
+
+// Merge one vector at a time with the vector of the greatest values, the next
+// vector is taken from the array with the lowest next value, the duplicates
+// are adjacent in the merged vectors and removed when they are written.
+// When an array has less than a vector left, it is merged with the greatest
+// values and the rest of the other array is copied by CoreUnionGalloping.
+template <class SortType, class IndexType>
+inline IndexType CoreUnionBlocks(const SortType array1[], const IndexType size1,
+                                 const SortType array2[], const IndexType size2,
+                                 SortType out[]){
+    typedef CoreSetVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    if(size1 < S){
+        return CoreUnionGalloping(array1, size1, array2, size2, out, IndexType(0));
+    }
+    if(size2 < S){
+        return CoreUnionGalloping(array2, size2, array1, size1, out, IndexType(0));
+    }
+
+    __m512i lowest = Vec::Load(&array1[0]);
+    __m512i greatest = Vec::Load(&array2[0]);
+    Vec::Merge(lowest, greatest);
+    IndexType nbOut = Vec::CompressStore(out, typename Vec::Mask(Vec::DistinctMask(lowest, lowest) | 1), lowest);
+    __m512i previous = lowest;
+    IndexType idx1 = S;
+    IndexType idx2 = S;
+
+    while(idx1 + S <= size1 && idx2 + S <= size2){
+        if(array1[idx1] <= array2[idx2]){
+            lowest = Vec::Load(&array1[idx1]);
+            idx1 += S;
+        }
+        else{
+            lowest = Vec::Load(&array2[idx2]);
+            idx2 += S;
+        }
+        Vec::Merge(lowest, greatest);
+        nbOut += Vec::CompressStore(&out[nbOut], Vec::DistinctMask(lowest, previous), lowest);
+        previous = lowest;
+    }
+
+    SortType remaining[Vec::S];
+    _mm512_storeu_si512(remaining, greatest);
+    SortType smallPart[2*Vec::S];
+    if(idx1 + S > size1){
+        const IndexType nbSmall = CoreUnionTail(remaining, S, &array1[idx1], size1 - idx1,
+                                                array1, IndexType(0), smallPart, IndexType(0));
+        return CoreUnionGalloping(smallPart, nbSmall, &array2[idx2], size2 - idx2, out, nbOut);
+    }
+    const IndexType nbSmall = CoreUnionTail(remaining, S, &array2[idx2], size2 - idx2,
+                                            array2, IndexType(0), smallPart, IndexType(0));
+    return CoreUnionGalloping(smallPart, nbSmall, &array1[idx1], size1 - idx1, out, nbOut);
+}
+
+template <class SortType, class IndexType = size_t>
+inline IndexType Intersection(const SortType array1[], const IndexType size1,
+                              const SortType array2[], const IndexType size2, SortType out[]){
+    if(size1 > size2 * GallopingRatio){
+        return CoreSetGalloping(array2, size2, array1, size1, out, true);
+    }
+    if(size2 > size1 * GallopingRatio){
+        return CoreSetGalloping(array1, size1, array2, size2, out, true);
+    }
+    return CoreSetBlocks(array1, size1, array2, size2, out, true);
+}
+
+template <class SortType, class IndexType = size_t>
+inline IndexType Union(const SortType array1[], const IndexType size1,
+                       const SortType array2[], const IndexType size2, SortType out[]){
+    if(size1 > size2 * GallopingRatio){
+        return CoreUnionGalloping(array2, size2, array1, size1, out, IndexType(0));
+    }
+    if(size2 > size1 * GallopingRatio){
+        return CoreUnionGalloping(array1, size1, array2, size2, out, IndexType(0));
+    }
+    return CoreUnionBlocks(array1, size1, array2, size2, out);
+}
+
+template <class SortType, class IndexType = size_t>
+inline IndexType Difference(const SortType array1[], const IndexType size1,
+                            const SortType array2[], const IndexType size2, SortType out[]){
+    if(size2 > size1 * GallopingRatio){
+        return CoreSetGalloping(array1, size1, array2, size2, out, false);
+    }
+    return CoreSetBlocks(array1, size1, array2, size2, out, false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Flat set
+////////////////////////////////////////////////////////////////////////////////
+
+// Position of the first value not lower than value in array[0 ... size-1],
+// by a (S+1)-ary search: at each step S pivots equally spaced in the
+// interval are gathered and compared to value at once, until a vector is left
+template <class SortType, class IndexType>
+inline IndexType CoreKaryLowerBound(const SortType array[], const IndexType size, const SortType value){
+    typedef CoreSetVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    IndexType low = 0;
+    IndexType length = size;
+    while(length > S){
+        const IndexType step = length/(S+1);
+        const IndexType nbLower = IndexType(Vec::CountLowerPivots(&array[low], int(step), value));
+        low += nbLower*step;
+        length = (nbLower == S ? length - S*step : step);
+    }
+    return low + IndexType(Vec::CountLower(&array[low], int(length), value));
+}
+
+template <class IndexType>
+inline IndexType CoreFlatSetSortUnique(int array[], const IndexType size){
+    return Sort512::SortUnique<int,IndexType>(array, size);
+}
+
+// There is no vectorized sort for int64_t
+template <class IndexType>
+inline IndexType CoreFlatSetSortUnique(int64_t array[], const IndexType size){
+    std::sort(array, array + size);
+    return IndexType(std::unique(array, array + size) - array);
+}
+
+// The buffer is aligned on 64 bytes
+template <class SortType>
+inline SortType* CoreFlatSetAlignedBuffer(std::unique_ptr<SortType[]>& memory, const size_t capacity){
+    memory.reset(new SortType[capacity + 64/sizeof(SortType)]);
+    const size_t shift = (64 - (reinterpret_cast<std::uintptr_t>(memory.get()) % 64)) % 64;
+    return memory.get() + shift/sizeof(SortType);
+}
+
+// Sorted set of int or int64_t stored in a contiguous array (without
+// duplicates), the batches are sorted (with the vectorized sort for int)
+// and merged with the set by Union in a second array that becomes the set
+template <class SortType, class IndexType = size_t>
+class FlatSet {
+    std::unique_ptr<SortType[]> valuesMemory;
+    SortType* values;
+    std::unique_ptr<SortType[]> spareMemory;
+    SortType* spare;
+    IndexType nbValues;
+    IndexType capacity;
+
+    // Make sure nbNeeded values can be stored in both arrays
+    void reserveSpare(const IndexType nbNeeded){
+        if(capacity < nbNeeded){
+            const IndexType newCapacity = std::max(nbNeeded, 2*capacity);
+            std::unique_ptr<SortType[]> newMemory;
+            SortType* newValues = CoreFlatSetAlignedBuffer(newMemory, newCapacity);
+            std::copy(values, values + nbValues, newValues);
+            valuesMemory = std::move(newMemory);
+            values = newValues;
+            spare = CoreFlatSetAlignedBuffer(spareMemory, newCapacity);
+            capacity = newCapacity;
+        }
+    }
+
+public:
+    FlatSet() : values(nullptr), spare(nullptr), nbValues(0), capacity(0){
+        reserveSpare(64);
+    }
+
+    FlatSet(const FlatSet&) = delete;
+    FlatSet& operator=(const FlatSet&) = delete;
+
+    // Position of the first value not lower than value
+    IndexType lowerBound(const SortType value) const{
+        return CoreKaryLowerBound(values, nbValues, value);
+    }
+
+    bool contains(const SortType value) const{
+        const IndexType position = lowerBound(value);
+        return position != nbValues && values[position] == value;
+    }
+
+    // Write in found[idx] if values[idx] is in the set
+    void contains(const SortType searched[], const IndexType nbSearched, bool found[]) const{
+        for(IndexType idx = 0 ; idx < nbSearched ; ++idx){
+            found[idx] = contains(searched[idx]);
+        }
+    }
+
+    // Returns false if the value was already in the set
+    bool insert(const SortType value){
+        const IndexType position = lowerBound(value);
+        if(position != nbValues && values[position] == value){
+            return false;
+        }
+        reserveSpare(nbValues + 1);
+        std::copy_backward(values + position, values + nbValues, values + nbValues + 1);
+        values[position] = value;
+        nbValues += 1;
+        return true;
+    }
+
+    // The values can be in any order and contain duplicates
+    void insert(const SortType batch[], const IndexType batchSize){
+        if(batchSize == 0){
+            return;
+        }
+        reserveSpare(nbValues + 2*batchSize);
+        // The batch is sorted at the end of spare and merged at its beginning,
+        // the merge cannot write over a batch value before it has been read
+        SortType* sortedBatch = spare + nbValues + batchSize;
+        std::copy(batch, batch + batchSize, sortedBatch);
+        const IndexType nbUnique = CoreFlatSetSortUnique(sortedBatch, batchSize);
+        nbValues = Union<SortType,IndexType>(values, nbValues, sortedBatch, nbUnique, spare);
+        std::swap(values, spare);
+        std::swap(valuesMemory, spareMemory);
+    }
+
+    // Returns false if the value was not in the set
+    bool erase(const SortType value){
+        const IndexType position = lowerBound(value);
+        if(position == nbValues || values[position] != value){
+            return false;
+        }
+        std::copy(values + position + 1, values + nbValues, values + position);
+        nbValues -= 1;
+        return true;
+    }
+
+    IndexType size() const{
+        return nbValues;
+    }
+
+    // The values in increasing order
+    const SortType* data() const{
+        return values;
+    }
+
+    void clear(){
+        nbValues = 0;
+    }
+};
+
+#if defined(_OPENMP)
+
+////////////////////////////////////////////////////////////////////////////////
+/// Parallel set operations
+////////////////////////////////////////////////////////////////////////////////
+
+// Position in array2 of the split on the merge path at diag,
+// a value present in both arrays is kept on the same side of the split
+template <class SortType, class IndexType>
+inline void CoreSetSplit(const SortType array1[], const IndexType size1,
+                         const SortType array2[], const IndexType size2,
+                         const IndexType diag, IndexType* split1, IndexType* split2){
+    (*split1) = Sort512::MergePathSplit(array1, size1, array2, size2, diag);
+    (*split2) = diag - (*split1);
+    if((*split1) != 0 && (*split2) != size2 && array1[(*split1)-1] == array2[(*split2)]){
+        (*split2) += 1;
+    }
+}
+
+// Each thread applies the operation on its part of the merge path in a
+// buffer, the buffers are then copied one after the other in out
+template <class SortType, class IndexType, class SetFunc>
+inline IndexType CoreSetOmp(const SortType array1[], const IndexType size1,
+                            const SortType array2[], const IndexType size2,
+                            SortType out[], SetFunc&& func){
+    const int nbThreads = omp_get_max_threads();
+    std::unique_ptr<IndexType[]> offsets(new IndexType[nbThreads+1]);
+    IndexType nbTotal = 0;
+
+#pragma omp parallel num_threads(nbThreads)
+    {
+        const int nbWorkers = Sort512::CoreTeamSize();
+        const int idxThread = omp_get_thread_num();
+        const IndexType totalSize = size1 + size2;
+        IndexType first1, first2, last1, last2;
+        CoreSetSplit(array1, size1, array2, size2, IndexType(totalSize*idxThread/nbWorkers), &first1, &first2);
+        CoreSetSplit(array1, size1, array2, size2, IndexType(totalSize*(idxThread+1)/nbWorkers), &last1, &last2);
+
+        std::unique_ptr<SortType[]> buffer(new SortType[(last1-first1) + (last2-first2) + 1]);
+        const IndexType nbOut = func(&array1[first1], last1-first1, &array2[first2], last2-first2, buffer.get());
+        offsets[idxThread+1] = nbOut;
+
+#pragma omp barrier
+#pragma omp master
+        {
+            offsets[0] = 0;
+            for(int idxOffset = 0 ; idxOffset < nbWorkers ; ++idxOffset){
+                offsets[idxOffset+1] += offsets[idxOffset];
+            }
+            nbTotal = offsets[nbWorkers];
+        }
+#pragma omp barrier
+
+        std::copy(buffer.get(), buffer.get() + nbOut, &out[offsets[idxThread]]);
+    }
+    return nbTotal;
+}
+
+template <class SortType, class IndexType = size_t>
+inline IndexType IntersectionOmp(const SortType array1[], const IndexType size1,
+                                 const SortType array2[], const IndexType size2, SortType out[]){
+    return CoreSetOmp(array1, size1, array2, size2, out, Intersection<SortType,IndexType>);
+}
+
+template <class SortType, class IndexType = size_t>
+inline IndexType UnionOmp(const SortType array1[], const IndexType size1,
+                          const SortType array2[], const IndexType size2, SortType out[]){
+    return CoreSetOmp(array1, size1, array2, size2, out, Union<SortType,IndexType>);
+}
+
+template <class SortType, class IndexType = size_t>
+inline IndexType DifferenceOmp(const SortType array1[], const IndexType size1,
+                               const SortType array2[], const IndexType size2, SortType out[]){
+    return CoreSetOmp(array1, size1, array2, size2, out, Difference<SortType,IndexType>);
+}
+
+#endif
+
+}
+
+#endif
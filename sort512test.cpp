@@ -18,10 +18,24 @@
 
 #include "sort512.hpp"
 #include "sort512kv.hpp"
+#include "sort512perm.hpp"
+#include "sort512rank.hpp"
+#include "sort512join.hpp"
+#include "sort512set.hpp"
+#include "sort512kway.hpp"
+#include "sort512topk.hpp"
+#include "sort512heap.hpp"
+#include "sort512window.hpp"
+#include "sort512tree.hpp"
+#include "sort512radix.hpp"
 
 #include <iostream>
 #include <memory>
 #include <cstdlib>
+#include <limits>
+#include <queue>
+#include <functional>
+#include <set>
 
 int test_res = 0;
 
@@ -1403,6 +1417,13 @@ void testQs512(){
         Sort512::SortOmpParMerge<NumType,size_t>(array.get(), idx);
         assertNotSorted(array.get(), idx, "");
     }
+    for(size_t idx = 1 ; idx <= (1<<18); idx = idx*3 + 1){
+        std::cout << "   " << idx << std::endl;
+        std::unique_ptr<NumType[]> array(new NumType[idx]);
+        createRandVec(array.get(), idx); Checker<NumType> checker(array.get(), array.get(), idx);
+        Sort512::SortOmpMergePath<NumType,size_t>(array.get(), idx);
+        assertNotSorted(array.get(), idx, "");
+    }
 #endif
 }
 
@@ -1412,15 +1433,23 @@ void testQs512_pair(){
     for(size_t idx = 1 ; idx <= (1<<10); idx *= 2){
         std::cout << "   " << idx << std::endl;
         std::unique_ptr<NumType[]> array(new NumType[idx]);
-        createRandVec(array.get(), idx); Checker<NumType> checker(array.get(), array.get(), idx);
+        createRandVec(array.get(), idx);
+        // Keys equal to the padding of the small sorts
+        for(size_t idxval = 3 ; idxval < idx ; idxval += 7){
+            array[idxval] = std::numeric_limits<NumType>::max();
+        }
+        Checker<NumType> checker(array.get(), array.get(), idx);
         std::unique_ptr<NumType[]> values(new NumType[idx]);
+        std::unique_ptr<NumType[]> source(new NumType[idx]);
         for(size_t idxval = 0 ; idxval < idx ; ++idxval){
-            values[idxval] = array[idxval]*100+1;
+            values[idxval] = NumType(idxval);
+            source[idxval] = array[idxval];
         }
         Sort512kv::Sort<NumType,size_t>(array.get(), values.get(), idx);
         assertNotSorted(array.get(), idx, "");
         for(size_t idxval = 0 ; idxval < idx ; ++idxval){
-            if(values[idxval] != array[idxval]*100+1){
+            if(values[idxval] < 0 || idx <= size_t(values[idxval])
+                    || source[size_t(values[idxval])] != array[idxval]){
                 std::cout << "Error in testNewPartition512V2_pair, pair/key do not match" << std::endl;
                 test_res = 1;
             }
@@ -1430,20 +1459,52 @@ void testQs512_pair(){
     for(size_t idx = 1 ; idx <= (1<<10); idx *= 2){
         std::cout << "   " << idx << std::endl;
         std::unique_ptr<NumType[]> array(new NumType[idx]);
-        createRandVec(array.get(), idx); Checker<NumType> checker(array.get(), array.get(), idx);
+        createRandVec(array.get(), idx);
+        // Keys equal to the padding of the small sorts
+        for(size_t idxval = 3 ; idxval < idx ; idxval += 7){
+            array[idxval] = std::numeric_limits<NumType>::max();
+        }
+        Checker<NumType> checker(array.get(), array.get(), idx);
         std::unique_ptr<NumType[]> values(new NumType[idx]);
+        std::unique_ptr<NumType[]> source(new NumType[idx]);
         for(size_t idxval = 0 ; idxval < idx ; ++idxval){
-            values[idxval] = array[idxval]*100+1;
+            values[idxval] = NumType(idxval);
+            source[idxval] = array[idxval];
         }
         Sort512kv::SortOmpPartition<NumType,size_t>(array.get(), values.get(), idx);
         assertNotSorted(array.get(), idx, "");
         for(size_t idxval = 0 ; idxval < idx ; ++idxval){
-            if(values[idxval] != array[idxval]*100+1){
+            if(values[idxval] < 0 || idx <= size_t(values[idxval])
+                    || source[size_t(values[idxval])] != array[idxval]){
                 std::cout << "Error in testNewPartition512V2_pair, pair/key do not match" << std::endl;
                 test_res = 1;
             }
         }
     }
+    for(size_t idx = 1 ; idx <= (1<<18); idx = idx*3 + 1){
+        std::cout << "   " << idx << std::endl;
+        std::unique_ptr<NumType[]> array(new NumType[idx]);
+        createRandVec(array.get(), idx);
+        for(size_t idxval = 3 ; idxval < idx ; idxval += 7){
+            array[idxval] = std::numeric_limits<NumType>::max();
+        }
+        Checker<NumType> checker(array.get(), array.get(), idx);
+        std::unique_ptr<NumType[]> values(new NumType[idx]);
+        std::unique_ptr<NumType[]> source(new NumType[idx]);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            values[idxval] = NumType(idxval);
+            source[idxval] = array[idxval];
+        }
+        Sort512kv::SortOmpMergePath<NumType,size_t>(array.get(), values.get(), idx);
+        assertNotSorted(array.get(), idx, "");
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            if(values[idxval] < 0 || idx <= size_t(values[idxval])
+                    || source[size_t(values[idxval])] != array[idxval]){
+                std::cout << "Error in SortOmpMergePath pair, pair/key do not match" << std::endl;
+                test_res = 1;
+            }
+        }
+    }
 #endif
 }
 
@@ -1575,21 +1636,22 @@ void testSmallVecSort_pair(){
             std::cout << "   " << idx << std::endl;
             std::unique_ptr<NumType[]> array(new NumType[idx]);
             std::unique_ptr<NumType[]> values(new NumType[idx]);
+            std::unique_ptr<NumType[]> source(new NumType[idx]);
             for(int idxTest = 0 ; idxTest < 100 ; ++idxTest){
                 createRandVec(array.get(), idx); Checker<NumType> checker(array.get(), array.get(), idx);
 
                 for(int idxval = 0 ; idxval < idx ; ++idxval){
-                    values[idxval] = array[idxval]*100+1;
+                    values[idxval] = NumType(idxval);
+                    source[idxval] = array[idxval];
                 }
 
                 Sort512kv::SmallSort16V(array.get(), values.get(), idx);
                 assertNotSorted(array.get(), idx, "");
 
                 for(int idxval = 0 ; idxval < idx ; ++idxval){
-                    if(values[idxval] != array[idxval]*100+1){
-                        std::cout << "Error in testSortVec_pair "
-                                     " is " << values[idxval] <<
-                                     " should be " << array[idxval]*100+1 << std::endl;
+                    if(values[idxval] < 0 || idx <= size_t(values[idxval])
+                            || source[size_t(values[idxval])] != array[idxval]){
+                        std::cout << "Error in testSortVec_pair, pair/key do not match at " << idxval << std::endl;
                         test_res = 1;
                     }
                 }
@@ -1598,55 +1660,1824 @@ void testSmallVecSort_pair(){
     }
 }
 
+void createRandPermutation(int permutation[], const size_t size){
+    for(size_t idx = 0 ; idx < size ; ++idx){
+        permutation[idx] = int(idx);
+    }
+    for(size_t idx = size ; idx > 1 ; --idx){
+        const size_t other = size_t(drand48()*double(idx)) % idx;
+        std::swap(permutation[idx-1], permutation[other]);
+    }
+}
 
-int main(){
-    testPopcount();
+void testPermutation(){
+    std::cout << "Start testPermutation...\n";
+    srand48(0);
+    auto testOne = [](const int permutation[], const size_t size){
+        std::unique_ptr<int[]> array(new int[size]);
+        std::unique_ptr<double[]> values(new double[size]);
+        std::unique_ptr<int[]> expected(new int[size]);
+        std::unique_ptr<int[]> res(new int[size]);
+        std::unique_ptr<double[]> resValues(new double[size]);
+
+        createRandVec(array.get(), size);
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            values[idxval] = array[idxval]*100+1;
+        }
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            expected[idxval] = array[permutation[idxval]];
+        }
 
-    testSortVec();
-    testSortVec_pair();
-    testSort2Vec();
-    testSort2Vec_pair();
-    testSort3Vec();
-    testSort3Vec_pair();
-    testSort4Vec();
-    testSort4Vec_pair();
-    testSort5Vec();
-    testSort5Vec_pair();
-    testSort6Vec();
-    testSort6Vec_pair();
-    testSort7Vec();
-    testSort7Vec_pair();
-    testSort8Vec();
-    testSort8Vec_pair();
+        Sort512perm::GatherPermutation<int,size_t>(array.get(), permutation, res.get(), size);
+        assertNotEqual(res.get(), expected.get(), int(size), "GatherPermutation int");
 
-    testSort9Vec();
-    testSort9Vec_pair();
-    testSort10Vec();
-    testSort10Vec_pair();
-    testSort11Vec();
-    testSort11Vec_pair();
-    testSort12Vec();
-    testSort12Vec_pair();
-    testSort13Vec();
-    testSort13Vec_pair();
-    testSort14Vec();
-    testSort14Vec_pair();
-    testSort15Vec();
-    testSort15Vec_pair();
-    testSort16Vec();
-    testSort16Vec_pair();
+        Sort512perm::GatherPermutation<double,size_t>(values.get(), permutation, resValues.get(), size);
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            if(resValues[idxval] != expected[idxval]*100+1){
+                std::cout << "Error in GatherPermutation double at " << idxval << std::endl;
+                test_res = 1;
+            }
+        }
 
-    testSmallVecSort<int>();
-    testSmallVecSort<double>();
-    testSmallVecSort_pair<int>();
+        Sort512perm::InvertPermutation<size_t>(permutation, res.get(), size);
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            if(permutation[res[idxval]] != int(idxval)){
+                std::cout << "Error in InvertPermutation at " << idxval << std::endl;
+                test_res = 1;
+            }
+        }
 
-    testQs512<double>();
-    testQs512<int>();
-    testQs512_pair<int>();
+        memcpy(res.get(), array.get(), size*sizeof(int));
+        Sort512perm::ApplyPermutation(permutation, size, res.get());
+        assertNotEqual(res.get(), expected.get(), int(size), "ApplyPermutation");
 
-    testPartition<int>();
-    testPartition<double>();
-    testPartition_pair<int>();
+        memcpy(res.get(), array.get(), size*sizeof(int));
+        memcpy(resValues.get(), values.get(), size*sizeof(double));
+        Sort512perm::ApplyPermutation(permutation, size, res.get(), resValues.get());
+        assertNotEqual(res.get(), expected.get(), int(size), "ApplyPermutation multi");
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            if(resValues[idxval] != res[idxval]*100+1){
+                std::cout << "Error in ApplyPermutation multi, pair/key do not match" << std::endl;
+                test_res = 1;
+            }
+        }
+#if defined(_OPENMP)
+        Sort512perm::GatherPermutationOmp<int,size_t>(array.get(), permutation, res.get(), size);
+        assertNotEqual(res.get(), expected.get(), int(size), "GatherPermutationOmp");
+
+        Sort512perm::InvertPermutationOmp<size_t>(permutation, res.get(), size);
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            if(permutation[res[idxval]] != int(idxval)){
+                std::cout << "Error in InvertPermutationOmp at " << idxval << std::endl;
+                test_res = 1;
+            }
+        }
+
+        memcpy(res.get(), array.get(), size*sizeof(int));
+        memcpy(resValues.get(), values.get(), size*sizeof(double));
+        Sort512perm::ApplyPermutationOmp(permutation, size, res.get(), resValues.get());
+        assertNotEqual(res.get(), expected.get(), int(size), "ApplyPermutationOmp");
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            if(resValues[idxval] != res[idxval]*100+1){
+                std::cout << "Error in ApplyPermutationOmp, pair/key do not match" << std::endl;
+                test_res = 1;
+            }
+        }
+#endif
+    };
+
+    for(size_t idx = 1 ; idx <= 300 ; ++idx){
+        std::unique_ptr<int[]> permutation(new int[idx]);
+        createRandPermutation(permutation.get(), idx);
+        testOne(permutation.get(), idx);
+    }
+    for(size_t idx = 512 ; idx <= (1<<16); idx *= 2){
+        std::cout << "   " << idx << std::endl;
+        std::unique_ptr<int[]> permutation(new int[idx+7]);
+        createRandPermutation(permutation.get(), idx+7);
+        testOne(permutation.get(), idx+7);
+        // A single cycle
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            permutation[idxval] = int((idxval+1)%idx);
+        }
+        testOne(permutation.get(), idx);
+        // Identity
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            permutation[idxval] = int(idxval);
+        }
+        testOne(permutation.get(), idx);
+    }
+}
+
+
+template <class NumType>
+void testRank(){
+    std::cout << "Start testRank...\n";
+    const Sort512::RankMethod methods[4] = {Sort512::RankMethod::Ordinal, Sort512::RankMethod::Dense,
+                                            Sort512::RankMethod::Min, Sort512::RankMethod::Average};
+    auto testOne = [&methods](const NumType keys[], const size_t size){
+        // Scalar reference from a stable sort of the positions
+        std::unique_ptr<size_t[]> order(new size_t[size]);
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            order[idxval] = idxval;
+        }
+        std::stable_sort(order.get(), order.get()+size, [&](const size_t i1, const size_t i2){
+            return keys[i1] < keys[i2];
+        });
+        std::unique_ptr<double[]> expected(new double[4*size]);
+        size_t nbGroups = 0;
+        for(size_t first = 0 ; first < size ; ){
+            size_t last = first + 1;
+            while(last < size && keys[order[last]] == keys[order[first]]){
+                last += 1;
+            }
+            nbGroups += 1;
+            for(size_t idxval = first ; idxval < last ; ++idxval){
+                expected[0*size + order[idxval]] = double(idxval+1);
+                expected[1*size + order[idxval]] = double(nbGroups);
+                expected[2*size + order[idxval]] = double(first+1);
+                expected[3*size + order[idxval]] = double(first+1+last)/2;
+            }
+            first = last;
+        }
+
+        std::unique_ptr<double[]> ranks(new double[size]);
+        for(int idxMethod = 0 ; idxMethod < 4 ; ++idxMethod){
+            Sort512::Rank<NumType,size_t>(keys, ranks.get(), size, methods[idxMethod]);
+            assertNotEqual(ranks.get(), &expected[idxMethod*size], int(size), "Rank");
+        }
+    };
+
+    for(size_t idx = 1 ; idx <= 300 ; ++idx){
+        std::unique_ptr<NumType[]> keys(new NumType[idx]);
+        createRandVec(keys.get(), idx);
+        testOne(keys.get(), idx);
+        // Many equal keys including the greatest value
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = (idxval % 7 == 0 ? std::numeric_limits<NumType>::max() : NumType(int(keys[idxval])%5));
+        }
+        testOne(keys.get(), idx);
+    }
+    for(size_t idx = 512 ; idx <= (1<<16); idx *= 2){
+        std::cout << "   " << idx << std::endl;
+        std::unique_ptr<NumType[]> keys(new NumType[idx+3]);
+        createRandVec(keys.get(), idx+3);
+        testOne(keys.get(), idx+3);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = NumType(int(keys[idxval])/16);
+        }
+        testOne(keys.get(), idx);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = NumType(1);
+        }
+        testOne(keys.get(), idx);
+    }
+}
+
+
+template <class NumType>
+void testSortUnique(){
+    std::cout << "Start testSortUnique...\n";
+    auto testOne = [](const NumType keys[], const size_t size){
+        std::unique_ptr<NumType[]> expected(new NumType[size]);
+        std::copy(keys, keys+size, expected.get());
+        std::sort(expected.get(), expected.get()+size);
+        const size_t nbExpected = size_t(std::unique(expected.get(), expected.get()+size) - expected.get());
+
+        std::unique_ptr<NumType[]> array(new NumType[size]);
+        std::copy(keys, keys+size, array.get());
+        const size_t nbUnique = Sort512::SortUnique<NumType,size_t>(array.get(), size);
+        if(nbUnique != nbExpected){
+            std::cout << "Error in SortUnique, " << nbUnique << " unique values instead of " << nbExpected << std::endl;
+            test_res = 1;
+            return;
+        }
+        assertNotEqual(array.get(), expected.get(), int(nbUnique), "SortUnique");
+
+        // The value is the position of the pair in the original array
+        std::unique_ptr<NumType[]> values(new NumType[size]);
+        for(int idxKeep = 0 ; idxKeep < 2 ; ++idxKeep){
+            const Sort512kv::KeepValue keep = (idxKeep == 0 ? Sort512kv::KeepValue::First : Sort512kv::KeepValue::Last);
+            std::copy(keys, keys+size, array.get());
+            for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                values[idxval] = NumType(idxval);
+            }
+            const size_t nbUniquekv = Sort512kv::SortUnique<NumType,size_t>(array.get(), values.get(), size, keep);
+            if(nbUniquekv != nbExpected){
+                std::cout << "Error in SortUnique kv, " << nbUniquekv << " unique values instead of " << nbExpected << std::endl;
+                test_res = 1;
+                return;
+            }
+            assertNotEqual(array.get(), expected.get(), int(nbUniquekv), "SortUnique kv");
+            for(size_t idxval = 0 ; idxval < nbUniquekv ; ++idxval){
+                const size_t position = size_t(values[idxval]);
+                const NumType* found = (idxKeep == 0 ? std::find(keys, keys+size, array[idxval])
+                                                     : std::find(std::reverse_iterator<const NumType*>(keys+size),
+                                                                 std::reverse_iterator<const NumType*>(keys),
+                                                                 array[idxval]).base() - 1);
+                if(position != size_t(found - keys)){
+                    std::cout << "Error in SortUnique kv, wrong value kept for key " << array[idxval] << std::endl;
+                    test_res = 1;
+                }
+            }
+        }
+    };
+
+    for(size_t idx = 1 ; idx <= 300 ; ++idx){
+        std::unique_ptr<NumType[]> keys(new NumType[idx]);
+        createRandVec(keys.get(), idx);
+        testOne(keys.get(), idx);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = (idxval % 7 == 0 ? std::numeric_limits<NumType>::max() : NumType(int(keys[idxval])%5));
+        }
+        testOne(keys.get(), idx);
+    }
+    for(size_t idx = 512 ; idx <= (1<<16); idx *= 2){
+        std::cout << "   " << idx << std::endl;
+        std::unique_ptr<NumType[]> keys(new NumType[idx+5]);
+        createRandVec(keys.get(), idx+5);
+        testOne(keys.get(), idx+5);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = NumType(int(keys[idxval])/32);
+        }
+        testOne(keys.get(), idx);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = NumType(3);
+        }
+        testOne(keys.get(), idx);
+    }
+}
+
+
+template <class NumType>
+void testSortRunLength(){
+    std::cout << "Start testSortRunLength...\n";
+    auto testOne = [](const NumType source[], const size_t size){
+        std::unique_ptr<NumType[]> sorted(new NumType[size]);
+        std::copy(source, source+size, sorted.get());
+        std::sort(sorted.get(), sorted.get()+size);
+        std::unique_ptr<NumType[]> expectedKeys(new NumType[size]);
+        std::unique_ptr<int[]> expectedCounts(new int[size]);
+        size_t nbExpected = 0;
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            if(idxval == 0 || sorted[idxval] != sorted[idxval-1]){
+                expectedKeys[nbExpected] = sorted[idxval];
+                expectedCounts[nbExpected] = 0;
+                nbExpected += 1;
+            }
+            expectedCounts[nbExpected-1] += 1;
+        }
+
+        std::unique_ptr<NumType[]> array(new NumType[size]);
+        std::unique_ptr<NumType[]> keys(new NumType[size]);
+        std::unique_ptr<int[]> counts(new int[size]);
+        for(int idxOutput = 0 ; idxOutput < 2 ; ++idxOutput){
+            std::copy(source, source+size, array.get());
+            // The distinct values can be written in the input array
+            NumType* outputKeys = (idxOutput == 0 ? keys.get() : array.get());
+            const size_t nbDistinct = Sort512::SortRunLength<NumType,size_t>(array.get(), size, outputKeys, counts.get());
+            if(nbDistinct != nbExpected){
+                std::cout << "Error in SortRunLength, " << nbDistinct << " distinct values instead of " << nbExpected << std::endl;
+                test_res = 1;
+                return;
+            }
+            assertNotEqual(outputKeys, expectedKeys.get(), int(nbDistinct), "SortRunLength keys");
+            assertNotEqual(counts.get(), expectedCounts.get(), int(nbDistinct), "SortRunLength counts");
+        }
+    };
+
+    for(size_t idx = 1 ; idx <= 300 ; ++idx){
+        std::unique_ptr<NumType[]> keys(new NumType[idx]);
+        createRandVec(keys.get(), idx);
+        testOne(keys.get(), idx);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = NumType(int(keys[idxval])%5);
+        }
+        testOne(keys.get(), idx);
+    }
+    for(size_t idx = 512 ; idx <= (1<<16); idx *= 2){
+        std::cout << "   " << idx << std::endl;
+        std::unique_ptr<NumType[]> keys(new NumType[idx+5]);
+        createRandVec(keys.get(), idx+5);
+        testOne(keys.get(), idx+5);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = NumType(int(keys[idxval])%7);
+        }
+        testOne(keys.get(), idx);
+        for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+            keys[idxval] = NumType(-1);
+        }
+        testOne(keys.get(), idx);
+    }
+}
+
+
+template <class KeyType, class ValueType, class Operator>
+void testReduceByKey(){
+    std::cout << "Start testReduceByKey...\n";
+    auto testOne = [](const KeyType sourceKeys[], const ValueType sourceValues[], const size_t size){
+        // Scalar reference from a stable sort
+        std::unique_ptr<size_t[]> order(new size_t[size]);
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            order[idxval] = idxval;
+        }
+        std::stable_sort(order.get(), order.get()+size, [&](const size_t i1, const size_t i2){
+            return sourceKeys[i1] < sourceKeys[i2];
+        });
+        std::unique_ptr<KeyType[]> expectedKeys(new KeyType[size]);
+        std::unique_ptr<ValueType[]> expectedValues(new ValueType[size]);
+        size_t nbExpected = 0;
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            const size_t pos = order[idxval];
+            if(nbExpected && expectedKeys[nbExpected-1] == sourceKeys[pos]){
+                expectedValues[nbExpected-1] = Operator::Apply(expectedValues[nbExpected-1], sourceValues[pos]);
+            }
+            else{
+                expectedKeys[nbExpected] = sourceKeys[pos];
+                expectedValues[nbExpected] = sourceValues[pos];
+                nbExpected += 1;
+            }
+        }
+
+        std::unique_ptr<KeyType[]> keys(new KeyType[size]);
+        std::unique_ptr<ValueType[]> values(new ValueType[size]);
+        std::copy(sourceKeys, sourceKeys+size, keys.get());
+        std::copy(sourceValues, sourceValues+size, values.get());
+        size_t nbKeys = Sort512kv::ReduceByKey(keys.get(), values.get(), size, Operator());
+        if(nbKeys != nbExpected){
+            std::cout << "Error in ReduceByKey, " << nbKeys << " keys instead of " << nbExpected << std::endl;
+            test_res = 1;
+            return;
+        }
+        assertNotEqual(keys.get(), expectedKeys.get(), int(nbKeys), "ReduceByKey keys");
+        assertNotEqual(values.get(), expectedValues.get(), int(nbKeys), "ReduceByKey values");
+#if defined(_OPENMP)
+        std::copy(sourceKeys, sourceKeys+size, keys.get());
+        std::copy(sourceValues, sourceValues+size, values.get());
+        nbKeys = Sort512kv::ReduceByKeyOmp(keys.get(), values.get(), size, Operator());
+        if(nbKeys != nbExpected){
+            std::cout << "Error in ReduceByKeyOmp, " << nbKeys << " keys instead of " << nbExpected << std::endl;
+            test_res = 1;
+            return;
+        }
+        assertNotEqual(keys.get(), expectedKeys.get(), int(nbKeys), "ReduceByKeyOmp keys");
+        assertNotEqual(values.get(), expectedValues.get(), int(nbKeys), "ReduceByKeyOmp values");
+#endif
+    };
+
+    for(size_t idx = 1 ; idx <= (1<<16) ; idx = (idx < 300 ? idx + 1 : idx * 2 + 3)){
+        if(idx > 300) std::cout << "   " << idx << std::endl;
+        std::unique_ptr<KeyType[]> keys(new KeyType[idx]);
+        std::unique_ptr<ValueType[]> values(new ValueType[idx]);
+        // Small integers are used such that the sums are exact
+        for(int nbDistinct : {1, 7, int(idx)}){
+            for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+                keys[idxval] = KeyType(int(drand48()*double(nbDistinct)));
+                values[idxval] = ValueType(int(drand48()*100.) - 50);
+            }
+            testOne(keys.get(), values.get(), idx);
+        }
+    }
+}
+
+
+void testJoin(){
+    std::cout << "Start testJoin...\n";
+    auto testOne = [](const int sourceLeftKeys[], const size_t leftSize,
+                      const int sourceRightKeys[], const size_t rightSize,
+                      const Sort512join::JoinType type){
+        // The values are the positions, the reference uses a sorted copy of the right side
+        std::vector<std::pair<int,int>> expected;
+        {
+            std::vector<std::pair<int,int>> right;
+            for(size_t idxval = 0 ; idxval < rightSize ; ++idxval){
+                right.emplace_back(sourceRightKeys[idxval], int(idxval));
+            }
+            std::sort(right.begin(), right.end());
+            for(size_t idxval = 0 ; idxval < leftSize ; ++idxval){
+                auto iter = std::lower_bound(right.begin(), right.end(), std::make_pair(sourceLeftKeys[idxval], INT_MIN));
+                if(iter == right.end() || iter->first != sourceLeftKeys[idxval]){
+                    if(type == Sort512join::JoinType::LeftOuter){
+                        expected.emplace_back(int(idxval), -1);
+                    }
+                }
+                for( ; iter != right.end() && iter->first == sourceLeftKeys[idxval] ; ++iter){
+                    expected.emplace_back(int(idxval), iter->second);
+                }
+            }
+            std::sort(expected.begin(), expected.end());
+        }
+
+        for(int useOmp = 0 ; useOmp < 2 ; ++useOmp){
+            std::unique_ptr<int[]> leftKeys(new int[leftSize+1]);
+            std::unique_ptr<int[]> leftValues(new int[leftSize+1]);
+            std::unique_ptr<int[]> rightKeys(new int[rightSize+1]);
+            std::unique_ptr<int[]> rightValues(new int[rightSize+1]);
+            for(size_t idxval = 0 ; idxval < leftSize ; ++idxval){
+                leftKeys[idxval] = sourceLeftKeys[idxval];
+                leftValues[idxval] = int(idxval);
+            }
+            for(size_t idxval = 0 ; idxval < rightSize ; ++idxval){
+                rightKeys[idxval] = sourceRightKeys[idxval];
+                rightValues[idxval] = int(idxval);
+            }
+            std::vector<int> outLeft;
+            std::vector<int> outRight;
+            if(useOmp == 0){
+                Sort512join::SortMergeJoin(leftKeys.get(), leftValues.get(), leftSize,
+                                           rightKeys.get(), rightValues.get(), rightSize,
+                                           outLeft, outRight, type, -1);
+            }
+            else{
+#if defined(_OPENMP)
+                Sort512join::SortMergeJoinOmp(leftKeys.get(), leftValues.get(), leftSize,
+                                              rightKeys.get(), rightValues.get(), rightSize,
+                                              outLeft, outRight, type, -1);
+#else
+                continue;
+#endif
+            }
+
+            std::vector<std::pair<int,int>> result;
+            for(size_t idxval = 0 ; idxval < outLeft.size() ; ++idxval){
+                result.emplace_back(outLeft[idxval], outRight[idxval]);
+            }
+            std::sort(result.begin(), result.end());
+            if(outLeft.size() != outRight.size() || result != expected){
+                std::cout << "Error in " << (useOmp ? "SortMergeJoinOmp" : "SortMergeJoin")
+                          << ", " << result.size() << " pairs instead of " << expected.size()
+                          << " (sizes " << leftSize << " and " << rightSize << ")" << std::endl;
+                test_res = 1;
+                return;
+            }
+        }
+    };
+
+    for(size_t idx = 1 ; idx <= (1<<16) ; idx = (idx < 300 ? idx + 1 : idx * 2 + 3)){
+        if(idx > 300) std::cout << "   " << idx << std::endl;
+        for(size_t rightSize : {size_t(0), size_t(1), idx/3 + 1, idx, idx*2 + 5}){
+            std::unique_ptr<int[]> leftKeys(new int[idx]);
+            std::unique_ptr<int[]> rightKeys(new int[rightSize]);
+            // Few distinct keys are used only on small sizes to limit the number of pairs
+            for(int nbDistinct : {3, 17, int(idx), int(idx)*4}){
+                if(nbDistinct < 300 && idx > 300) continue;
+                // The greatest key must keep its values (it is the padding of the small sorts)
+                for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+                    leftKeys[idxval] = int(drand48()*double(nbDistinct));
+                    if(leftKeys[idxval] == nbDistinct-1) leftKeys[idxval] = INT_MAX;
+                }
+                for(size_t idxval = 0 ; idxval < rightSize ; ++idxval){
+                    rightKeys[idxval] = int(drand48()*double(nbDistinct));
+                    if(rightKeys[idxval] == nbDistinct-1) rightKeys[idxval] = INT_MAX;
+                }
+                testOne(leftKeys.get(), idx, rightKeys.get(), rightSize, Sort512join::JoinType::Inner);
+                testOne(leftKeys.get(), idx, rightKeys.get(), rightSize, Sort512join::JoinType::LeftOuter);
+            }
+        }
+    }
+}
+
+template <class SortType>
+void testSetOperations(){
+    std::cout << "Start testSetOperations...\n";
+    auto testOne = [](const std::vector<SortType>& array1, const std::vector<SortType>& array2){
+        std::vector<SortType> expected(array1.size() + array2.size());
+        std::vector<SortType> result(array1.size() + array2.size() + 1);
+
+        typedef size_t (*SetFunc)(const SortType[], const size_t, const SortType[], const size_t, SortType[]);
+        struct SetOperation {
+            const char* name;
+            SetFunc func;
+            int kind;
+        };
+        std::vector<SetOperation> operations = {
+            {"Intersection", Sort512set::Intersection<SortType,size_t>, 0},
+            {"Union", Sort512set::Union<SortType,size_t>, 1},
+            {"Difference", Sort512set::Difference<SortType,size_t>, 2},
+#if defined(_OPENMP)
+            {"IntersectionOmp", Sort512set::IntersectionOmp<SortType,size_t>, 0},
+            {"UnionOmp", Sort512set::UnionOmp<SortType,size_t>, 1},
+            {"DifferenceOmp", Sort512set::DifferenceOmp<SortType,size_t>, 2},
+#endif
+        };
+        for(const SetOperation& operation : operations){
+            size_t nbExpected = 0;
+            if(operation.kind == 0){
+                nbExpected = size_t(std::set_intersection(array1.begin(), array1.end(), array2.begin(), array2.end(),
+                                                          expected.begin()) - expected.begin());
+            }
+            else if(operation.kind == 1){
+                nbExpected = size_t(std::set_union(array1.begin(), array1.end(), array2.begin(), array2.end(),
+                                                   expected.begin()) - expected.begin());
+            }
+            else{
+                nbExpected = size_t(std::set_difference(array1.begin(), array1.end(), array2.begin(), array2.end(),
+                                                        expected.begin()) - expected.begin());
+            }
+            const size_t nbResult = operation.func(array1.data(), array1.size(), array2.data(), array2.size(), result.data());
+            if(nbResult != nbExpected){
+                std::cout << "Error in " << operation.name << ", " << nbResult << " values instead of " << nbExpected
+                          << " (sizes " << array1.size() << " and " << array2.size() << ")" << std::endl;
+                test_res = 1;
+                return;
+            }
+            assertNotEqual(result.data(), expected.data(), int(nbResult), operation.name);
+        }
+    };
+
+    // Sorted values without duplicates taken in [0, range[
+    auto randomSet = [](const size_t size, const size_t range){
+        std::vector<SortType> values(size);
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            values[idxval] = SortType(drand48()*double(range)) - SortType(range/2);
+        }
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        return values;
+    };
+
+    for(size_t idx = 1 ; idx <= (1<<16) ; idx = (idx < 300 ? idx + 1 : idx * 2 + 3)){
+        if(idx > 300) std::cout << "   " << idx << std::endl;
+        for(size_t size2 : {size_t(0), size_t(1), idx/50 + 1, idx/3 + 1, idx, idx*2 + 5, idx*40}){
+            // The overlap goes from almost identical arrays to almost disjoint arrays
+            for(size_t range : {idx + size2 + 1, 2*(idx + size2) + 1, 10*(idx + size2) + 1}){
+                testOne(randomSet(idx, range), randomSet(size2, range));
+                testOne(randomSet(size2, range), randomSet(idx, range));
+            }
+        }
+    }
+
+    // Consecutive ranges, disjoint or sharing one value, with few values on one side
+    for(size_t size : {size_t(17), size_t(1000), size_t(50000)}){
+        for(size_t shift : {size - 1, size}){
+            for(size_t size2 : {size_t(3), size}){
+                std::vector<SortType> array1(size);
+                std::vector<SortType> array2(size2);
+                for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                    array1[idxval] = SortType(idxval);
+                }
+                for(size_t idxval = 0 ; idxval < size2 ; ++idxval){
+                    array2[idxval] = SortType(shift + idxval);
+                }
+                testOne(array1, array2);
+                testOne(array2, array1);
+            }
+        }
+    }
+
+    // Extreme values
+    {
+        std::vector<SortType> array1;
+        std::vector<SortType> array2;
+        for(SortType idxval = 0 ; idxval < 40 ; ++idxval){
+            array1.push_back(std::numeric_limits<SortType>::min() + idxval*2);
+            array2.push_back(std::numeric_limits<SortType>::min() + idxval*3);
+        }
+        for(SortType idxval = 40 ; idxval > 0 ; --idxval){
+            array1.push_back(std::numeric_limits<SortType>::max() - idxval*2 + 1);
+            array2.push_back(std::numeric_limits<SortType>::max() - idxval*3 + 1);
+        }
+        testOne(array1, array2);
+    }
+}
+
+template <class SortType>
+void testMergeCompact(){
+    std::cout << "Start testMergeCompact...\n";
+    // Sorted distinct keys taken in [0, range[, the values tell the run and the position
+    auto randomRun = [](const size_t size, const size_t range, const SortType runValue,
+                        std::vector<SortType>& keys, std::vector<SortType>& values){
+        keys.resize(size);
+        for(size_t idxval = 0 ; idxval < size ; ++idxval){
+            keys[idxval] = SortType(int(drand48()*double(range)));
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        values.resize(keys.size());
+        for(size_t idxval = 0 ; idxval < keys.size() ; ++idxval){
+            values[idxval] = runValue + SortType(idxval);
+        }
+    };
+
+    for(size_t idx = 1 ; idx <= (1<<16) ; idx = (idx < 300 ? idx + 1 : idx * 2 + 3)){
+        if(idx > 300) std::cout << "   " << idx << std::endl;
+        for(size_t newSize : {size_t(0), size_t(1), idx/10 + 1, idx, idx*3 + 5}){
+            for(size_t range : {idx + newSize + 1, 4*(idx + newSize) + 1}){
+                for(bool shifted : {false, true}){
+                    std::vector<SortType> oldKeys, oldValues, newKeys, newValues;
+                    randomRun(idx, range, SortType(0), oldKeys, oldValues);
+                    randomRun(newSize, range, SortType(1<<24), newKeys, newValues);
+                    // Shifted, all the new keys are after the old ones (the old run ends first)
+                    if(shifted){
+                        for(SortType& key : newKeys){
+                            key += SortType(range);
+                        }
+                    }
+
+                    std::vector<SortType> expectedKeys;
+                    std::vector<SortType> expectedValues;
+                    {
+                        size_t idxOld = 0;
+                        size_t idxNew = 0;
+                        while(idxOld != oldKeys.size() || idxNew != newKeys.size()){
+                            if(idxNew == newKeys.size() || (idxOld != oldKeys.size() && oldKeys[idxOld] < newKeys[idxNew])){
+                                expectedKeys.push_back(oldKeys[idxOld]);
+                                expectedValues.push_back(oldValues[idxOld]);
+                                idxOld += 1;
+                            }
+                            else{
+                                if(idxOld != oldKeys.size() && oldKeys[idxOld] == newKeys[idxNew]){
+                                    idxOld += 1;
+                                }
+                                expectedKeys.push_back(newKeys[idxNew]);
+                                expectedValues.push_back(newValues[idxNew]);
+                                idxNew += 1;
+                            }
+                        }
+                    }
+
+                    std::vector<SortType> outKeys(oldKeys.size() + newKeys.size());
+                    std::vector<SortType> outValues(oldKeys.size() + newKeys.size());
+                    const size_t nbOut = Sort512kv::MergeCompact(oldKeys.data(), oldValues.data(), oldKeys.size(),
+                                                                 newKeys.data(), newValues.data(), newKeys.size(),
+                                                                 outKeys.data(), outValues.data());
+                    if(nbOut != expectedKeys.size()){
+                        std::cout << "Error in MergeCompact, " << nbOut << " pairs instead of " << expectedKeys.size() << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                    assertNotEqual(outKeys.data(), expectedKeys.data(), int(nbOut), "MergeCompact keys");
+                    assertNotEqual(outValues.data(), expectedValues.data(), int(nbOut), "MergeCompact values");
+                }
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testMerge(){
+    std::cout << "Start testMerge...\n";
+    for(size_t idx = 1 ; idx <= (1<<16) ; idx = (idx < 300 ? idx + 1 : idx * 2 + 3)){
+        if(idx > 300) std::cout << "   " << idx << std::endl;
+        for(size_t size2 : {size_t(0), size_t(1), idx/7 + 1, idx, idx*3 + 5}){
+            for(size_t range : {size_t(5), idx + size2}){
+                const size_t total = idx + size2;
+                std::unique_ptr<NumType[]> array(new NumType[total]);
+                std::unique_ptr<NumType[]> values(new NumType[total]);
+                for(size_t idxval = 0 ; idxval < total ; ++idxval){
+                    array[idxval] = NumType(int(drand48()*double(range)));
+                    // The greatest value must be kept by the networks
+                    if(drand48() < 0.02){
+                        array[idxval] = std::numeric_limits<NumType>::max();
+                    }
+                    values[idxval] = NumType(idxval);
+                }
+                std::sort(&array[0], &array[idx]);
+                std::sort(&array[idx], &array[total]);
+
+                std::unique_ptr<NumType[]> expected(new NumType[total]);
+                std::merge(&array[0], &array[idx], &array[idx], &array[total], expected.get());
+
+                // Out of place
+                {
+                    std::unique_ptr<NumType[]> res(new NumType[total]);
+                    Sort512::Merge<NumType,size_t>(&array[0], idx, &array[idx], size2, res.get());
+                    assertNotEqual(res.get(), expected.get(), int(total), "Merge");
+                }
+                // In place with the second part
+                {
+                    std::unique_ptr<NumType[]> res(new NumType[total]);
+                    std::unique_ptr<NumType[]> buffer(new NumType[idx]);
+                    std::copy(&array[0], &array[total], res.get());
+                    Sort512::CoreMergeInPlace<NumType,size_t>(res.get(), 0, idx, total, buffer.get());
+                    assertNotEqual(res.get(), expected.get(), int(total), "CoreMergeInPlace");
+                }
+                // Pairs in place with the second part, each value gives the position of its key in array
+                {
+                    std::unique_ptr<NumType[]> resKeys(new NumType[total]);
+                    std::unique_ptr<NumType[]> resValues(new NumType[total]);
+                    std::copy(&array[0], &array[total], resKeys.get());
+                    std::copy(&values[0], &values[total], resValues.get());
+                    Sort512kv::Merge<NumType,size_t>(&array[0], &values[0], idx, &resKeys[idx], &resValues[idx], size2,
+                                                     resKeys.get(), resValues.get());
+                    assertNotEqual(resKeys.get(), expected.get(), int(total), "kv Merge keys");
+                    std::vector<bool> seen(total, false);
+                    for(size_t idxval = 0 ; idxval < total ; ++idxval){
+                        const size_t pos = size_t(resValues[idxval]);
+                        if(pos >= total || seen[pos] || array[pos] != resKeys[idxval]){
+                            std::cout << "Error in kv Merge, the value " << resValues[idxval] << " is not correct" << std::endl;
+                            test_res = 1;
+                            return;
+                        }
+                        seen[pos] = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testReorderShifting(){
+#if defined(_OPENMP)
+    std::cout << "Start testReorderShifting...\n";
+    auto testOne = [](const int lengthLeftPart, const int totalSize){
+        std::unique_ptr<NumType[]> array(new NumType[totalSize]);
+        std::unique_ptr<NumType[]> expected(new NumType[totalSize]);
+        for(int idxval = 0 ; idxval < totalSize ; ++idxval){
+            array[idxval] = NumType(idxval);
+            expected[idxval] = NumType(idxval);
+        }
+        std::rotate(expected.get(), expected.get() + lengthLeftPart, expected.get() + totalSize);
+        ParallelInplace::reorderShifting(array.get(), lengthLeftPart, totalSize);
+        assertNotEqual(array.get(), expected.get(), totalSize, "reorderShifting");
+    };
+
+    for(int idx = 1 ; idx <= 300 ; ++idx){
+        for(int lengthLeftPart = 0 ; lengthLeftPart <= idx ; ++lengthLeftPart){
+            testOne(lengthLeftPart, idx);
+        }
+    }
+    for(int idx = 512 ; idx <= (1<<20) ; idx = idx * 2 + 7){
+        std::cout << "   " << idx << std::endl;
+        for(int lengthLeftPart : {1, 7, 16, 33, idx/3, idx/2, idx - 17, idx - 1}){
+            testOne(lengthLeftPart, idx);
+        }
+    }
+#endif
+}
+
+template <class NumType>
+void testMergeKWay(){
+    std::cout << "Start testMergeKWay...\n";
+    for(int nbRuns : {1, 2, 3, 5, 16, 17, 64, 257, 1024}){
+        for(size_t maxRunSize : {size_t(1), size_t(20), size_t(300), size_t(5000)}){
+            if(size_t(nbRuns)*maxRunSize > (1<<20)) continue;
+            for(size_t range : {size_t(5), size_t(nbRuns)*maxRunSize}){
+                std::vector<size_t> sizes(nbRuns);
+                std::vector<size_t> offsets(nbRuns+1, 0);
+                for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+                    sizes[idxRun] = size_t(drand48()*double(maxRunSize + 1));
+                    offsets[idxRun+1] = offsets[idxRun] + sizes[idxRun];
+                }
+                const size_t total = offsets[nbRuns];
+                std::unique_ptr<NumType[]> array(new NumType[total]);
+                std::unique_ptr<NumType[]> values(new NumType[total]);
+                for(size_t idxval = 0 ; idxval < total ; ++idxval){
+                    array[idxval] = NumType(int(drand48()*double(range)));
+                    // The greatest values must not be taken for the padding
+                    if(drand48() < 0.01){
+                        array[idxval] = std::numeric_limits<NumType>::max();
+                    }
+                    else if(std::numeric_limits<NumType>::has_infinity && drand48() < 0.005){
+                        array[idxval] = std::numeric_limits<NumType>::infinity();
+                    }
+                    values[idxval] = NumType(idxval);
+                }
+                std::vector<const NumType*> runs(nbRuns);
+                std::vector<const NumType*> runValues(nbRuns);
+                for(int idxRun = 0 ; idxRun < nbRuns ; ++idxRun){
+                    std::sort(&array[offsets[idxRun]], &array[offsets[idxRun+1]]);
+                    runs[idxRun] = &array[offsets[idxRun]];
+                    runValues[idxRun] = &values[offsets[idxRun]];
+                }
+                std::unique_ptr<NumType[]> expected(new NumType[total]);
+                std::copy(&array[0], &array[total], expected.get());
+                std::sort(expected.get(), expected.get() + total);
+
+                std::unique_ptr<NumType[]> res(new NumType[total]);
+                Sort512::MergeKWay<NumType,size_t>(runs.data(), sizes.data(), nbRuns, res.get());
+                assertNotEqual(res.get(), expected.get(), int(total), "MergeKWay");
+#if defined(_OPENMP)
+                std::fill(res.get(), res.get() + total, NumType(0));
+                Sort512::MergeKWayOmp<NumType,size_t>(runs.data(), sizes.data(), nbRuns, res.get());
+                assertNotEqual(res.get(), expected.get(), int(total), "MergeKWayOmp");
+#endif
+
+                // Pairs, each value gives the position of its key in array
+                for(int useOmp = 0 ; useOmp < 2 ; ++useOmp){
+                    std::unique_ptr<NumType[]> resKeys(new NumType[total]);
+                    std::unique_ptr<NumType[]> resValues(new NumType[total]);
+                    if(useOmp == 0){
+                        Sort512kv::MergeKWay<NumType,size_t>(runs.data(), runValues.data(), sizes.data(), nbRuns,
+                                                             resKeys.get(), resValues.get());
+                    }
+                    else{
+#if defined(_OPENMP)
+                        Sort512kv::MergeKWayOmp<NumType,size_t>(runs.data(), runValues.data(), sizes.data(), nbRuns,
+                                                                resKeys.get(), resValues.get());
+#else
+                        break;
+#endif
+                    }
+                    assertNotEqual(resKeys.get(), expected.get(), int(total), "kv MergeKWay keys");
+                    std::vector<bool> seen(total, false);
+                    for(size_t idxval = 0 ; idxval < total ; ++idxval){
+                        const size_t pos = size_t(resValues[idxval]);
+                        if(pos >= total || seen[pos] || array[pos] != resKeys[idxval]){
+                            std::cout << "Error in kv MergeKWay, the value " << resValues[idxval] << " is not correct" << std::endl;
+                            test_res = 1;
+                            return;
+                        }
+                        seen[pos] = true;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testMergeInsert(){
+    std::cout << "Start testMergeInsert...\n";
+    std::vector<std::pair<size_t,size_t>> sizes;
+    for(size_t idx = 0 ; idx <= 200 ; idx = (idx < 40 ? idx + 1 : idx + 17)){
+        for(size_t batchSize : {size_t(0), size_t(1), size_t(7), size_t(16), size_t(33), size_t(150)}){
+            sizes.emplace_back(idx, batchSize);
+        }
+    }
+    sizes.emplace_back(100000, 1000);
+    sizes.emplace_back(1<<18, 1<<17);
+    sizes.emplace_back(1000, 1<<17);
+
+    for(const auto& sizeAndBatch : sizes){
+        const size_t size = sizeAndBatch.first;
+        const size_t batchSize = sizeAndBatch.second;
+        const size_t total = size + batchSize;
+        if(size > 300) std::cout << "   " << total << std::endl;
+        for(size_t range : {size_t(5), total + 1}){
+            std::unique_ptr<NumType[]> keys(new NumType[total]);
+            std::unique_ptr<NumType[]> values(new NumType[total]);
+            for(size_t idxval = 0 ; idxval < total ; ++idxval){
+                // One key in seven equals the padding of the small sorts
+                keys[idxval] = (idxval % 7 == 3 ? std::numeric_limits<NumType>::max()
+                                                : NumType(int(drand48()*double(range))));
+                values[idxval] = NumType(idxval);
+            }
+            std::sort(&keys[0], &keys[size]);
+            std::unique_ptr<NumType[]> expected(new NumType[total]);
+            std::copy(&keys[0], &keys[total], expected.get());
+            std::sort(expected.get(), expected.get() + total);
+
+            {
+                std::unique_ptr<NumType[]> res(new NumType[total]);
+                std::unique_ptr<NumType[]> batch(new NumType[batchSize]);
+                std::copy(&keys[0], &keys[size], res.get());
+                std::copy(&keys[size], &keys[total], batch.get());
+                Sort512::MergeInsert<NumType,size_t>(res.get(), size, batch.get(), batchSize);
+                assertNotEqual(res.get(), expected.get(), int(total), "MergeInsert");
+            }
+#if defined(_OPENMP)
+            {
+                std::unique_ptr<NumType[]> res(new NumType[total]);
+                std::unique_ptr<NumType[]> batch(new NumType[batchSize]);
+                std::copy(&keys[0], &keys[size], res.get());
+                std::copy(&keys[size], &keys[total], batch.get());
+                Sort512::MergeInsertOmp<NumType,size_t>(res.get(), size, batch.get(), batchSize);
+                assertNotEqual(res.get(), expected.get(), int(total), "MergeInsertOmp");
+            }
+#endif
+            // Pairs, each value gives the position of its key in keys
+            {
+                std::unique_ptr<NumType[]> resKeys(new NumType[total]);
+                std::unique_ptr<NumType[]> resValues(new NumType[total]);
+                std::unique_ptr<NumType[]> batchKeys(new NumType[batchSize]);
+                std::unique_ptr<NumType[]> batchValues(new NumType[batchSize]);
+                std::copy(&keys[0], &keys[size], resKeys.get());
+                std::copy(&values[0], &values[size], resValues.get());
+                std::copy(&keys[size], &keys[total], batchKeys.get());
+                std::copy(&values[size], &values[total], batchValues.get());
+                Sort512kv::MergeInsert<NumType,size_t>(resKeys.get(), resValues.get(), size,
+                                                       batchKeys.get(), batchValues.get(), batchSize);
+                assertNotEqual(resKeys.get(), expected.get(), int(total), "kv MergeInsert keys");
+                std::vector<bool> seen(total, false);
+                for(size_t idxval = 0 ; idxval < total ; ++idxval){
+                    const size_t pos = size_t(resValues[idxval]);
+                    if(pos >= total || seen[pos] || keys[pos] != resKeys[idxval]){
+                        std::cout << "Error in kv MergeInsert, the value " << resValues[idxval] << " is not correct" << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                    seen[pos] = true;
+                }
+            }
+        }
+    }
+}
+
+// The value at kth must be the one of the sorted array, the values before
+// are lower or equal and the values after are greater or equal
+template <class NumType>
+void assertNotSelected(const NumType array[], const NumType sorted[], const size_t size, const size_t kth,
+                       const std::string log){
+    if(array[kth] != sorted[kth]){
+        std::cout << "assertNotSelected -- " << log << " the value at " << kth << " is " << array[kth]
+                  << " should be " << sorted[kth] << std::endl;
+        test_res = 1;
+        return;
+    }
+    for(size_t idx = 0 ; idx < size ; ++idx){
+        if((idx < kth && array[kth] < array[idx]) || (kth < idx && array[idx] < array[kth])){
+            std::cout << "assertNotSelected -- " << log << " the value at " << idx << " is on the wrong side" << std::endl;
+            test_res = 1;
+            return;
+        }
+    }
+}
+
+template <class NumType>
+void testPartitionK(){
+    std::cout << "Start testPartitionK...\n";
+    for(size_t size = 0 ; size <= (1<<20) ; size = (size < 300 ? size + 1 : size * 3 + 7)){
+        if(size > 1000) std::cout << "   " << size << std::endl;
+        for(size_t nbBuckets : {size_t(1), size_t(2), size_t(5), size_t(16), size_t(17), size_t(32), size_t(33), size_t(200)}){
+            if(size < 300 && size % 7 != 0 && nbBuckets > 17){
+                continue;
+            }
+            // Values in a large or a small range (many equal to the splitters)
+            const size_t range = (size % 2 ? size*2 + 1 : nbBuckets + 3);
+            std::unique_ptr<NumType[]> array(new NumType[size]);
+            for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                array[idxval] = NumType(int(drand48()*double(range)));
+            }
+            std::unique_ptr<NumType[]> splitters(new NumType[nbBuckets]);
+            for(size_t idxSplitter = 0 ; idxSplitter + 1 < nbBuckets ; ++idxSplitter){
+                splitters[idxSplitter] = NumType(int(drand48()*double(range + 2))) - NumType(1);
+            }
+            std::sort(splitters.get(), splitters.get() + nbBuckets - 1);
+
+            std::unique_ptr<size_t[]> offsets(new size_t[nbBuckets + 1]);
+            auto check = [&](const NumType res[], const char* log){
+                if(offsets[0] != 0 || offsets[nbBuckets] != size){
+                    std::cout << "Error in " << log << ", the offsets do not cover the array" << std::endl;
+                    test_res = 1;
+                    return;
+                }
+                for(size_t idxBucket = 0 ; idxBucket < nbBuckets ; ++idxBucket){
+                    for(size_t idxval = offsets[idxBucket] ; idxval < offsets[idxBucket + 1] ; ++idxval){
+                        if((idxBucket != 0 && !(splitters[idxBucket - 1] < res[idxval]))
+                                || (idxBucket + 1 != nbBuckets && splitters[idxBucket] < res[idxval])){
+                            std::cout << "Error in " << log << ", " << res[idxval] << " at " << idxval
+                                      << " is not in the bucket " << idxBucket << std::endl;
+                            test_res = 1;
+                            return;
+                        }
+                    }
+                }
+            };
+
+            {
+                std::unique_ptr<NumType[]> output(new NumType[size]);
+                Sort512::Partition512KCopy<NumType,size_t>(array.get(), size, splitters.get(), nbBuckets,
+                                                           offsets.get(), output.get());
+                check(output.get(), "Partition512KCopy");
+                Checker<NumType> checker(array.get(), output.get(), size);
+            }
+            {
+                Checker<NumType> checker(array.get(), array.get(), size);
+                Sort512::Partition512K<NumType,size_t>(array.get(), size, splitters.get(), nbBuckets, offsets.get());
+                check(array.get(), "Partition512K");
+            }
+#if defined(_OPENMP)
+            {
+                for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                    array[idxval] = NumType(int(drand48()*double(range)));
+                }
+                Checker<NumType> checker(array.get(), array.get(), size);
+                Sort512::Partition512KOmp<NumType,size_t>(array.get(), size, splitters.get(), nbBuckets, offsets.get());
+                check(array.get(), "Partition512KOmp");
+            }
+#endif
+        }
+    }
+}
+
+template <class NumType>
+void testSearchSorted(){
+    std::cout << "Start testSearchSorted...\n";
+    for(size_t size = 0 ; size <= (1<<20) ; size = (size < 40 ? size + 1 : size * 3 + 7)){
+        if(size > 1000) std::cout << "   " << size << std::endl;
+        for(size_t range : {size_t(5), size*2 + 1}){
+            std::unique_ptr<NumType[]> sorted(new NumType[size]);
+            for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                sorted[idxval] = NumType(int(drand48()*double(range)));
+            }
+            std::sort(sorted.get(), sorted.get() + size);
+
+            for(size_t nbQueries : {size_t(0), size_t(1), size_t(15), size_t(100), size/2 + 3}){
+                // Values in the array, between and outside
+                std::unique_ptr<NumType[]> queries(new NumType[nbQueries]);
+                for(size_t idxQuery = 0 ; idxQuery < nbQueries ; ++idxQuery){
+                    queries[idxQuery] = NumType(drand48()*double(range + 4)) - NumType(2);
+                }
+                std::unique_ptr<size_t[]> expected(new size_t[nbQueries]);
+                std::unique_ptr<size_t[]> res(new size_t[nbQueries]);
+                auto check = [&](const char* log){
+                    for(size_t idxQuery = 0 ; idxQuery < nbQueries ; ++idxQuery){
+                        expected[idxQuery] = size_t(std::lower_bound(sorted.get(), sorted.get() + size, queries[idxQuery])
+                                                    - sorted.get());
+                        if(res[idxQuery] != expected[idxQuery]){
+                            std::cout << "Error in " << log << ", the position of " << queries[idxQuery] << " is "
+                                      << res[idxQuery] << " should be " << expected[idxQuery] << std::endl;
+                            test_res = 1;
+                            return;
+                        }
+                    }
+                };
+                Sort512::SearchSorted<NumType,size_t>(sorted.get(), size, queries.get(), nbQueries, res.get());
+                check("SearchSorted");
+
+                std::sort(queries.get(), queries.get() + nbQueries);
+                Sort512::SearchSortedMerge<NumType,size_t>(sorted.get(), size, queries.get(), nbQueries, res.get());
+                check("SearchSortedMerge");
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testNthElement(){
+    std::cout << "Start testNthElement...\n";
+    for(size_t idx = 1 ; idx <= (1<<20) ; idx = (idx < 1100 ? idx + 1 : idx * 2 + 3)){
+        if(idx > 1100) std::cout << "   " << idx << std::endl;
+        for(int pattern = 0 ; pattern < 5 ; ++pattern){
+            std::unique_ptr<NumType[]> array(new NumType[idx]);
+            std::unique_ptr<NumType[]> values(new NumType[idx]);
+            for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+                // Random, few distinct values, increasing, decreasing and
+                // one key in seven equal to the padding of the small sorts
+                array[idxval] = (pattern == 0 ? NumType(int(drand48()*double(idx))) :
+                                 pattern == 1 ? NumType(int(drand48()*4)) :
+                                 pattern == 2 ? NumType(idxval) :
+                                 pattern == 3 ? NumType(idx - idxval) :
+                                 idxval % 7 == 3 ? std::numeric_limits<NumType>::max() : NumType(int(drand48()*4)));
+                values[idxval] = NumType(idxval);
+            }
+            std::unique_ptr<NumType[]> sorted(new NumType[idx]);
+            std::copy(&array[0], &array[idx], sorted.get());
+            std::sort(sorted.get(), sorted.get() + idx);
+
+            for(size_t kth : {size_t(0), idx/2, idx-1, size_t(drand48()*double(idx))}){
+                std::unique_ptr<NumType[]> res(new NumType[idx]);
+                std::copy(&array[0], &array[idx], res.get());
+                Sort512::NthElement<NumType,size_t>(res.get(), idx, kth);
+                assertNotSelected(res.get(), sorted.get(), idx, kth, "NthElement");
+
+                std::unique_ptr<NumType[]> resValues(new NumType[idx]);
+                std::copy(&array[0], &array[idx], res.get());
+                std::copy(&values[0], &values[idx], resValues.get());
+                Sort512kv::NthElement<NumType,size_t>(res.get(), resValues.get(), idx, kth);
+                assertNotSelected(res.get(), sorted.get(), idx, kth, "kv NthElement");
+                for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+                    if(resValues[idxval] < 0 || idx <= size_t(resValues[idxval])
+                            || array[size_t(resValues[idxval])] != res[idxval]){
+                        std::cout << "Error in kv NthElement, pair/key do not match" << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testPartialSort(){
+    std::cout << "Start testPartialSort...\n";
+    for(size_t idx = 1 ; idx <= (1<<20) ; idx = (idx < 1100 ? idx + 7 : idx * 2 + 3)){
+        if(idx > 1100) std::cout << "   " << idx << std::endl;
+        for(size_t range : {size_t(4), idx}){
+            std::unique_ptr<NumType[]> array(new NumType[idx]);
+            std::unique_ptr<NumType[]> values(new NumType[idx]);
+            for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+                // With few distinct keys, one in seven equals the padding of the small sorts
+                array[idxval] = (range == 4 && idxval % 7 == 3 ? std::numeric_limits<NumType>::max()
+                                                               : NumType(int(drand48()*double(range))));
+                values[idxval] = NumType(idxval);
+            }
+            std::unique_ptr<NumType[]> sorted(new NumType[idx]);
+            std::copy(&array[0], &array[idx], sorted.get());
+            std::sort(sorted.get(), sorted.get() + idx);
+
+            for(size_t nbFirst : {size_t(0), size_t(1), size_t(1000), idx/3, idx}){
+                nbFirst = std::min(nbFirst, idx);
+                std::unique_ptr<NumType[]> res(new NumType[idx]);
+                {
+                    std::copy(&array[0], &array[idx], res.get());
+                    Checker<NumType> checker(array.get(), res.get(), idx);
+                    Sort512::PartialSort<NumType,size_t>(res.get(), idx, nbFirst);
+                    assertNotEqual(res.get(), sorted.get(), int(nbFirst), "PartialSort");
+                    for(size_t idxval = nbFirst ; nbFirst && idxval < idx ; ++idxval){
+                        if(res[idxval] < res[nbFirst-1]){
+                            std::cout << "Error in PartialSort, a lower value is after the first ones" << std::endl;
+                            test_res = 1;
+                            return;
+                        }
+                    }
+                }
+
+                std::unique_ptr<NumType[]> resValues(new NumType[idx]);
+                std::copy(&array[0], &array[idx], res.get());
+                std::copy(&values[0], &values[idx], resValues.get());
+                Sort512kv::PartialSort<NumType,size_t>(res.get(), resValues.get(), idx, nbFirst);
+                assertNotEqual(res.get(), sorted.get(), int(nbFirst), "kv PartialSort");
+                for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+                    if(resValues[idxval] < 0 || idx <= size_t(resValues[idxval])
+                            || array[size_t(resValues[idxval])] != res[idxval]){
+                        std::cout << "Error in kv PartialSort, pair/key do not match" << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testMultiSelect(){
+    std::cout << "Start testMultiSelect...\n";
+    for(size_t idx = 1 ; idx <= (1<<20) ; idx = (idx < 1100 ? idx + 13 : idx * 2 + 3)){
+        if(idx > 1100) std::cout << "   " << idx << std::endl;
+        for(int pattern = 0 ; pattern < 3 ; ++pattern){
+            std::unique_ptr<NumType[]> array(new NumType[idx]);
+            for(size_t idxval = 0 ; idxval < idx ; ++idxval){
+                array[idxval] = (pattern == 0 ? NumType(int(drand48()*double(idx))) :
+                                 pattern == 1 ? NumType(int(drand48()*4)) : NumType(idx - idxval));
+            }
+            std::unique_ptr<NumType[]> sorted(new NumType[idx]);
+            std::copy(&array[0], &array[idx], sorted.get());
+            std::sort(sorted.get(), sorted.get() + idx);
+
+            // Percentiles, duplicated ranks and ranks out of the array
+            std::vector<size_t> ranks = {idx/2, idx*9/10, idx*99/100, idx*999/1000, idx/2, idx + 3, 0};
+            for(int idxRank = 0 ; idxRank < 20 ; ++idxRank){
+                ranks.push_back(size_t(drand48()*double(idx)));
+            }
+            std::unique_ptr<NumType[]> res(new NumType[idx]);
+            std::copy(&array[0], &array[idx], res.get());
+            Sort512::MultiSelect<NumType,size_t>(res.get(), idx, ranks.data(), ranks.size());
+            for(size_t rank : ranks){
+                if(rank < idx){
+                    assertNotSelected(res.get(), sorted.get(), idx, rank, "MultiSelect");
+                }
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testTopK(){
+    std::cout << "Start testTopK...\n";
+    for(size_t k : {size_t(0), size_t(1), size_t(17), size_t(100), size_t(1000), size_t(3000)}){
+        for(size_t size : {size_t(0), size_t(10), size_t(2000), size_t(100000)}){
+            if(size > 1000) std::cout << "   " << size << std::endl;
+            for(size_t range : {size_t(10), size*4 + 1}){
+                std::unique_ptr<NumType[]> keys(new NumType[size]);
+                std::unique_ptr<NumType[]> values(new NumType[size]);
+                for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                    // A few keys equal the padding of the small sorts
+                    keys[idxval] = (idxval % 499 == 3 ? std::numeric_limits<NumType>::max()
+                                                      : NumType(int(drand48()*double(range))));
+                    values[idxval] = NumType(idxval);
+                }
+                std::unique_ptr<NumType[]> expected(new NumType[size]);
+                std::copy(&keys[0], &keys[size], expected.get());
+                std::sort(expected.get(), expected.get() + size, [](const NumType v1, const NumType v2){
+                    return v1 > v2;
+                });
+                const size_t nbExpected = std::min(k, size);
+
+                Sort512::TopK<NumType> topk(k);
+                Sort512kv::TopK<NumType> topkPairs(k);
+                // Values pushed one by one and in batches of different sizes
+                for(size_t idxval = 0 ; idxval < size ; ){
+                    const size_t nbToPush = std::min(size - idxval, size_t(drand48()*200) + 1);
+                    if(nbToPush < 5){
+                        for(size_t idxPush = idxval ; idxPush < idxval + nbToPush ; ++idxPush){
+                            topk.push(keys[idxPush]);
+                            topkPairs.push(keys[idxPush], values[idxPush]);
+                        }
+                    }
+                    else{
+                        topk.push(&keys[idxval], nbToPush);
+                        topkPairs.push(&keys[idxval], &values[idxval], nbToPush);
+                    }
+                    idxval += nbToPush;
+                }
+
+                if(topk.size() != nbExpected || topkPairs.size() != nbExpected){
+                    std::cout << "Error in TopK, the number of values is " << topk.size() << " should be " << nbExpected << std::endl;
+                    test_res = 1;
+                    return;
+                }
+                std::unique_ptr<NumType[]> res(new NumType[nbExpected]);
+                topk.copyTo(res.get());
+                assertNotEqual(res.get(), expected.get(), int(nbExpected), "TopK");
+
+                std::unique_ptr<NumType[]> resValues(new NumType[nbExpected]);
+                topkPairs.copyTo(res.get(), resValues.get());
+                assertNotEqual(res.get(), expected.get(), int(nbExpected), "kv TopK keys");
+                std::vector<bool> seen(size, false);
+                for(size_t idxval = 0 ; idxval < nbExpected ; ++idxval){
+                    const size_t pos = size_t(resValues[idxval]);
+                    if(pos >= size || seen[pos] || keys[pos] != res[idxval]){
+                        std::cout << "Error in kv TopK, the value " << resValues[idxval] << " is not correct" << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                    seen[pos] = true;
+                }
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testBlockHeap(){
+    std::cout << "Start testBlockHeap...\n";
+    for(size_t size : {size_t(0), size_t(10), size_t(100), size_t(2000), size_t(100000)}){
+        if(size > 1000) std::cout << "   " << size << std::endl;
+        for(size_t range : {size_t(10), size*4 + 1}){
+            std::unique_ptr<NumType[]> keys(new NumType[size]);
+            std::unique_ptr<NumType[]> values(new NumType[size]);
+            for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                keys[idxval] = NumType(int(drand48()*double(range)));
+                values[idxval] = NumType(idxval);
+            }
+            std::unique_ptr<NumType[]> sorted(new NumType[size]);
+            std::copy(&keys[0], &keys[size], sorted.get());
+            std::sort(sorted.get(), sorted.get() + size);
+
+            // Everything pushed then popped by blocks
+            {
+                Sort512::BlockHeap<NumType> heap;
+                Sort512kv::BlockHeap<NumType> heapPairs;
+                heap.push(keys.get(), size);
+                heapPairs.push(keys.get(), values.get(), size);
+                if(heap.size() != size || heapPairs.size() != size){
+                    std::cout << "Error in BlockHeap, the size is " << heap.size() << " should be " << size << std::endl;
+                    test_res = 1;
+                    return;
+                }
+                std::unique_ptr<NumType[]> res(new NumType[size + 16]);
+                std::unique_ptr<NumType[]> resKeys(new NumType[size + 16]);
+                std::unique_ptr<NumType[]> resValues(new NumType[size + 16]);
+                size_t nbPopped = 0;
+                while(!heap.empty()){
+                    nbPopped += heap.popBlock(&res[nbPopped]);
+                }
+                size_t nbPairsPopped = 0;
+                while(!heapPairs.empty()){
+                    nbPairsPopped += heapPairs.popBlock(&resKeys[nbPairsPopped], &resValues[nbPairsPopped]);
+                }
+                if(nbPopped != size || nbPairsPopped != size){
+                    std::cout << "Error in BlockHeap, " << nbPopped << " values popped instead of " << size << std::endl;
+                    test_res = 1;
+                    return;
+                }
+                assertNotEqual(res.get(), sorted.get(), int(size), "BlockHeap popBlock");
+                assertNotEqual(resKeys.get(), sorted.get(), int(size), "kv BlockHeap popBlock");
+                std::vector<bool> seen(size, false);
+                for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                    const size_t pos = size_t(resValues[idxval]);
+                    if(pos >= size || seen[pos] || keys[pos] != resKeys[idxval]){
+                        std::cout << "Error in kv BlockHeap, the value " << resValues[idxval] << " is not correct" << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                    seen[pos] = true;
+                }
+            }
+            // Pushes and pops one by one or by blocks in any order
+            {
+                Sort512::BlockHeap<NumType> heap;
+                Sort512kv::BlockHeap<NumType> heapPairs;
+                std::priority_queue<NumType, std::vector<NumType>, std::greater<NumType>> reference;
+                NumType block[16];
+                NumType blockKeys[16];
+                NumType blockValues[16];
+                for(size_t idxval = 0 ; idxval < size || !reference.empty() ; ){
+                    const size_t nbToPush = std::min(size - idxval, size_t(drand48()*40));
+                    if(nbToPush < 5){
+                        for(size_t idxPush = idxval ; idxPush < idxval + nbToPush ; ++idxPush){
+                            heap.push(keys[idxPush]);
+                            heapPairs.push(keys[idxPush], values[idxPush]);
+                        }
+                    }
+                    else{
+                        heap.push(&keys[idxval], nbToPush);
+                        heapPairs.push(&keys[idxval], &values[idxval], nbToPush);
+                    }
+                    for(size_t idxPush = idxval ; idxPush < idxval + nbToPush ; ++idxPush){
+                        reference.push(keys[idxPush]);
+                    }
+                    idxval += nbToPush;
+
+                    size_t nbToPop = std::min(reference.size(), size_t(drand48()*(idxval < size ? 30 : 60)));
+                    while(nbToPop){
+                        if(drand48() < 0.5){
+                            const size_t nbBlock = heap.popBlock(block);
+                            const size_t nbPairsBlock = heapPairs.popBlock(blockKeys, blockValues);
+                            const size_t nbExpected = std::min(size_t(heap.BlockSize), reference.size());
+                            if(nbBlock != nbExpected || nbPairsBlock != nbExpected){
+                                std::cout << "Error in BlockHeap, " << nbBlock << " values popped instead of "
+                                          << nbExpected << std::endl;
+                                test_res = 1;
+                                return;
+                            }
+                            for(size_t idxBlock = 0 ; idxBlock < nbBlock ; ++idxBlock){
+                                const size_t pos = size_t(blockValues[idxBlock]);
+                                if(block[idxBlock] != reference.top() || blockKeys[idxBlock] != reference.top()
+                                        || keys[pos] != blockKeys[idxBlock]){
+                                    std::cout << "Error in BlockHeap popBlock, the key is " << block[idxBlock]
+                                              << " should be " << reference.top() << std::endl;
+                                    test_res = 1;
+                                    return;
+                                }
+                                reference.pop();
+                            }
+                            nbToPop -= std::min(nbToPop, nbBlock);
+                        }
+                        else{
+                            NumType topKey, topValue, key, value;
+                            heapPairs.top(topKey, topValue);
+                            heapPairs.pop(key, value);
+                            const NumType top = heap.top();
+                            const NumType popped = heap.pop();
+                            if(top != reference.top() || popped != reference.top() || topKey != reference.top()
+                                    || key != reference.top() || keys[size_t(value)] != key){
+                                std::cout << "Error in BlockHeap, the lowest value is " << popped
+                                          << " should be " << reference.top() << std::endl;
+                                test_res = 1;
+                                return;
+                            }
+                            reference.pop();
+                            nbToPop -= 1;
+                        }
+                    }
+                    if(heap.size() != reference.size() || heapPairs.size() != reference.size()){
+                        std::cout << "Error in BlockHeap, the size is " << heap.size()
+                                  << " should be " << reference.size() << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class SortType>
+void testFlatSet(){
+    std::cout << "Start testFlatSet...\n";
+    for(size_t range : {size_t(50), size_t(5000), size_t(1000000)}){
+        std::cout << "   " << range << std::endl;
+        Sort512set::FlatSet<SortType> flatSet;
+        std::set<SortType> reference;
+        for(int idxRound = 0 ; idxRound < 60 ; ++idxRound){
+            // Batches of different sizes, single inserts and erases
+            const size_t batchSize = size_t(drand48()*double(idxRound < 30 ? 40 : 6000));
+            std::vector<SortType> batch(batchSize);
+            for(size_t idxval = 0 ; idxval < batchSize ; ++idxval){
+                batch[idxval] = SortType(drand48()*double(range)) - SortType(range/2);
+                reference.insert(batch[idxval]);
+            }
+            flatSet.insert(batch.data(), batchSize);
+            for(int idxSingle = 0 ; idxSingle < 10 ; ++idxSingle){
+                const SortType value = SortType(drand48()*double(range)) - SortType(range/2);
+                const bool inserted = reference.insert(value).second;
+                if(flatSet.insert(value) != inserted){
+                    std::cout << "Error in FlatSet insert of " << value << std::endl;
+                    test_res = 1;
+                    return;
+                }
+            }
+            for(int idxSingle = 0 ; idxSingle < 10 ; ++idxSingle){
+                const SortType value = SortType(drand48()*double(range)) - SortType(range/2);
+                const bool erased = (reference.erase(value) != 0);
+                if(flatSet.erase(value) != erased){
+                    std::cout << "Error in FlatSet erase of " << value << std::endl;
+                    test_res = 1;
+                    return;
+                }
+            }
+
+            const std::vector<SortType> expected(reference.begin(), reference.end());
+            if(flatSet.size() != expected.size()){
+                std::cout << "Error in FlatSet, the size is " << flatSet.size() << " should be " << expected.size() << std::endl;
+                test_res = 1;
+                return;
+            }
+            assertNotEqual(flatSet.data(), expected.data(), int(expected.size()), "FlatSet");
+
+            // Values around the limits, in the set or not
+            std::vector<SortType> searched = {SortType(-SortType(range)), SortType(range)};
+            for(int idxSearch = 0 ; idxSearch < 200 ; ++idxSearch){
+                searched.push_back(SortType(drand48()*double(range + 20)) - SortType(range/2 + 10));
+            }
+            std::unique_ptr<bool[]> found(new bool[searched.size()]);
+            flatSet.contains(searched.data(), searched.size(), found.get());
+            for(size_t idxSearch = 0 ; idxSearch < searched.size() ; ++idxSearch){
+                const SortType value = searched[idxSearch];
+                const size_t expectedPosition = size_t(std::lower_bound(expected.begin(), expected.end(), value)
+                                                       - expected.begin());
+                if(flatSet.lowerBound(value) != expectedPosition || flatSet.contains(value) != (reference.count(value) != 0)
+                        || found[idxSearch] != (reference.count(value) != 0)){
+                    std::cout << "Error in FlatSet lookup of " << value << ", position " << flatSet.lowerBound(value)
+                              << " should be " << expectedPosition << std::endl;
+                    test_res = 1;
+                    return;
+                }
+            }
+        }
+        flatSet.clear();
+        if(flatSet.size() != 0 || flatSet.contains(0)){
+            std::cout << "Error in FlatSet clear" << std::endl;
+            test_res = 1;
+        }
+    }
+}
+
+template <class NumType>
+void testSlidingWindow(){
+    std::cout << "Start testSlidingWindow...\n";
+    for(size_t windowSize : {size_t(1), size_t(2), size_t(17), size_t(300), size_t(5000)}){
+        if(windowSize > 1000) std::cout << "   " << windowSize << std::endl;
+        for(size_t range : {size_t(10), size_t(1000000)}){
+            Sort512::SlidingWindow<NumType> window(windowSize);
+            std::vector<NumType> history;
+            const size_t nbValues = windowSize*4 + 1000;
+            for(size_t idxval = 0 ; idxval < nbValues ; ++idxval){
+                // Values increasing then random
+                const NumType value = (idxval < nbValues/4 ? NumType(idxval % range) : NumType(drand48()*double(range)));
+                window.push(value);
+                history.push_back(value);
+
+                const size_t nbInWindow = std::min(windowSize, history.size());
+                if(window.size() != nbInWindow){
+                    std::cout << "Error in SlidingWindow, the size is " << window.size() << " should be " << nbInWindow << std::endl;
+                    test_res = 1;
+                    return;
+                }
+                if(idxval % (windowSize/50 + 1) == 0 || idxval + 1 == nbValues){
+                    std::vector<NumType> sorted(history.end() - nbInWindow, history.end());
+                    std::sort(sorted.begin(), sorted.end());
+                    for(size_t rank = 0 ; rank < nbInWindow ; rank += nbInWindow/20 + 1){
+                        if(window.valueAt(rank) != sorted[rank]){
+                            std::cout << "Error in SlidingWindow, the value of rank " << rank << " is " << window.valueAt(rank)
+                                      << " should be " << sorted[rank] << std::endl;
+                            test_res = 1;
+                            return;
+                        }
+                    }
+                    if(window.median() != sorted[(nbInWindow-1)/2] || window.quantile(0) != sorted[0]
+                            || window.quantile(1) != sorted[nbInWindow-1]
+                            || window.quantile(0.9) != sorted[size_t(0.9*double(nbInWindow-1))]){
+                        std::cout << "Error in SlidingWindow, the median is " << window.median()
+                                  << " should be " << sorted[(nbInWindow-1)/2] << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                }
+            }
+            window.clear();
+            window.push(NumType(3));
+            if(window.size() != 1 || window.median() != NumType(3)){
+                std::cout << "Error in SlidingWindow clear" << std::endl;
+                test_res = 1;
+            }
+        }
+    }
+}
+
+template <class NumType>
+void testStaticBTree(){
+    std::cout << "Start testStaticBTree...\n";
+    for(size_t size = 0 ; size <= (1<<20) ; size = (size < 300 ? size + 1 : size * 3 + 7)){
+        if(size > 1000) std::cout << "   " << size << std::endl;
+        for(size_t range : {size_t(5), size*2 + 1}){
+            std::unique_ptr<NumType[]> sorted(new NumType[size]);
+            for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                sorted[idxval] = NumType(int(drand48()*double(range)));
+            }
+            std::sort(sorted.get(), sorted.get() + size);
+
+            // Values in the array, between and outside
+            const size_t nbQueries = std::min(size_t(1000), size + 50);
+            std::unique_ptr<NumType[]> queries(new NumType[nbQueries]);
+            std::unique_ptr<size_t[]> expected(new size_t[nbQueries]);
+            for(size_t idxQuery = 0 ; idxQuery < nbQueries ; ++idxQuery){
+                queries[idxQuery] = NumType(drand48()*double(range + 4)) - NumType(2);
+                expected[idxQuery] = size_t(std::lower_bound(sorted.get(), sorted.get() + size, queries[idxQuery])
+                                            - sorted.get());
+            }
+
+            Sort512::StaticBTree<NumType> tree;
+            tree.build(sorted.get(), size);
+            std::unique_ptr<size_t[]> res(new size_t[nbQueries]);
+            for(size_t idxQuery = 0 ; idxQuery < nbQueries ; ++idxQuery){
+                res[idxQuery] = tree.lowerBound(queries[idxQuery]);
+            }
+            assertNotEqual(res.get(), expected.get(), int(nbQueries), "StaticBTree lowerBound");
+            tree.lowerBound(queries.get(), nbQueries, res.get());
+            assertNotEqual(res.get(), expected.get(), int(nbQueries), "StaticBTree batched lowerBound");
+
+#if defined(_OPENMP)
+            Sort512::StaticBTree<NumType> treeOmp;
+            treeOmp.buildOmp(sorted.get(), size);
+            treeOmp.lowerBoundOmp(queries.get(), nbQueries, res.get());
+            assertNotEqual(res.get(), expected.get(), int(nbQueries), "StaticBTree lowerBoundOmp");
+#endif
+        }
+    }
+}
+
+template <class NumType>
+void testSortOmpSampleSort(){
+#if defined(_OPENMP)
+    std::cout << "Start testSortOmpSampleSort...\n";
+    for(size_t size = 0 ; size <= (1<<21) ; size = (size < 10 ? size + 1 : size * 3 + 7)){
+        if(size > 1000) std::cout << "   " << size << std::endl;
+        // Random, few distinct values, sorted, reversed and mostly the lowest value
+        for(int pattern = 0 ; pattern < 5 ; ++pattern){
+            std::unique_ptr<NumType[]> array(new NumType[size]);
+            createRandVec(array.get(), size);
+            if(pattern == 1){
+                for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                    array[idxval] = NumType(int(drand48()*5));
+                }
+            }
+            else if(pattern == 2){
+                std::sort(array.get(), array.get() + size);
+            }
+            else if(pattern == 3){
+                std::sort(array.get(), array.get() + size, std::greater<NumType>());
+            }
+            else if(pattern == 4){
+                // With a few lower values when there is an infinity
+                for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                    const double dice = drand48();
+                    if(dice < 0.6){
+                        array[idxval] = std::numeric_limits<NumType>::lowest();
+                    }
+                    else if(dice < 0.602 && std::numeric_limits<NumType>::has_infinity){
+                        array[idxval] = -std::numeric_limits<NumType>::infinity();
+                    }
+                }
+            }
+            Checker<NumType> checker(array.get(), array.get(), size);
+            Sort512::SortOmpSampleSort<NumType,size_t>(array.get(), size);
+            assertNotSorted(array.get(), size, "SortOmpSampleSort");
+        }
+    }
+#endif
+}
+
+template <class NumType>
+void testSortRadix(){
+    std::cout << "Start testSortRadix...\n";
+    for(size_t size = 0 ; size <= (1<<21) ; size = (size < 10 ? size + 1 : size * 3 + 7)){
+        if(size > 1000) std::cout << "   " << size << std::endl;
+        // Negative and positive values, all the digits used or only the low ones
+        for(int pattern = 0 ; pattern < 3 ; ++pattern){
+            std::unique_ptr<NumType[]> array(new NumType[size]);
+            for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                if(pattern == 0){
+                    array[idxval] = NumType(int(mrand48()));
+                }
+                else if(pattern == 1){
+                    array[idxval] = NumType(mrand48() % 1000)/NumType(7);
+                }
+                else{
+                    array[idxval] = NumType(lrand48() % 200);
+                }
+            }
+            if(size > 2){
+                array[0] = std::numeric_limits<NumType>::lowest();
+                array[size/2] = std::numeric_limits<NumType>::max();
+            }
+            std::unique_ptr<NumType[]> values(new NumType[size]);
+            for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                values[idxval] = NumType(idxval);
+            }
+            std::unique_ptr<NumType[]> original(new NumType[size]);
+            std::copy(array.get(), array.get() + size, original.get());
+
+            auto checkPairs = [&](const char* log){
+                for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                    if(original[size_t(values[idxval])] != array[idxval]){
+                        std::cout << "Error in " << log << ", pair/key do not match at " << idxval << std::endl;
+                        test_res = 1;
+                        return;
+                    }
+                }
+            };
+            {
+                std::unique_ptr<NumType[]> keys(new NumType[size]);
+                std::copy(array.get(), array.get() + size, keys.get());
+                Checker<NumType> checker(keys.get(), keys.get(), size);
+                Sort512::SortRadix<NumType,size_t>(keys.get(), size);
+                assertNotSorted(keys.get(), size, "SortRadix");
+            }
+            {
+                Checker<NumType> checker(array.get(), array.get(), size);
+                Sort512kv::SortRadix<NumType,size_t>(array.get(), values.get(), size);
+                assertNotSorted(array.get(), size, "SortRadix pair");
+                checkPairs("SortRadix pair");
+            }
+#if defined(_OPENMP)
+            {
+                std::copy(original.get(), original.get() + size, array.get());
+                Checker<NumType> checker(array.get(), array.get(), size);
+                Sort512::SortRadixOmp<NumType,size_t>(array.get(), size);
+                assertNotSorted(array.get(), size, "SortRadixOmp");
+            }
+            {
+                std::copy(original.get(), original.get() + size, array.get());
+                for(size_t idxval = 0 ; idxval < size ; ++idxval){
+                    values[idxval] = NumType(idxval);
+                }
+                Checker<NumType> checker(array.get(), array.get(), size);
+                Sort512kv::SortRadixOmp<NumType,size_t>(array.get(), values.get(), size);
+                assertNotSorted(array.get(), size, "SortRadixOmp pair");
+                checkPairs("SortRadixOmp pair");
+            }
+#endif
+        }
+    }
+}
+
+#if defined(_OPENMP)
+// The parallel functions must not rely on getting the number of threads they
+// ask for, their tests are run again in a nested region (where the team has a
+// single thread) and with the dynamic adjustment of the number of threads
+void testOmpSmallTeams(){
+    std::cout << "Start testOmpSmallTeams...\n";
+    const int nbThreads = omp_get_max_threads();
+    const int maxActiveLevels = omp_get_max_active_levels();
+    const int dynamic = omp_get_dynamic();
+    auto testAll = [](){
+        testQs512<int>();
+        testQs512_pair<double>();
+        testReduceByKey<int,int,Sort512kv::ReduceSum>();
+        testJoin();
+        testSetOperations<int>();
+        testMergeInsert<int>();
+        testPartitionK<int>();
+        testSortOmpSampleSort<int>();
+        testSortRadix<int>();
+    };
+
+    // Several threads are asked whatever the environment
+    omp_set_num_threads(std::max(nbThreads, 4));
+
+    omp_set_max_active_levels(1);
+#pragma omp parallel num_threads(2)
+    {
+#pragma omp single
+        testAll();
+    }
+    omp_set_max_active_levels(maxActiveLevels);
+
+    omp_set_dynamic(1);
+    testAll();
+    omp_set_dynamic(dynamic);
+
+    omp_set_num_threads(nbThreads);
+}
+#endif
+
+
+int main(){
+    testPopcount();
+
+    testSortVec();
+    testSortVec_pair();
+    testSort2Vec();
+    testSort2Vec_pair();
+    testSort3Vec();
+    testSort3Vec_pair();
+    testSort4Vec();
+    testSort4Vec_pair();
+    testSort5Vec();
+    testSort5Vec_pair();
+    testSort6Vec();
+    testSort6Vec_pair();
+    testSort7Vec();
+    testSort7Vec_pair();
+    testSort8Vec();
+    testSort8Vec_pair();
+
+    testSort9Vec();
+    testSort9Vec_pair();
+    testSort10Vec();
+    testSort10Vec_pair();
+    testSort11Vec();
+    testSort11Vec_pair();
+    testSort12Vec();
+    testSort12Vec_pair();
+    testSort13Vec();
+    testSort13Vec_pair();
+    testSort14Vec();
+    testSort14Vec_pair();
+    testSort15Vec();
+    testSort15Vec_pair();
+    testSort16Vec();
+    testSort16Vec_pair();
+
+    testSmallVecSort<int>();
+    testSmallVecSort<double>();
+    testSmallVecSort_pair<int>();
+    testSmallVecSort_pair<double>();
+
+    testQs512<double>();
+    testQs512<int>();
+    testQs512_pair<int>();
+    testQs512_pair<double>();
+
+    testPartition<int>();
+    testPartition<double>();
+    testPartition_pair<int>();
+
+    testPermutation();
+
+    testRank<int>();
+    testRank<double>();
+
+    testSortUnique<int>();
+    testSortUnique<double>();
+
+    testSortRunLength<int>();
+    testSortRunLength<double>();
+
+    testReduceByKey<int, int, Sort512kv::ReduceSum>();
+    testReduceByKey<int, int, Sort512kv::ReduceMin>();
+    testReduceByKey<double, double, Sort512kv::ReduceMax>();
+    testReduceByKey<double, double, Sort512kv::ReduceSum>();
+    testReduceByKey<int, double, Sort512kv::ReduceSum>();
+    testReduceByKey<int, double, Sort512kv::ReduceMin>();
+
+    testJoin();
+
+    testSetOperations<int>();
+    testSetOperations<int64_t>();
+
+    testMergeCompact<int>();
+    testMergeCompact<double>();
+
+    testMerge<int>();
+    testMerge<double>();
+
+    testReorderShifting<int>();
+    testReorderShifting<double>();
+
+    testMergeKWay<int>();
+    testMergeKWay<double>();
+
+    testMergeInsert<int>();
+    testMergeInsert<double>();
+
+    testNthElement<int>();
+    testNthElement<double>();
+
+    testPartialSort<int>();
+    testPartialSort<double>();
+
+    testMultiSelect<int>();
+    testMultiSelect<double>();
+
+    testTopK<int>();
+    testTopK<double>();
+
+    testBlockHeap<int>();
+    testBlockHeap<double>();
+
+    testFlatSet<int>();
+    testFlatSet<int64_t>();
+
+    testSlidingWindow<int>();
+    testSlidingWindow<float>();
+    testSlidingWindow<double>();
+
+    testSearchSorted<int>();
+    testSearchSorted<double>();
+
+    testStaticBTree<int>();
+    testStaticBTree<double>();
+
+    testPartitionK<int>();
+    testPartitionK<double>();
+
+    testSortOmpSampleSort<int>();
+    testSortOmpSampleSort<double>();
+
+    testSortRadix<int>();
+    testSortRadix<double>();
+
+#if defined(_OPENMP)
+    testOmpSmallTeams();
+#endif
 
     if(test_res != 0){
         std::cout << "Test failed!" << std::endl;
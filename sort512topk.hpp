@@ -0,0 +1,313 @@
+//////////////////////////////////////////////////////////
+/// Code to keep the k greatest values of a stream of integers
+/// or doubles (or key/value pairs)
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Classes to use:
+/// Sort512::TopK<SortType>; to keep the k greatest values
+/// Sort512kv::TopK<SortType>; to keep the k pairs with the greatest keys
+///
+/// The values are filtered by the k-th greatest value known (with a vector
+/// compare and a compress store) in a buffer, when the buffer is full
+/// it is sorted and merged with the current k greatest values.
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512TOPK_HPP
+#define SORT512TOPK_HPP
+
+#include <immintrin.h>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+
+#include "sort512.hpp"
+#include "sort512kv.hpp"
+
+namespace Sort512 {
+
+////////////////////////////////////////////////////////////////////////////////
+/// Filter
+////////////////////////////////////////////////////////////////////////////////
+
+// Copy in dest the values greater than threshold (or all of them if
+// filter is false), returns the number of values copied
+template <class IndexType>
+inline IndexType CoreTopKFilter(const int values[], const IndexType size, const int threshold, const bool filter,
+                                int dest[]){
+    const IndexType S = 16;
+    const __m512i thresholdvec = _mm512_set1_epi32(threshold);
+    IndexType nbKept = 0;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask16 remaining = (size - idx >= S ? 0xFFFF : __mmask16(0xFFFF >> (S - (size - idx))));
+        const __m512i vec = _mm512_maskz_loadu_epi32(remaining, &values[idx]);
+        const __mmask16 kept = (filter ? _mm512_mask_cmp_epi32_mask(remaining, vec, thresholdvec, _MM_CMPINT_NLE)
+                                       : remaining);
+        _mm512_mask_compressstoreu_epi32(&dest[nbKept], kept, vec);
+        nbKept += popcount(kept);
+    }
+    return nbKept;
+}
+
+template <class IndexType>
+inline IndexType CoreTopKFilter(const double values[], const IndexType size, const double threshold, const bool filter,
+                                double dest[]){
+    const IndexType S = 8;
+    const __m512d thresholdvec = _mm512_set1_pd(threshold);
+    IndexType nbKept = 0;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask8 remaining = (size - idx >= S ? 0xFF : __mmask8(0xFF >> (S - (size - idx))));
+        const __m512d vec = _mm512_maskz_loadu_pd(remaining, &values[idx]);
+        const __mmask8 kept = (filter ? _mm512_mask_cmp_pd_mask(remaining, vec, thresholdvec, _CMP_GT_OQ)
+                                      : remaining);
+        _mm512_mask_compressstoreu_pd(&dest[nbKept], kept, vec);
+        nbKept += popcount(kept);
+    }
+    return nbKept;
+}
+
+// The pairs whose key is greater than threshold
+template <class IndexType>
+inline IndexType CoreTopKFilter(const int keys[], const int values[], const IndexType size, const int threshold,
+                                const bool filter, int destKeys[], int destValues[]){
+    const IndexType S = 16;
+    const __m512i thresholdvec = _mm512_set1_epi32(threshold);
+    IndexType nbKept = 0;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask16 remaining = (size - idx >= S ? 0xFFFF : __mmask16(0xFFFF >> (S - (size - idx))));
+        const __m512i vec = _mm512_maskz_loadu_epi32(remaining, &keys[idx]);
+        const __mmask16 kept = (filter ? _mm512_mask_cmp_epi32_mask(remaining, vec, thresholdvec, _MM_CMPINT_NLE)
+                                       : remaining);
+        _mm512_mask_compressstoreu_epi32(&destKeys[nbKept], kept, vec);
+        _mm512_mask_compressstoreu_epi32(&destValues[nbKept], kept, _mm512_maskz_loadu_epi32(remaining, &values[idx]));
+        nbKept += popcount(kept);
+    }
+    return nbKept;
+}
+
+template <class IndexType>
+inline IndexType CoreTopKFilter(const double keys[], const double values[], const IndexType size, const double threshold,
+                                const bool filter, double destKeys[], double destValues[]){
+    const IndexType S = 8;
+    const __m512d thresholdvec = _mm512_set1_pd(threshold);
+    IndexType nbKept = 0;
+    for(IndexType idx = 0 ; idx < size ; idx += S){
+        const __mmask8 remaining = (size - idx >= S ? 0xFF : __mmask8(0xFF >> (S - (size - idx))));
+        const __m512d vec = _mm512_maskz_loadu_pd(remaining, &keys[idx]);
+        const __mmask8 kept = (filter ? _mm512_mask_cmp_pd_mask(remaining, vec, thresholdvec, _CMP_GT_OQ)
+                                      : remaining);
+        _mm512_mask_compressstoreu_pd(&destKeys[nbKept], kept, vec);
+        _mm512_mask_compressstoreu_pd(&destValues[nbKept], kept, _mm512_maskz_loadu_pd(remaining, &values[idx]));
+        nbKept += popcount(kept);
+    }
+    return nbKept;
+}
+
+// The buffer is aligned on 64 bytes and can contain a vector more than its capacity
+template <class SortType>
+inline SortType* CoreTopKAlignedBuffer(std::unique_ptr<SortType[]>& memory, const size_t capacity){
+    memory.reset(new SortType[capacity + 2*64/sizeof(SortType)]);
+    const size_t shift = (64 - (reinterpret_cast<std::uintptr_t>(memory.get()) % 64)) % 64;
+    return memory.get() + shift/sizeof(SortType);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Top k
+////////////////////////////////////////////////////////////////////////////////
+
+// Keep the k greatest values pushed (with their duplicates)
+template <class SortType, class IndexType = size_t>
+class TopK {
+    static const IndexType S = 64/sizeof(SortType);
+
+    const IndexType k;
+    const IndexType capacity;
+    // The greatest values, sorted in increasing order
+    std::unique_ptr<SortType[]> best;
+    IndexType nbBest;
+    std::unique_ptr<SortType[]> merged;
+    std::unique_ptr<SortType[]> bufferMemory;
+    SortType* buffer;
+    IndexType nbBuffered;
+
+    bool isFull() const{
+        return nbBest == k;
+    }
+
+public:
+    explicit TopK(const IndexType inK)
+        : k(inK), capacity(std::max(IndexType(1024), ((inK + S - 1)/S)*S)),
+          best(new SortType[inK]), nbBest(0), merged(new SortType[inK + capacity]),
+          buffer(nullptr), nbBuffered(0){
+        buffer = CoreTopKAlignedBuffer(bufferMemory, capacity);
+    }
+
+    TopK(const TopK&) = delete;
+    TopK& operator=(const TopK&) = delete;
+
+    void push(const SortType value){
+        if(k && (!isFull() || best[0] < value)){
+            buffer[nbBuffered++] = value;
+            if(nbBuffered == capacity){
+                flush();
+            }
+        }
+    }
+
+    void push(const SortType values[], const IndexType size){
+        if(k == 0){
+            return;
+        }
+        for(IndexType idx = 0 ; idx < size ; ){
+            const IndexType nbToFilter = std::min(size - idx, capacity - nbBuffered);
+            nbBuffered += CoreTopKFilter(&values[idx], nbToFilter, (isFull() ? best[0] : SortType()), isFull(),
+                                         &buffer[nbBuffered]);
+            idx += nbToFilter;
+            if(nbBuffered == capacity || capacity - nbBuffered < S){
+                flush();
+            }
+        }
+    }
+
+    // Sort the buffer and merge it with the greatest values
+    void flush(){
+        if(nbBuffered == 0){
+            return;
+        }
+        Sort<SortType,IndexType>(buffer, nbBuffered);
+        const IndexType nbMerged = nbBest + nbBuffered;
+        Merge<SortType,IndexType>(best.get(), nbBest, buffer, nbBuffered, merged.get());
+        nbBest = std::min(k, nbMerged);
+        std::copy(&merged[nbMerged - nbBest], &merged[nbMerged], best.get());
+        nbBuffered = 0;
+    }
+
+    // The number of values kept (at most k)
+    IndexType size(){
+        flush();
+        return nbBest;
+    }
+
+    // Copy the values kept in dest, from the greatest one
+    void copyTo(SortType dest[]){
+        flush();
+        std::reverse_copy(best.get(), best.get() + nbBest, dest);
+    }
+
+    void clear(){
+        nbBest = 0;
+        nbBuffered = 0;
+    }
+};
+
+}
+
+namespace Sort512kv {
+
+// Keep the k pairs with the greatest keys (the pairs with a key equal to the
+// k-th greatest one are kept in no particular order)
+template <class SortType, class IndexType = size_t>
+class TopK {
+    static const IndexType S = 64/sizeof(SortType);
+
+    const IndexType k;
+    const IndexType capacity;
+    std::unique_ptr<SortType[]> bestKeys;
+    std::unique_ptr<SortType[]> bestValues;
+    IndexType nbBest;
+    std::unique_ptr<SortType[]> mergedKeys;
+    std::unique_ptr<SortType[]> mergedValues;
+    std::unique_ptr<SortType[]> bufferKeysMemory;
+    std::unique_ptr<SortType[]> bufferValuesMemory;
+    SortType* bufferKeys;
+    SortType* bufferValues;
+    IndexType nbBuffered;
+
+    bool isFull() const{
+        return nbBest == k;
+    }
+
+public:
+    explicit TopK(const IndexType inK)
+        : k(inK), capacity(std::max(IndexType(1024), ((inK + S - 1)/S)*S)),
+          bestKeys(new SortType[inK]), bestValues(new SortType[inK]), nbBest(0),
+          mergedKeys(new SortType[inK + capacity]), mergedValues(new SortType[inK + capacity]),
+          bufferKeys(nullptr), bufferValues(nullptr), nbBuffered(0){
+        bufferKeys = Sort512::CoreTopKAlignedBuffer(bufferKeysMemory, capacity);
+        bufferValues = Sort512::CoreTopKAlignedBuffer(bufferValuesMemory, capacity);
+    }
+
+    TopK(const TopK&) = delete;
+    TopK& operator=(const TopK&) = delete;
+
+    void push(const SortType key, const SortType value){
+        if(k && (!isFull() || bestKeys[0] < key)){
+            bufferKeys[nbBuffered] = key;
+            bufferValues[nbBuffered] = value;
+            nbBuffered += 1;
+            if(nbBuffered == capacity){
+                flush();
+            }
+        }
+    }
+
+    void push(const SortType keys[], const SortType values[], const IndexType size){
+        if(k == 0){
+            return;
+        }
+        for(IndexType idx = 0 ; idx < size ; ){
+            const IndexType nbToFilter = std::min(size - idx, capacity - nbBuffered);
+            nbBuffered += Sort512::CoreTopKFilter(&keys[idx], &values[idx], nbToFilter,
+                                                  (isFull() ? bestKeys[0] : SortType()), isFull(),
+                                                  &bufferKeys[nbBuffered], &bufferValues[nbBuffered]);
+            idx += nbToFilter;
+            if(nbBuffered == capacity || capacity - nbBuffered < S){
+                flush();
+            }
+        }
+    }
+
+    void flush(){
+        if(nbBuffered == 0){
+            return;
+        }
+        Sort<SortType,IndexType>(bufferKeys, bufferValues, nbBuffered);
+        const IndexType nbMerged = nbBest + nbBuffered;
+        Merge<SortType,IndexType>(bestKeys.get(), bestValues.get(), nbBest, bufferKeys, bufferValues, nbBuffered,
+                                  mergedKeys.get(), mergedValues.get());
+        nbBest = std::min(k, nbMerged);
+        std::copy(&mergedKeys[nbMerged - nbBest], &mergedKeys[nbMerged], bestKeys.get());
+        std::copy(&mergedValues[nbMerged - nbBest], &mergedValues[nbMerged], bestValues.get());
+        nbBuffered = 0;
+    }
+
+    IndexType size(){
+        flush();
+        return nbBest;
+    }
+
+    // Copy the pairs kept, from the greatest key
+    void copyTo(SortType destKeys[], SortType destValues[]){
+        flush();
+        std::reverse_copy(bestKeys.get(), bestKeys.get() + nbBest, destKeys);
+        std::reverse_copy(bestValues.get(), bestValues.get() + nbBest, destValues);
+    }
+
+    void clear(){
+        nbBest = 0;
+        nbBuffered = 0;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,197 @@
+//////////////////////////////////////////////////////////
+/// Code of a static search tree over a sorted array
+/// of integers or doubles
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Classes to use:
+/// Sort512::StaticBTree<SortType>; to search many values in a large sorted array
+///
+/// The sorted array is cut in leaves of one vector (16 int or 8 double),
+/// the inner nodes are vectors too and each one has a child more than keys.
+/// The key i of a node is the lowest value of its child i+1, so the child
+/// to visit is the number of keys lower than the value searched (one vector
+/// compare and a popcount). A node is a cache line, the nodes of a level
+/// are stored one after the other and the children of node k are
+/// k*(S+1) ... k*(S+1)+S, such that there is a cache miss per level
+/// instead of one per step of a binary search. The leaves are not copied,
+/// the sorted array must stay alive and unchanged while the tree is used.
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512TREE_HPP
+#define SORT512TREE_HPP
+
+#include <immintrin.h>
+#include <cstdint>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "sort512.hpp"
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+namespace Sort512 {
+
+////////////////////////////////////////////////////////////////////////////////
+/// Static B-tree
+////////////////////////////////////////////////////////////////////////////////
+
+// Search tree built once from a sorted array of int or double,
+// lowerBound gives the same position as std::lower_bound
+template <class SortType, class IndexType = size_t>
+class StaticBTree {
+    typedef CoreSearchVec<SortType> Vec;
+    static const IndexType S = Vec::S;
+    // Number of queries that go down the tree together
+    static const IndexType GroupSize = 32;
+
+    const SortType* sorted;
+    IndexType size;
+    // The inner levels, from the leaves (level 1) to the root
+    std::unique_ptr<SortType[]> nodesMemory;
+    SortType* nodes;
+    // For each level the position of its first node and the number of leaves under a node
+    std::vector<IndexType> levelOffsets;
+    std::vector<IndexType> levelSpans;
+
+    // Set the number of nodes of each level, returns the total number of inner nodes
+    IndexType prepareLevels(){
+        levelOffsets.assign(1, 0);
+        levelSpans.assign(1, 1);
+        IndexType nbNodes = (size + S - 1)/S;
+        IndexType nbInnerNodes = 0;
+        while(nbNodes > 1){
+            nbNodes = (nbNodes + S)/(S + 1);
+            levelOffsets.push_back(nbInnerNodes);
+            levelSpans.push_back(levelSpans.back()*(S + 1));
+            nbInnerNodes += nbNodes;
+        }
+        levelOffsets.push_back(nbInnerNodes);
+        return nbInnerNodes;
+    }
+
+    void allocateNodes(const IndexType nbInnerNodes){
+        nodesMemory.reset(new SortType[nbInnerNodes*S + 64/sizeof(SortType)]);
+        const size_t shift = (64 - (reinterpret_cast<std::uintptr_t>(nodesMemory.get()) % 64)) % 64;
+        nodes = nodesMemory.get() + shift/sizeof(SortType);
+    }
+
+    IndexType nbLevels() const{
+        return IndexType(levelOffsets.size()) - 1;
+    }
+
+    // Fill the node of the level (>= 1), the key i is the first value of the child i+1
+    // (pad value for the children that do not exist)
+    void buildNode(const IndexType level, const IndexType idxNode){
+        SortType* node = &nodes[(levelOffsets[level] + idxNode)*S];
+        for(IndexType idxKey = 0 ; idxKey < S ; ++idxKey){
+            const IndexType firstLeaf = (idxNode*(S + 1) + idxKey + 1)*levelSpans[level - 1];
+            node[idxKey] = (firstLeaf*S < size ? sorted[firstLeaf*S] : CorePadValue<SortType>());
+        }
+    }
+
+    const SortType* node(const IndexType level, const IndexType idxNode) const{
+        return (level == 0 ? &sorted[idxNode*S] : &nodes[(levelOffsets[level] + idxNode)*S]);
+    }
+
+public:
+    StaticBTree() : sorted(nullptr), size(0), nodes(nullptr){
+        prepareLevels();
+    }
+
+    StaticBTree(const StaticBTree&) = delete;
+    StaticBTree& operator=(const StaticBTree&) = delete;
+
+    // Build the inner nodes over the sorted array (which is not copied)
+    void build(const SortType inSorted[], const IndexType inSize){
+        sorted = inSorted;
+        size = inSize;
+        allocateNodes(prepareLevels());
+        for(IndexType level = 1 ; level < nbLevels() ; ++level){
+            for(IndexType idxNode = 0 ; idxNode < levelOffsets[level + 1] - levelOffsets[level] ; ++idxNode){
+                buildNode(level, idxNode);
+            }
+        }
+    }
+
+#if defined(_OPENMP)
+    // The nodes of all the levels are independent and built in parallel
+    void buildOmp(const SortType inSorted[], const IndexType inSize){
+        sorted = inSorted;
+        size = inSize;
+        const IndexType nbInnerNodes = prepareLevels();
+        allocateNodes(nbInnerNodes);
+#pragma omp parallel for schedule(static)
+        for(IndexType idxInnerNode = 0 ; idxInnerNode < nbInnerNodes ; ++idxInnerNode){
+            const IndexType level = IndexType(std::upper_bound(levelOffsets.begin() + 1, levelOffsets.end(), idxInnerNode)
+                                              - levelOffsets.begin()) - 1;
+            buildNode(level, idxInnerNode - levelOffsets[level]);
+        }
+    }
+#endif
+
+    // Position of the first value not lower than value
+    IndexType lowerBound(const SortType value) const{
+        if(size == 0){
+            return 0;
+        }
+        IndexType idxNode = 0;
+        for(IndexType level = nbLevels() - 1 ; level != 0 ; --level){
+            idxNode = idxNode*(S + 1) + IndexType(Vec::CountLower(node(level, idxNode), int(S), value));
+        }
+        return idxNode*S + IndexType(Vec::CountLower(&sorted[idxNode*S], int(std::min(IndexType(S), size - idxNode*S)), value));
+    }
+
+    // out[idx] is the position of the first value not lower than values[idx],
+    // the values go down the tree by groups, a level at a time, and the next
+    // node of each one is prefetched, such that the cache misses of a group overlap
+    void lowerBound(const SortType values[], const IndexType nbValues, IndexType out[]) const{
+        if(size == 0){
+            std::fill(out, out + nbValues, IndexType(0));
+            return;
+        }
+        for(IndexType first = 0 ; first < nbValues ; first += GroupSize){
+            const IndexType nbInGroup = std::min(IndexType(GroupSize), nbValues - first);
+            IndexType idxNodes[GroupSize] = {0};
+            for(IndexType level = nbLevels() - 1 ; level != 0 ; --level){
+                for(IndexType idx = 0 ; idx < nbInGroup ; ++idx){
+                    idxNodes[idx] = idxNodes[idx]*(S + 1)
+                                    + IndexType(Vec::CountLower(node(level, idxNodes[idx]), int(S), values[first + idx]));
+                    _mm_prefetch(reinterpret_cast<const char*>(node(level - 1, idxNodes[idx])), _MM_HINT_T0);
+                }
+            }
+            for(IndexType idx = 0 ; idx < nbInGroup ; ++idx){
+                const IndexType firstValue = idxNodes[idx]*S;
+                out[first + idx] = firstValue + IndexType(Vec::CountLower(&sorted[firstValue], int(std::min(IndexType(S), size - firstValue)),
+                                                                          values[first + idx]));
+            }
+        }
+    }
+
+#if defined(_OPENMP)
+    void lowerBoundOmp(const SortType values[], const IndexType nbValues, IndexType out[]) const{
+        const IndexType nbGroups = (nbValues + GroupSize - 1)/GroupSize;
+#pragma omp parallel for schedule(static)
+        for(IndexType idxGroup = 0 ; idxGroup < nbGroups ; ++idxGroup){
+            const IndexType first = idxGroup*GroupSize;
+            lowerBound(&values[first], std::min(IndexType(GroupSize), nbValues - first), &out[first]);
+        }
+    }
+#endif
+};
+
+}
+
+#endif
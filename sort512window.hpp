@@ -0,0 +1,365 @@
+//////////////////////////////////////////////////////////
+/// Code to get the median or any quantile of the last
+/// values of a stream of integers, floats or doubles
+/// using avx 512 (targeting intel KNL/SKL).
+/// Licence is MIT.
+/// Comes without any warranty.
+///
+///
+/// Classes to use:
+/// Sort512::SlidingWindow<SortType>; to keep the last values sorted
+///
+/// The values of the window are kept sorted in a list of blocks of a
+/// few vectors. A value is inserted in (or removed from) its block with a
+/// vector compare to find its position, an expand load (or a compress store)
+/// on the vector that contains the position and a shift of one lane of the
+/// following vectors. A full block is split in two, a block is merged with
+/// a neighbor when both are less than half full. The rank of the first
+/// value of each block is kept up to date, such that the value of a given
+/// rank is found by a binary search on the blocks and read directly.
+///
+/// To compile such flags can be used to enable avx 512 and openmp:
+/// - KNL
+/// Gcc : -mavx512f -mavx512pf -mavx512er -mavx512cd -fopenmp
+/// Intel : -xCOMMON-AVX512 -xMIC-AVX512 -qopenmp
+/// - SKL
+/// Gcc : -mavx512f -mavx512cd -mavx512vl -mavx512bw -mavx512dq -fopenmp
+/// Intel : -xCOMMON-AVX512 -xCORE-AVX512 -qopenmp
+//////////////////////////////////////////////////////////
+#ifndef SORT512WINDOW_HPP
+#define SORT512WINDOW_HPP
+
+#include <immintrin.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "sort512.hpp"
+
+namespace Sort512 {
+
+////////////////////////////////////////////////////////////////////////////////
+/// Vector operations
+////////////////////////////////////////////////////////////////////////////////
+
+template <class SortType>
+struct CoreWindowVec;
+
+template <>
+struct CoreWindowVec<int> {
+    static const int S = 16;
+    typedef __mmask16 Mask;
+    typedef __m512i VecType;
+
+    static inline VecType Load(const int* ptr){
+        return _mm512_loadu_si512(ptr);
+    }
+    static inline void Store(int* ptr, const VecType vec){
+        _mm512_storeu_si512(ptr, vec);
+    }
+    // The lanes of mask get the values of ptr one after the other, the others are set to value
+    static inline VecType ExpandLoad(const int value, const Mask mask, const int* ptr){
+        return _mm512_mask_expandloadu_epi32(_mm512_set1_epi32(value), mask, ptr);
+    }
+    static inline void CompressStore(int* ptr, const Mask mask, const VecType vec){
+        _mm512_mask_compressstoreu_epi32(ptr, mask, vec);
+    }
+    // Number of values lower (or equal if orEqual) than value in ptr[0 ... nbValues-1]
+    static inline int CountLower(const int* ptr, const int nbValues, const int value, const bool orEqual){
+        const __m512i valuevec = _mm512_set1_epi32(value);
+        int count = 0;
+        for(int idx = 0 ; idx < nbValues ; idx += S){
+            const Mask remaining = (nbValues - idx >= S ? Mask(0xFFFF) : Mask(0xFFFF >> (S - (nbValues - idx))));
+            const __m512i vec = _mm512_maskz_loadu_epi32(remaining, &ptr[idx]);
+            count += popcount(orEqual ? _mm512_mask_cmp_epi32_mask(remaining, vec, valuevec, _MM_CMPINT_LE)
+                                      : _mm512_mask_cmp_epi32_mask(remaining, vec, valuevec, _MM_CMPINT_LT));
+        }
+        return count;
+    }
+};
+
+template <>
+struct CoreWindowVec<float> {
+    static const int S = 16;
+    typedef __mmask16 Mask;
+    typedef __m512 VecType;
+
+    static inline VecType Load(const float* ptr){
+        return _mm512_loadu_ps(ptr);
+    }
+    static inline void Store(float* ptr, const VecType vec){
+        _mm512_storeu_ps(ptr, vec);
+    }
+    static inline VecType ExpandLoad(const float value, const Mask mask, const float* ptr){
+        return _mm512_mask_expandloadu_ps(_mm512_set1_ps(value), mask, ptr);
+    }
+    static inline void CompressStore(float* ptr, const Mask mask, const VecType vec){
+        _mm512_mask_compressstoreu_ps(ptr, mask, vec);
+    }
+    static inline int CountLower(const float* ptr, const int nbValues, const float value, const bool orEqual){
+        const __m512 valuevec = _mm512_set1_ps(value);
+        int count = 0;
+        for(int idx = 0 ; idx < nbValues ; idx += S){
+            const Mask remaining = (nbValues - idx >= S ? Mask(0xFFFF) : Mask(0xFFFF >> (S - (nbValues - idx))));
+            const __m512 vec = _mm512_maskz_loadu_ps(remaining, &ptr[idx]);
+            count += popcount(orEqual ? _mm512_mask_cmp_ps_mask(remaining, vec, valuevec, _CMP_LE_OQ)
+                                      : _mm512_mask_cmp_ps_mask(remaining, vec, valuevec, _CMP_LT_OQ));
+        }
+        return count;
+    }
+};
+
+template <>
+struct CoreWindowVec<double> {
+    static const int S = 8;
+    typedef __mmask8 Mask;
+    typedef __m512d VecType;
+
+    static inline VecType Load(const double* ptr){
+        return _mm512_loadu_pd(ptr);
+    }
+    static inline void Store(double* ptr, const VecType vec){
+        _mm512_storeu_pd(ptr, vec);
+    }
+    static inline VecType ExpandLoad(const double value, const Mask mask, const double* ptr){
+        return _mm512_mask_expandloadu_pd(_mm512_set1_pd(value), mask, ptr);
+    }
+    static inline void CompressStore(double* ptr, const Mask mask, const VecType vec){
+        _mm512_mask_compressstoreu_pd(ptr, mask, vec);
+    }
+    static inline int CountLower(const double* ptr, const int nbValues, const double value, const bool orEqual){
+        const __m512d valuevec = _mm512_set1_pd(value);
+        int count = 0;
+        for(int idx = 0 ; idx < nbValues ; idx += S){
+            const Mask remaining = (nbValues - idx >= S ? Mask(0xFF) : Mask(0xFF >> (S - (nbValues - idx))));
+            const __m512d vec = _mm512_maskz_loadu_pd(remaining, &ptr[idx]);
+            count += popcount(orEqual ? _mm512_mask_cmp_pd_mask(remaining, vec, valuevec, _CMP_LE_OQ)
+                                      : _mm512_mask_cmp_pd_mask(remaining, vec, valuevec, _CMP_LT_OQ));
+        }
+        return count;
+    }
+};
+
+// Insert value at position in the sorted block of nbValues values, the block
+// must be able to contain nbValues + S values
+template <class SortType, class IndexType>
+inline void CoreWindowInsert(SortType block[], const IndexType nbValues, const IndexType position,
+                             const SortType value){
+    typedef CoreWindowVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    const IndexType vecPosition = position/S;
+    // From the end, each vector is moved by one lane
+    for(IndexType idxVec = nbValues/S ; idxVec > vecPosition ; --idxVec){
+        Vec::Store(&block[idxVec*S], Vec::Load(&block[idxVec*S - 1]));
+    }
+    const typename Vec::Mask others = typename Vec::Mask(~(1U << (position - vecPosition*S)));
+    Vec::Store(&block[vecPosition*S], Vec::ExpandLoad(value, others, &block[vecPosition*S]));
+}
+
+// Remove the value at position in the sorted block of nbValues values
+template <class SortType, class IndexType>
+inline void CoreWindowRemove(SortType block[], const IndexType nbValues, const IndexType position){
+    typedef CoreWindowVec<SortType> Vec;
+    const IndexType S = Vec::S;
+    const IndexType vecPosition = position/S;
+    const typename Vec::Mask others = typename Vec::Mask(~(1U << (position - vecPosition*S)));
+    Vec::CompressStore(&block[vecPosition*S], others, Vec::Load(&block[vecPosition*S]));
+    // The next vectors are moved by one lane to the left
+    for(IndexType idxVec = vecPosition + 1 ; idxVec*S < nbValues ; ++idxVec){
+        Vec::Store(&block[idxVec*S - 1], Vec::Load(&block[idxVec*S]));
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Sliding window
+////////////////////////////////////////////////////////////////////////////////
+
+// Keep the last windowSize values pushed, sorted, to get the value of any rank
+template <class SortType, class IndexType = size_t>
+class SlidingWindow {
+    static const IndexType S = CoreWindowVec<SortType>::S;
+    // Number of values in a full block
+    static const IndexType BlockCapacity = 16*S;
+    // A block is stored with a vector more (for the moves by one lane)
+    static const IndexType BlockStride = BlockCapacity + S;
+
+    const IndexType windowSize;
+    // The values in the order they have been pushed (circular)
+    std::unique_ptr<SortType[]> history;
+    IndexType historyFirst;
+    IndexType nbValues;
+
+    // The blocks are stored in slots of the pool in any order
+    std::vector<SortType> pool;
+    std::vector<IndexType> freeSlots;
+    // In the order of the values: the slot, the number of values, the rank
+    // of the first value and the greatest value of each block
+    std::vector<IndexType> blockSlots;
+    std::vector<IndexType> blockSizes;
+    std::vector<IndexType> blockStarts;
+    std::vector<SortType> blockLasts;
+
+    SortType* blockValues(const IndexType idxBlock){
+        return &pool[blockSlots[idxBlock]*BlockStride];
+    }
+
+    IndexType newSlot(){
+        if(freeSlots.empty()){
+            const IndexType nbSlots = IndexType(pool.size()/BlockStride);
+            pool.resize(pool.size() + BlockStride);
+            return nbSlots;
+        }
+        const IndexType slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+
+    void addBlock(const IndexType idxBlock, const IndexType start){
+        blockSlots.insert(blockSlots.begin() + idxBlock, newSlot());
+        blockSizes.insert(blockSizes.begin() + idxBlock, 0);
+        blockStarts.insert(blockStarts.begin() + idxBlock, start);
+        blockLasts.insert(blockLasts.begin() + idxBlock, SortType());
+    }
+
+    void removeBlock(const IndexType idxBlock){
+        freeSlots.push_back(blockSlots[idxBlock]);
+        blockSlots.erase(blockSlots.begin() + idxBlock);
+        blockSizes.erase(blockSizes.begin() + idxBlock);
+        blockStarts.erase(blockStarts.begin() + idxBlock);
+        blockLasts.erase(blockLasts.begin() + idxBlock);
+    }
+
+    // The first block whose greatest value is not lower than value (or the last block)
+    IndexType findBlock(const SortType value) const{
+        const IndexType idxBlock = IndexType(std::lower_bound(blockLasts.begin(), blockLasts.end(), value)
+                                             - blockLasts.begin());
+        return std::min(idxBlock, IndexType(blockLasts.size() - 1));
+    }
+
+    void shiftStarts(const IndexType firstBlock, const IndexType shift){
+        for(IndexType idxBlock = firstBlock ; idxBlock < IndexType(blockStarts.size()) ; ++idxBlock){
+            blockStarts[idxBlock] += shift;
+        }
+    }
+
+    void insert(const SortType value){
+        if(blockSlots.empty()){
+            addBlock(0, 0);
+        }
+        const IndexType idxBlock = findBlock(value);
+        SortType* values = blockValues(idxBlock);
+        const IndexType position = IndexType(CoreWindowVec<SortType>::CountLower(values, int(blockSizes[idxBlock]),
+                                                                                 value, true));
+        CoreWindowInsert(values, blockSizes[idxBlock], position, value);
+        blockSizes[idxBlock] += 1;
+        blockLasts[idxBlock] = values[blockSizes[idxBlock] - 1];
+        shiftStarts(idxBlock + 1, 1);
+
+        if(blockSizes[idxBlock] == BlockCapacity){
+            // The greatest half goes in a new block
+            const IndexType half = BlockCapacity/2;
+            addBlock(idxBlock + 1, blockStarts[idxBlock] + half);
+            std::copy(&blockValues(idxBlock)[half], &blockValues(idxBlock)[BlockCapacity], blockValues(idxBlock + 1));
+            blockSizes[idxBlock + 1] = BlockCapacity - half;
+            blockLasts[idxBlock + 1] = blockLasts[idxBlock];
+            blockSizes[idxBlock] = half;
+            blockLasts[idxBlock] = blockValues(idxBlock)[half - 1];
+        }
+    }
+
+    // Merge the block with the next one if they are both small enough
+    void mergeIfSmall(const IndexType idxBlock){
+        if(idxBlock + 1 < IndexType(blockSlots.size())
+                && blockSizes[idxBlock] + blockSizes[idxBlock + 1] <= BlockCapacity/2){
+            std::copy(blockValues(idxBlock + 1), blockValues(idxBlock + 1) + blockSizes[idxBlock + 1],
+                      blockValues(idxBlock) + blockSizes[idxBlock]);
+            blockSizes[idxBlock] += blockSizes[idxBlock + 1];
+            blockLasts[idxBlock] = blockLasts[idxBlock + 1];
+            removeBlock(idxBlock + 1);
+        }
+    }
+
+    // The value must be in the window
+    void remove(const SortType value){
+        const IndexType idxBlock = findBlock(value);
+        SortType* values = blockValues(idxBlock);
+        const IndexType position = IndexType(CoreWindowVec<SortType>::CountLower(values, int(blockSizes[idxBlock]),
+                                                                                 value, false));
+        CoreWindowRemove(values, blockSizes[idxBlock], position);
+        blockSizes[idxBlock] -= 1;
+        shiftStarts(idxBlock + 1, IndexType(-1));
+
+        if(blockSizes[idxBlock] == 0){
+            removeBlock(idxBlock);
+        }
+        else{
+            blockLasts[idxBlock] = values[blockSizes[idxBlock] - 1];
+            mergeIfSmall(idxBlock);
+            if(idxBlock){
+                mergeIfSmall(idxBlock - 1);
+            }
+        }
+    }
+
+public:
+    explicit SlidingWindow(const IndexType inWindowSize)
+        : windowSize(inWindowSize), history(new SortType[inWindowSize]), historyFirst(0), nbValues(0){
+    }
+
+    SlidingWindow(const SlidingWindow&) = delete;
+    SlidingWindow& operator=(const SlidingWindow&) = delete;
+
+    // Add a value, the oldest one is removed if the window is full
+    void push(const SortType value){
+        if(windowSize == 0){
+            return;
+        }
+        if(nbValues == windowSize){
+            remove(history[historyFirst]);
+            history[historyFirst] = value;
+            historyFirst = (historyFirst + 1 == windowSize ? 0 : historyFirst + 1);
+        }
+        else{
+            history[(historyFirst + nbValues) % windowSize] = value;
+            nbValues += 1;
+        }
+        insert(value);
+    }
+
+    // The number of values in the window (at most windowSize)
+    IndexType size() const{
+        return nbValues;
+    }
+
+    // The value of position rank if the window was sorted, rank must be lower than size()
+    SortType valueAt(const IndexType rank) const{
+        const IndexType idxBlock = IndexType(std::upper_bound(blockStarts.begin(), blockStarts.end(), rank)
+                                             - blockStarts.begin()) - 1;
+        return pool[blockSlots[idxBlock]*BlockStride + rank - blockStarts[idxBlock]];
+    }
+
+    // The value of rank quantile*(size()-1) (rounded down), the window must not be empty
+    SortType quantile(const double quantile) const{
+        return valueAt(std::min(nbValues - 1, IndexType(quantile*double(nbValues - 1))));
+    }
+
+    // The lower median if the number of values is even
+    SortType median() const{
+        return valueAt((nbValues - 1)/2);
+    }
+
+    void clear(){
+        historyFirst = 0;
+        nbValues = 0;
+        pool.clear();
+        freeSlots.clear();
+        blockSlots.clear();
+        blockSizes.clear();
+        blockStarts.clear();
+        blockLasts.clear();
+    }
+};
+
+}
+
+#endif